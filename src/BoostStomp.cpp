@@ -26,6 +26,7 @@ http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
 // http://www.boost.org/doc/libs/1_46_1/doc/html/boost_asio/example/timeouts/async_tcp_client.cpp
 
 #include <iostream>
+#include <sched.h>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/buffer.hpp>
@@ -42,38 +43,128 @@ namespace STOMP {
   using namespace boost::asio;
   using boost::asio::ip::tcp;
 
-  // used by debug_print
-  boost::mutex global_stream_lock;
+  // client debug messages, enabled per instance by enable_debug_msgs()
+#define STOMP_DEBUG(...) STOMP_LOG_IF(m_showDebug, ::STOMP::log::LOG_DEBUG, this, __VA_ARGS__)
+#define STOMP_TRACE(...) STOMP_LOG_IF(m_showDebug, ::STOMP::log::LOG_TRACE, this, __VA_ARGS__)
   
+  // STOMP server command handler methods, indexed by stomp_command.
+  // Custom commands are looked up in cmd_map instead.
+  const pfnStompCommandHandler_t BoostStomp::s_dispatch[CMD_COUNT] = {
+	  NULL, // CMD_UNKNOWN
+	  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, // client commands
+	  &BoostStomp::process_CONNECTED,
+	  &BoostStomp::process_MESSAGE,
+	  &BoostStomp::process_RECEIPT,
+	  &BoostStomp::process_ERROR
+  };
+
+  // receipt id of the DISCONNECT that ends a session when moving to a better broker
+  static const char* const FAILBACK_RECEIPT = "failback";
+  const int BoostStomp::FAILBACK_INTERVAL;
+  const size_t BoostStomp::RECEIVE_BUFFER_MIN;
+  const size_t BoostStomp::GATHER_MIN_BODY;
+
   // ----------------------------
   // constructor
   // ----------------------------
-  BoostStomp::BoostStomp(string& hostname, int& port, AckMode ackmode /*= ACK_AUTO*/):
+  BoostStomp::BoostStomp(string& hostname, int& port, AckMode ackmode /*= ACK_AUTO*/, const TransportOptions& options):
+  // ----------------------------
+    BoostStomp(boost::shared_ptr<Transport>(new TcpTransport(hostname, port)), ackmode, options)
+  {
+	  m_port = port;
+  }
+
+  // ----------------------------
+  BoostStomp::BoostStomp(const string& uri, AckMode ackmode /*= ACK_AUTO*/, const TransportOptions& options):
+  // ----------------------------
+    BoostStomp(Transport::from_uri(uri), ackmode, options)
+  {
+  }
+
+  // ----------------------------
+  BoostStomp::BoostStomp(boost::shared_ptr<Transport> transport, AckMode ackmode /*= ACK_AUTO*/, const TransportOptions& options):
+  // ----------------------------
+    BoostStomp(NULL, transport, ackmode, options)
+  {
+  }
+
+  // ----------------------------
+  BoostStomp::BoostStomp(StompReactor& reactor, const string& uri, AckMode ackmode /*= ACK_AUTO*/, const TransportOptions& options):
+  // ----------------------------
+    BoostStomp(&reactor, Transport::from_uri(uri), ackmode, options)
+  {
+  }
+
+  // ----------------------------
+  BoostStomp::BoostStomp(StompReactor& reactor, boost::shared_ptr<Transport> transport, AckMode ackmode /*= ACK_AUTO*/, const TransportOptions& options):
+  // ----------------------------
+    BoostStomp(&reactor, transport, ackmode, options)
+  {
+  }
+
+  // ----------------------------
+  BoostStomp::BoostStomp(StompReactor* reactor, boost::shared_ptr<Transport> transport, AckMode ackmode, const TransportOptions& options):
   // ----------------------------
 	// protected members setup
 	//m_sendqueue 		(new std::queue<Frame*>()),
 	//m_sendqueue_mutex 	(new boost::mutex()),
-    m_hostname	(hostname),
-    m_port		(port),
+    m_hostname	(transport->host()),
+    m_port		(0),
     m_ackmode	(ackmode),
     m_stopped	(true),
     m_connected	(false),
-    m_io_service		(new io_service()),
-    m_io_service_work	(new io_service::work(*m_io_service)),
+    m_reactor			(reactor),
+    m_reactor_thread	(reactor ? reactor->attach() : 0),
+    m_io_service		(reactor ? reactor->io_service(m_reactor_thread) : boost::shared_ptr<io_service>(new io_service())),
+    m_io_service_work	(reactor ? NULL : new io_service::work(*m_io_service)),
     m_strand			(new io_service::strand(*m_io_service)),
-    m_socket			(new tcp::socket(*m_io_service)),
+    m_transport			(transport),
+    m_socket			(new Transport::socket_type(*m_io_service)),
+    m_stream			(*m_socket),
+    m_options			(options),
+    stomp_request		(new boost::asio::streambuf()),
+    stomp_response		(new boost::asio::streambuf(ReceiveLimits().max_buffered_bytes)),
     // private members
-    m_protocol_version("1.0"),
-    m_transaction_id(0)
+    worker_thread(NULL),
+    m_heartbeat_timer(*m_io_service, reactor, m_reactor_thread),
+    m_retry_timer(*m_io_service, reactor, m_reactor_thread),
+    m_pacing_timer(*m_io_service),
+    m_pacing_armed(false),
+    m_failback_timer(*m_io_service, reactor, m_reactor_thread),
+    m_draining(false),
+    m_codec(&FrameCodec::for_version(STOMP_1_2)),
+    m_transaction_id(0),
+    m_receipt_id(0),
+    m_nagle_mode(TransportOptions::NAGLE_ON),
+    m_frames_sent(0), m_bytes_sent(0), m_write_batches(0), m_corked_batches(0), m_frames_received(0), m_paced_waits(0),
+    m_dedup_lookups(0), m_dedup_hits(0), m_write_wakeups(0),
+    m_filter_checks(0), m_filter_rejects(0),
+    m_write_scheduled(false),
+    m_rcvd_duplicate(false),
+    m_rcvd_rejected(false),
+    m_rcvd_action(FILTER_ACK),
+    m_tracing(false), m_trace_every(0), m_trace_counter(0), m_trace_pending(0), m_rcvd_traced_at(0),
+    m_rcvd_spare(NULL),
+    m_error_callback(NULL),
+    m_rcvd_header_bytes(0), m_rcvd_bodysize(0), m_recent_frame(0),
+    m_receive_capacity(0), m_receive_shrinks(0),
+    m_io_pinned(false),
+    m_relocate_response(false),
+    m_io_sleeps(0),
+    m_read_holds(0),
+    m_read_paused(false)
   // ----------------------------
   {
-		// map STOMP server commands to handler methods
-		cmd_map["CONNECTED"] = &BoostStomp::process_CONNECTED;
-		cmd_map["MESSAGE"] 	= &BoostStomp::process_MESSAGE;
-		cmd_map["RECEIPT"] 	= &BoostStomp::process_RECEIPT;
-		cmd_map["ERROR"] 	= &BoostStomp::process_ERROR;
 		// set default debug flag
 		m_showDebug = false;
+		m_rcvd_frame = NULL;
+		stomp_response->prepare(RECEIVE_BUFFER_MIN);
+		m_receive_capacity = stomp_response->capacity();
+		if (m_reactor && m_reactor->options().numa_local_buffers) {
+			// the reactor thread is placed already, move our buffers over
+			m_threading.numa_local_buffers = true;
+			m_strand->post(boost::bind(&BoostStomp::apply_thread_options, this));
+		}
   }
 
 
@@ -83,27 +174,155 @@ namespace STOMP {
   BoostStomp::~BoostStomp()
   // ----------------------------
   {
+	  cancel();
+	  for (subscription_queue_map::iterator it = m_subscription_queues.begin(); it != m_subscription_queues.end(); it++)
+		  it->second->detach();
+	  if (m_reactor) {
+		  leave_reactor();
+		  delete m_rcvd_frame;
+		  delete m_rcvd_spare;
+		  return;
+	  }
+	  m_stopped = true;
 	  // first stop io_service so as to exit the run loop (when idle)
 	  m_io_service->stop();
-	  // then interrupt the worker thread
-	  worker_thread->interrupt();
+	  // then interrupt the worker thread and wait for it, it still uses this object
+	  if (worker_thread) {
+		  worker_thread->interrupt();
+		  worker_thread->join();
+	  }
 	  // delete m_heartbeat_timer; // no need, its a shared_ptr
 	  delete worker_thread;
+	  delete m_rcvd_frame;
+	  delete m_rcvd_spare;
   }
 
+  // ----------------------------
+  // leaving the reactor: the io_service goes on, so no handler of ours may
+  // be left in it. Stop on the IO thread (the socket's operations complete
+  // as aborted), wait until what got queued meanwhile has gone through, and
+  // drop our timers from the wheel on the IO thread, where they fire.
+  // ----------------------------
+  void BoostStomp::leave_reactor()
+  {
+	  stop();
+	  if (on_io_thread()) {
+		  reactor_barrier(NULL, 1);
+	  } else {
+		  std::promise<void> done;
+		  m_strand->post(boost::bind(&BoostStomp::reactor_barrier, this, &done, 2));
+		  done.get_future().wait();
+	  }
+	  m_reactor->detach(m_reactor_thread);
+  }
+
+  void BoostStomp::reactor_barrier(std::promise<void>* done, int rounds)
+  {
+	  // once more at the back of the queue: the aborted handlers queued
+	  // before the first round may post to the strand once again
+	  if (--rounds > 0) {
+		  m_io_service->post(m_strand->wrap(boost::bind(&BoostStomp::reactor_barrier, this, done, rounds)));
+		  return;
+	  }
+	  m_heartbeat_timer.cancel();
+	  m_retry_timer.cancel();
+	  m_failback_timer.cancel();
+	  if (done) done->set_value();
+  }
+
+  // end of the header block: a blank line. Lines end with \n, or \r\n in STOMP 1.2
+  typedef boost::asio::buffers_iterator<boost::asio::streambuf::const_buffers_type> sb_iterator;
+  static std::pair<sb_iterator, bool> match_end_of_headers(sb_iterator begin, sb_iterator end)
+  {
+	  for (sb_iterator i = begin; i != end; ++i) {
+		  if (*i != '\n') continue;
+		  sb_iterator j = i;
+		  if (++j != end && *j == '\r') ++j;
+		  if (j == end) return std::make_pair(i, false); // partial match, resume from i
+		  if (*j == '\n') return std::make_pair(++j, true);
+	  }
+	  return std::make_pair(end, false);
+  }
+
+  // end of a body without content-length: the NULL octet
+  static std::pair<sb_iterator, bool> match_end_of_body(sb_iterator begin, sb_iterator end)
+  {
+	  sb_iterator i = std::find(begin, end, '\0');
+	  return (i == end) ? std::make_pair(end, false) : std::make_pair(++i, true);
+  }
+
+  // A match condition that gives up once the buffer holds more than limit
+  // bytes, reporting a match at the end of the data: a header block or body
+  // that never ends cannot grow the buffer past the receive limits. The read
+  // handler then sees more than limit bytes transferred.
+  class bounded_match {
+  public:
+	  typedef std::pair<sb_iterator, bool> result_type;
+	  typedef result_type (*matcher_t)(sb_iterator, sb_iterator);
+
+	  bounded_match(matcher_t matcher, const boost::asio::streambuf* buffer, size_t limit):
+		  m_matcher(matcher), m_buffer(buffer), m_limit(limit) {};
+	  result_type operator()(sb_iterator begin, sb_iterator end) const {
+		  result_type r = m_matcher(begin, end);
+		  if (!r.second && (m_buffer->size() > m_limit)) return result_type(end, true);
+		  return r;
+	  }
+  private:
+	  matcher_t 						m_matcher;
+	  const boost::asio::streambuf* 	m_buffer;
+	  size_t 						m_limit;
+  };
+
   // ----------------------------
   // worker thread
   // ----------------------------
   void BoostStomp::worker( boost::shared_ptr< boost::asio::io_service > _io_service )
   {
-	  debug_print("Worker thread: starting...");
+	  STOMP_DEBUG("Worker thread: starting...");
+	  apply_thread_options();
 	  while(!m_stopped) {
-		  _io_service->run();
-		  debug_print("Worker thread: io_service is stopped...");
+		  run_io(*_io_service);
+		  STOMP_DEBUG("Worker thread: io_service is stopped...");
 		  _io_service->reset();
-		  sleep(1);
+		  boost::this_thread::sleep(boost::posix_time::seconds(1));
+	  }
+	  STOMP_DEBUG("Worker thread finished.");
+  }
+
+  // ----------------------------
+  // the IO loop, until the io_service is stopped
+  // ----------------------------
+  void BoostStomp::run_io( boost::asio::io_service& io )
+  {
+	  run_io_service(io, m_threading, m_io_sleeps);
+  }
+
+  // ----------------------------
+  // pin the IO thread, and move its buffers to its NUMA node (IO thread only)
+  // ----------------------------
+  void BoostStomp::apply_thread_options()
+  {
+	  if (!m_threading.io_cpus.empty() || m_io_pinned) {
+		  boost::system::error_code ec = pin_current_thread(m_threading.io_cpus);
+		  if (ec) {
+			  STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "cannot pin the IO thread to CPUs %1%: %2%",
+					  format_cpu_set(m_threading.io_cpus), ec.message());
+		  } else {
+			  m_io_pinned = !m_threading.io_cpus.empty();
+			  STOMP_DEBUG("IO thread on CPUs %1% (node %2%), %3% wait", format_cpu_set(m_threading.io_cpus),
+					  cpu_node(sched_getcpu()), ThreadOptions::wait_name(m_threading.wait));
+		  }
+	  }
+	  if (m_threading.numa_local_buffers) {
+		  // first touch from this thread places the pages on its node. Writes
+		  // are synchronous, the send buffer is free in between; the read
+		  // buffer may belong to a pending read, it moves after the next frame.
+		  boost::asio::streambuf* sb = new boost::asio::streambuf();
+		  sb->prepare(std::max(stomp_request->capacity(), size_t(OutputScheduler::BATCH_BYTES)));
+		  sb->sputn(boost::asio::buffer_cast<const char*>(stomp_request->data()), stomp_request->size());
+		  stomp_request.reset(sb);
+		  m_relocate_response = true;
 	  }
-	  debug_print("Worker thread finished.");
   }
 
 
@@ -113,25 +332,26 @@ namespace STOMP {
 
 
   // Called by the user of the client class to initiate the connection process.
-  // The endpoint iterator will have been obtained using a tcp::resolver.
+  // Connecting is asynchronous: the client is usable once is_connected(),
+  // or use async_connect() to be told.
   void BoostStomp::start(string& login, string& passcode)
   {
-	debug_print("starting...");
+	STOMP_DEBUG("starting...");
+	// remember the credentials for reconnects
+	m_login = login;
+	m_passcode = passcode;
 	m_stopped = false;
-	tcp::resolver 	resolver(*m_io_service);
-	tcp::resolver::iterator endpoint_iter = resolver.resolve(tcp::resolver::query(
-			m_hostname,
-	  		to_string<int>(m_port, std::dec),
-	  		boost::asio::ip::resolver_query_base::numeric_service)
-	);
+	m_retry_timer.cancel();
     // Start the connect actor.
-    start_connect(endpoint_iter, login, passcode);
+	m_strand->post(boost::bind(&BoostStomp::start_connect, this));
+    // start worker thread (m_io_service.run()), unless a reactor runs it
+    if ((worker_thread == NULL) && (m_reactor == NULL))
+    	worker_thread = new boost::thread( boost::bind( &BoostStomp::worker, this, m_io_service ) );
   }
 
   void BoostStomp::start()
   {
-    std::string empty = "";
-    start(empty, empty);
+    start(m_login, m_passcode);
   }
 
   // This function terminates all the actors to shut down the connection. It
@@ -139,76 +359,231 @@ namespace STOMP {
   // response to graceful termination or an unrecoverable error.
   void BoostStomp::stop()
   {
-	debug_print("stopping...");
+	if (((worker_thread == NULL) && (m_reactor == NULL)) || on_io_thread()) {
+		do_stop();
+		return;
+	}
+	// called from another thread: the stream (a TLS session in particular)
+	// must only be used from the IO thread, so stop from there and wait
+	std::promise<void> done;
+	m_strand->post(boost::bind(&BoostStomp::stop_and_signal, this, &done));
+	done.get_future().wait();
+  }
+
+  bool BoostStomp::on_io_thread() const
+  {
+	if (m_reactor) return m_reactor->on_thread(m_reactor_thread);
+	return (worker_thread != NULL) && (boost::this_thread::get_id() == worker_thread->get_id());
+  }
+
+  void BoostStomp::stop_and_signal(std::promise<void>* done)
+  {
+	do_stop();
+	done->set_value();
+  }
+
+  void BoostStomp::do_stop()
+  {
+	STOMP_DEBUG("stopping...");
 	if (m_connected && m_socket->is_open()) {
-	  Frame frame( "DISCONNECT");
-	  frame.encode(stomp_request);
-	  debug_print("Sending DISCONNECT frame...");
-	  boost::asio::write(*m_socket, stomp_request);
+	  Frame frame( CMD_DISCONNECT );
+	  frame.encode(*stomp_request, *m_codec.load());
+	  STOMP_DEBUG("Sending DISCONNECT frame...");
+	  // the peer may be gone already, this is best effort
+	  boost::system::error_code ignored;
+	  boost::asio::write(m_stream, *stomp_request, ignored);
 	}
 	m_connected = false;
     m_stopped = true;
-    if (m_heartbeat_timer != NULL) {
-    	m_heartbeat_timer->cancel();
-    }
+    m_retry_timer.cancel();
+    m_pacing_timer.cancel();
+    m_failback_timer.cancel();
+    m_draining = false;
+    // a connect still racing belongs to this stop
+    m_transport->cancel();
+    // receipts for frames sent on this connection will never arrive
+    fail_receipt_waiters(boost::asio::error::connection_aborted);
+    m_heartbeat_timer.cancel();
     //
-    m_socket->close();
+    boost::system::error_code ignored;
+    m_socket->close(ignored);
     //
   }
 
 
   //
   // --------------------------------------------------
-  // ---------- TCP CONNECTION SETUP ------------------
+  // ---------- TRANSPORT CONNECTION SETUP ------------
   // --------------------------------------------------
 
   // --------------------------------------------------
-  void BoostStomp::start_connect(tcp::resolver::iterator endpoint_iter, string& login, string& passcode)
+  void BoostStomp::start_connect()
   // --------------------------------------------------
   {
-    if (endpoint_iter != tcp::resolver::iterator())
-    {
-      debug_print(boost::format("STOMP: Connecting to %1%...") % endpoint_iter->endpoint() );
-
-      // Try TCP connection synchronously (the first frame to send is the CONNECT frame)
-      boost::system::error_code ec;
-      m_socket->connect(endpoint_iter->endpoint(), ec);
-      if (!ec) {
-          // now we are connected to STOMP server's TCP port/
-          debug_print(boost::format("STOMP TCP connection to %1% is active") % endpoint_iter->endpoint() );
-
-    	  // Send the CONNECT request synchronously (immediately).
-    	  hdrmap headers;
-    	  headers["accept-version"] = "1.1";
-    	  headers["host"] = m_hostname;
-          if (!login.empty()) {
-			headers["login"] = login;
-            headers["passcode"] = passcode;
-		  }
-    	  Frame frame( "CONNECT", headers );
-    	  frame.encode(stomp_request);
-    	  debug_print("Sending CONNECT frame...");
-    	  boost::asio::write(*m_socket, stomp_request);
-    	  // start the read actor so as to receive the CONNECTED frame
-          start_stomp_read_headers();
-          // start worker thread (m_io_service.run())
-          worker_thread = new boost::thread( boost::bind( &BoostStomp::worker, this, m_io_service ) );
-      } else {
-          // We need to close the socket used in the previous connection attempt
-          // before starting a new one.
-          m_socket->close();
-          // Try the next available endpoint.
-          start_connect(++endpoint_iter, login, passcode);
-      }
-    }
-    else
-    {
-      // There are no more endpoints to try.
-      stop();
-      debug_print("Connection unsuccessful. Sleeping, then retrying...");
-      sleep(3);
-      start();
-    }
+	  if (m_stopped) return;
+	  // a TLS session belongs to the previous connection
+	  m_stream.reset();
+	  m_transport->async_connect(*m_socket, m_strand->wrap(
+			  boost::bind(&BoostStomp::handle_connect, this, boost::asio::placeholders::error)));
+	  STOMP_DEBUG("STOMP: Connecting to %1%...", m_transport->describe());
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::handle_connect(const boost::system::error_code& ec)
+  // --------------------------------------------------
+  {
+	  if ((m_stopped) || (ec == boost::asio::error::operation_aborted)) return;
+	  if (ec) {
+		  retry_connect(ec);
+		  return;
+	  }
+	  m_nagle_mode = m_transport->configure(*m_socket, m_options);
+	  STOMP_DEBUG("STOMP connection to %1% is active (%2%)", m_transport->describe(),
+			  TransportOptions::nagle_name(TransportOptions::NagleMode(m_nagle_mode.load())));
+	  // TLS transports run their handshake here, the others complete right away
+	  m_transport->async_handshake(m_stream, m_strand->wrap(
+			  boost::bind(&BoostStomp::handle_handshake, this, boost::asio::placeholders::error)));
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::handle_handshake(const boost::system::error_code& ec)
+  // --------------------------------------------------
+  {
+	  if (m_stopped) return;
+	  if (ec) {
+		  retry_connect(ec);
+		  return;
+	  }
+	  if (m_stream.secure())
+		  STOMP_DEBUG("TLS: %1% session", (SSL_session_reused(m_stream.tls().native_handle()) ? "resumed" : "new"));
+	  // Send the CONNECT request synchronously (immediately).
+	  hdrmap headers;
+	  headers["accept-version"] = stomp_accept_versions;
+	  headers["host"] = m_hostname;
+	  if (!m_login.empty()) {
+		  headers["login"] = m_login;
+		  headers["passcode"] = m_passcode;
+	  }
+	  Frame frame( CMD_CONNECT, headers );
+	  // until CONNECTED tells us otherwise, use the most tolerant parser (\r\n line
+	  // endings). CONNECT and CONNECTED headers are never escaped anyway.
+	  m_codec = &FrameCodec::for_version(STOMP_1_2);
+	  // drop whatever a failed write left behind on the previous connection
+	  stomp_request->consume(stomp_request->size());
+	  // a replay of the capture starts from here
+	  if (CaptureWriter* capture = m_stream.capture()) capture->record(CAPTURE_OPEN, NULL, 0);
+	  frame.encode(*stomp_request, *m_codec.load());
+	  STOMP_DEBUG("Sending CONNECT frame...");
+	  m_connect_sent = boost::posix_time::microsec_clock::universal_time();
+	  boost::system::error_code wec;
+	  boost::asio::write(m_stream, *stomp_request, wec);
+	  if (wec) {
+		  retry_connect(wec);
+		  return;
+	  }
+	  // start the read actor so as to receive the CONNECTED frame: a new
+	  // connection always starts reading, whatever paused the previous one
+	  stomp_response->consume(stomp_response->size());
+	  m_read_paused = false;
+	  start_stomp_read_headers();
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::retry_connect(const boost::system::error_code& ec)
+  // --------------------------------------------------
+  {
+	  // The transport has tried every endpoint it knows of.
+	  STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "Cannot connect to %1%: %2%", m_transport->describe(), ec.message());
+	  m_transport->failed();
+	  stop();
+	  STOMP_DEBUG("Connection unsuccessful. Retrying in 3 seconds...");
+	  m_retry_timer.async_wait(boost::posix_time::seconds(3),
+			  boost::bind(&BoostStomp::handle_retry_timer, this, boost::asio::placeholders::error));
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::handle_retry_timer(const boost::system::error_code& ec)
+  // --------------------------------------------------
+  {
+	  // cancelled by stop() or an explicit start()
+	  if (!ec) start();
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::connection_lost()
+  // --------------------------------------------------
+  {
+	  // on the IO thread, after a read or write error: reconnect,
+	  // the transport ranks the broker down first
+	  if (m_draining) {
+		  // the broker we are leaving hung up, that's fine
+		  switch_broker();
+		  return;
+	  }
+	  m_transport->failed();
+	  stop();
+	  start();
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::start_failback_timer(const boost::posix_time::time_duration& delay)
+  // --------------------------------------------------
+  {
+	  m_failback_timer.async_wait(delay, m_strand->wrap(
+			  boost::bind(&BoostStomp::handle_failback_timer, this, boost::asio::placeholders::error)));
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::handle_failback_timer(const boost::system::error_code& ec)
+  // --------------------------------------------------
+  {
+	  if ((m_stopped) || (ec == boost::asio::error::operation_aborted)) return;
+	  if (m_draining) {
+		  STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "no receipt for DISCONNECT from %1%, moving on anyway", m_transport->describe());
+		  switch_broker();
+		  return;
+	  }
+	  if (!m_connected || m_transport->preferred()) return;
+	  m_transport->async_probe(m_socket->get_executor(), m_strand->wrap(
+			  boost::bind(&BoostStomp::handle_failback_probe, this, _1)));
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::handle_failback_probe(bool better)
+  // --------------------------------------------------
+  {
+	  if ((m_stopped) || (!m_connected) || (m_draining)) return;
+	  if (!better) {
+		  start_failback_timer(boost::posix_time::seconds(FAILBACK_INTERVAL));
+		  return;
+	  }
+	  // A better broker is back. The output actor is on this strand too, so no
+	  // batch is half written: stop it here, and end the session with a receipt.
+	  // Once the broker confirms it got everything before the DISCONNECT, we move
+	  // over; frames still queued go out to the new broker.
+	  STOMP_DEBUG("a better broker than %1% is available, moving over", m_transport->describe());
+	  m_draining = true;
+	  Frame frame( CMD_DISCONNECT );
+	  frame.headers()["receipt"] = FAILBACK_RECEIPT;
+	  frame.encode(*stomp_request, *m_codec.load());
+	  boost::system::error_code wec;
+	  boost::asio::write(m_stream, *stomp_request, wec);
+	  if (wec) {
+		  switch_broker();
+		  return;
+	  }
+	  start_failback_timer(boost::posix_time::seconds(5));
+  }
+
+  // --------------------------------------------------
+  void BoostStomp::switch_broker()
+  // --------------------------------------------------
+  {
+	  if (!m_draining) return; 	// done already
+	  // said goodbye already: no second DISCONNECT from do_stop
+	  m_connected = false;
+	  stop();
+	  start();
   }
 
   // -----------------------------------------------
@@ -219,50 +594,79 @@ namespace STOMP {
   void BoostStomp::start_stomp_read_headers()
   // -----------------------------------------------
   {
-	//debug_print("start_stomp_read_headers");
+	//STOMP_TRACE("start_stomp_read_headers");
     // Start an asynchronous operation to read at least the STOMP frame command & headers (till the double newline delimiter)
      boost::asio::async_read_until(
-    	*m_socket,
-    	stomp_response,
-    	"\n\n",
-        boost::bind(&BoostStomp::handle_stomp_read_headers, this, placeholders::error()));
+    	m_stream,
+    	*stomp_response,
+    	bounded_match(&match_end_of_headers, stomp_response.get(), m_limits.max_header_bytes),
+        boost::bind(&BoostStomp::handle_stomp_read_headers, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
   }
 
   // -----------------------------------------------
-  void BoostStomp::handle_stomp_read_headers(const boost::system::error_code& ec)
+  void BoostStomp::handle_stomp_read_headers(const boost::system::error_code& ec, std::size_t bytes_transferred)
   // -----------------------------------------------
   {
-    if (m_stopped)
+    // reads cancelled by stop() belong to a connection that is gone already
+    if ((m_stopped) || (ec == boost::asio::error::operation_aborted))
       return;
 
     if (!ec)
     {
+    	if (m_options.quick_ack) m_transport->quick_ack(*m_socket);
+    	// the whole header block must be within the limit (bounded_match gives up past it)
+    	if (bytes_transferred > m_limits.max_header_bytes) {
+    		receive_failed(FRAME_HEADERS_TOO_LARGE);
+    		return;
+    	}
     	std::size_t bodysize = 0;
 		try {
-			//debug_print("handle_stomp_read_headers");
-			m_rcvd_frame = new Frame(stomp_response, cmd_map); // freed by consume_frame
-			hdrmap& _headers = m_rcvd_frame->headers();
+			//STOMP_TRACE("handle_stomp_read_headers");
+			// headers are only decoded when a handler looks at them
+			if (m_rcvd_spare == NULL) m_rcvd_spare = new Frame(CMD_UNKNOWN);
+			m_rcvd_frame = m_rcvd_spare; // recycled by consume_frame
+			m_rcvd_spare = NULL;
+			m_rcvd_frame->parse_head(*stomp_response, cmd_map, *m_codec.load());
 			// if the frame headers contain 'content-length', use that to call the proper async_read overload
-			if (_headers.find("content-length") != _headers.end()) {
-				string&  content_length =  _headers["content-length"];
-				debug_print(boost::format("received response (command+headers: %1% bytes, content-length: %2%)") %  stomp_response.size() % content_length );
-				bodysize = lexical_cast<size_t>(content_length);
+			boost::string_view content_length;
+			if (m_rcvd_frame->find_header(HDR_CONTENT_LENGTH, content_length)) {
+				STOMP_TRACE("received response (command+headers: %1% bytes, content-length: %2%)", stomp_response->size(), content_length);
+				bodysize = lexical_cast<size_t>(content_length.data(), content_length.size());
 			}
-	    	start_stomp_read_body(bodysize);
 		} catch(NoMoreFrames&) {
-			debug_print("No more frames!");
-//			break;
+			STOMP_TRACE("No more frames!");
+			// only heartbeats / garbage were buffered, wait for the next frame
+			// with the same recycled frame
+			m_rcvd_spare = m_rcvd_frame;
+			m_rcvd_frame = NULL;
+			start_stomp_read_headers();
+			return;
 		} catch(std::exception& e) {
-			debug_print(boost::format("handle_stomp_read in loop: unknown exception in Frame constructor:\n%1%") % e.what());
-			exit(10);
+			STOMP_LOG_IF(true, ::STOMP::log::LOG_ERROR, this, "cannot parse received frame: %1%", e.what());
+			receive_failed(FRAME_MALFORMED);
+			return;
 		}
-
+		// don't even start reading a body that would not fit
+		if (bodysize > m_limits.max_frame_bytes - std::min(bytes_transferred, m_limits.max_frame_bytes)) {
+			receive_failed(FRAME_TOO_LARGE);
+			return;
+		}
+		m_rcvd_header_bytes = bytes_transferred;
+		m_rcvd_bodysize = bodysize;
+		check_duplicate();
+		check_filter();
+		if (m_tracing) trace_received();
+		start_stomp_read_body(bodysize);
+    }
+    else if (ec == boost::asio::error::not_found)
+    {
+      // async_read_until filled the whole buffer without finding the delimiter
+      receive_failed(FRAME_BUDGET_EXCEEDED);
     }
     else
     {
-      std::cerr << "BoostStomp: Error on receive: " << ec.message() << "\n";
-      stop();
-      start();
+      STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "Error on receive: %1%", ec.message());
+      connection_lost();
     }
   }
 
@@ -270,18 +674,27 @@ namespace STOMP {
   void BoostStomp::start_stomp_read_body(std::size_t bodysize)
   // -----------------------------------------------
   {
-	//debug_print("start_stomp_read_body");
+	//STOMP_TRACE("start_stomp_read_body");
     // Start an asynchronous operation to read at least the STOMP frame body
 	if (bodysize == 0) {
+		// NULL signifies the end of the body, which must come within the frame limit
+		size_t limit = m_limits.max_frame_bytes - std::min(m_rcvd_header_bytes, m_limits.max_frame_bytes);
 		boost::asio::async_read_until(
-				*m_socket, 	stomp_response,
-				'\0', 	// NULL signifies the end of the body
-				boost::bind(&BoostStomp::handle_stomp_read_body, this, placeholders::error(), placeholders::bytes_transferred()));
+				m_stream, 	*stomp_response,
+				bounded_match(&match_end_of_body, stomp_response.get(), limit),
+				boost::bind(&BoostStomp::handle_stomp_read_body, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	} else if (stomp_response->size() > bodysize) {
+		// body and terminating NULL are already buffered, no need to wait for the socket
+		handle_stomp_read_body(boost::system::error_code(), 0);
 	} else {
+		// make room for the whole body at once, rather than growing the
+		// buffer chunk by chunk as it comes in
+		stomp_response->prepare(bodysize + 1 - stomp_response->size());
+		// only wait for the missing part of the body (plus the terminating NULL)
 		boost::asio::async_read(
-			*m_socket, 	stomp_response,
-			boost::asio::transfer_at_least(bodysize),
-			boost::bind(&BoostStomp::handle_stomp_read_body, this, placeholders::error(), placeholders::bytes_transferred()));
+			m_stream, 	*stomp_response,
+			boost::asio::transfer_at_least(bodysize + 1 - stomp_response->size()),
+			boost::bind(&BoostStomp::handle_stomp_read_body, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 	}
   }
 
@@ -289,47 +702,298 @@ namespace STOMP {
   void BoostStomp::handle_stomp_read_body(const boost::system::error_code& ec, std::size_t bytes_transferred = 0)
   // -----------------------------------------------
   {
-    if (m_stopped)
+    if ((m_stopped) || (ec == boost::asio::error::operation_aborted))
       return;
 
     if (!ec)
     {
-    	//debug_print(boost::format("received response (%1% bytes) (buffer: %2% bytes)") % bytes_transferred %  stomp_response.size()  );
-    	if (m_rcvd_frame != NULL) {
-    		m_rcvd_frame->parse_body(stomp_response);
+    	//STOMP_TRACE("received response (%1% bytes) (buffer: %2% bytes)", bytes_transferred, stomp_response->size());
+    	size_t framesize = m_rcvd_header_bytes + m_rcvd_bodysize + 1;
+    	if (m_rcvd_bodysize == 0) {
+    		// NULL terminated: bytes_transferred runs up to the NULL, unless bounded_match gave up
+    		framesize = m_rcvd_header_bytes + bytes_transferred;
+    		if (framesize > m_limits.max_frame_bytes) {
+    			receive_failed(FRAME_TOO_LARGE);
+    			return;
+    		}
+    	}
+    	if (m_rcvd_duplicate || m_rcvd_rejected) {
+    		// seen it already, or filtered out: skip the body without copying it
+    		m_rcvd_frame->skip_body(*stomp_response);
+    		drop_received();
+    	} else if (m_rcvd_frame != NULL) {
+    		// handlers see the body where it is in the receive buffer, a frame
+    		// that outlives them is detached (see process_MESSAGE)
+    		size_t bytecount = m_rcvd_frame->attach_body(*stomp_response);
+    		m_frames_received++;
+    		// only now that it is complete does the message count as delivered
+    		if (m_rcvd_dedup) {
+    			m_rcvd_dedup->insert(rcvd_key(m_rcvd_frame->header(HDR_MESSAGE_ID)));
+    			m_rcvd_dedup.reset();
+    		}
     		consume_received_frame();
+    		stomp_response->consume(bytecount);
     	}
     	//
-    	//debug_print("stomp_response contents after Frame scanning:");
-    	//hexdump(stomp_response);
+    	//STOMP_TRACE("stomp_response contents after Frame scanning:");
+    	//hexdump(*stomp_response);
+    	if (m_stopped) return; // a handler stopped the client
 
-		// wait for the next incoming frame from the server...
+    	// give memory back once the large frames are over: aim at twice the
+    	// largest recent frame, which decays by 1/64 per frame
+    	m_recent_frame = std::max(framesize, m_recent_frame - m_recent_frame / 64);
+    	size_t target = std::max(2 * m_recent_frame, RECEIVE_BUFFER_MIN);
+    	if (((stomp_response->capacity() > 4 * target) && (stomp_response->size() <= target)) ||
+    			(stomp_response->max_size() != m_limits.max_buffered_bytes)) {
+    		resize_receive_buffer(target);
+    	} else if (m_relocate_response) {
+    		resize_receive_buffer(stomp_response->capacity());
+    	}
+    	m_relocate_response = false;
+    	m_receive_capacity = stomp_response->capacity();
+
+		// wait for the next incoming frame from the server, unless a full
+		// pull subscription holds the reader (resume_reading resumes it)
+		if (m_read_holds.load() > 0) {
+			// a release racing this check posts resume_reading, which runs after us
+			m_read_paused = true;
+			STOMP_DEBUG("subscription buffer full, reading paused");
+			return;
+		}
 		start_stomp_read_headers();
     }
+    else if (ec == boost::asio::error::not_found)
+    {
+      receive_failed(FRAME_BUDGET_EXCEEDED);
+    }
     else
     {
-      std::cerr << "BoostStomp: Error on receive: " << ec.message() << "\n";
-      stop();
-      start();
+      STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "Error on receive: %1%", ec.message());
+      connection_lost();
     }
   }
 
+  // ------------------------------------------
+  void BoostStomp::resize_receive_buffer(size_t capacity)
+  // ------------------------------------------
+  {
+	  // only called from a read handler: no read operation refers to the old buffer
+	  boost::asio::streambuf* sb = new boost::asio::streambuf(m_limits.max_buffered_bytes);
+	  size_t buffered = stomp_response->size();
+	  sb->prepare(std::max(capacity, buffered));
+	  sb->sputn(boost::asio::buffer_cast<const char*>(stomp_response->data()), buffered);
+	  if (sb->capacity() < stomp_response->capacity()) {
+		  STOMP_DEBUG("receive buffer shrunk from %1% to %2% bytes", stomp_response->capacity(), sb->capacity());
+		  m_receive_shrinks++;
+	  }
+	  stomp_response.reset(sb);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::receive_failed(const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  // the stream can't be trusted any more: drop the connection, don't reconnect
+	  STOMP_LOG_IF(true, ::STOMP::log::LOG_ERROR, this, "closing the connection to %1%: %2%", m_transport->describe(), ec.message());
+	  // keep the frame for the next connection (parse_head resets it)
+	  if (m_rcvd_frame != NULL) {
+		  delete m_rcvd_spare;
+		  m_rcvd_spare = m_rcvd_frame;
+		  m_rcvd_frame = NULL;
+	  }
+	  m_rcvd_dedup.reset();
+	  m_rcvd_duplicate = false;
+	  m_rcvd_rejected = false;
+	  stop();
+	  complete_connect_waiters(ec);
+	  fail_receipt_waiters(ec);
+	  if (m_error_callback) m_error_callback(ec);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::do_set_receive_limits(const ReceiveLimits& limits)
+  // ------------------------------------------
+  {
+	  // the read buffer picks up the new budget after the next frame
+	  m_limits = limits;
+	  m_limits.max_buffered_bytes = std::max(m_limits.max_buffered_bytes,
+			  m_limits.max_header_bytes + m_limits.max_frame_bytes + 65536);
+  }
+
   // ------------------------------------------
   void BoostStomp::consume_received_frame()
   // ------------------------------------------
   {
 	  if (m_rcvd_frame != NULL) {
 		  // is there a declared handler for the command in the received STOMP frame?
-		  if (pfnStompCommandHandler_t handler = cmd_map[m_rcvd_frame->command()]) {
-			  //debug_print(boost::format("-- consume_frame: calling %1% command handler") % m_rcvd_frame->command());
+		  pfnStompCommandHandler_t handler = s_dispatch[m_rcvd_frame->command_id()];
+		  if (m_rcvd_frame->command_id() == CMD_UNKNOWN) {
+			  stomp_server_command_map_t::const_iterator it = cmd_map.find(m_rcvd_frame->command());
+			  if (it != cmd_map.end()) handler = it->second;
+		  }
+		  if (handler) {
+			  //STOMP_TRACE("-- consume_frame: calling %1% command handler", m_rcvd_frame->command());
 			  // call STOMP command handler
 			  (this->*handler)();
 		  }
-		  delete m_rcvd_frame;
+		  // keep it for parsing the next one into
+		  if (m_rcvd_frame != NULL) {
+			  delete m_rcvd_spare;
+			  m_rcvd_spare = m_rcvd_frame;
+		  }
 	  }
 	  m_rcvd_frame = NULL;
   };
 
+  // ------------------------------------------
+  void BoostStomp::do_set_queue(const std::string& topic, boost::shared_ptr<Subscription> sub)
+  // ------------------------------------------
+  {
+	  subscription_queue_map::iterator q = m_subscription_queues.find(topic);
+	  if (q != m_subscription_queues.end()) {
+		  q->second->detach();
+		  m_subscription_queues.erase(q);
+	  }
+	  if (sub) {
+		  // a pull subscription replaces the callback one
+		  m_subscriptions.erase(topic);
+		  m_subscription_queues[topic] = sub;
+	  }
+  }
+
+  void BoostStomp::check_duplicate()
+  // ------------------------------------------
+  {
+	  // called with the headers of a new frame, before its body is read
+	  m_rcvd_dedup.reset();
+	  m_rcvd_duplicate = false;
+	  if (m_dedup.empty() || (m_rcvd_frame->command_id() != CMD_MESSAGE)) return;
+	  boost::string_view dest, id;
+	  if (!m_rcvd_frame->find_header(HDR_DESTINATION, dest) || !m_rcvd_frame->find_header(HDR_MESSAGE_ID, id)) return;
+	  dedup_map::iterator it = m_dedup.find(rcvd_key(dest));
+	  if (it == m_dedup.end()) return;
+	  m_rcvd_dedup = it->second;
+	  m_dedup_lookups++;
+	  if (m_rcvd_dedup->seen(rcvd_key(id))) {
+		  m_dedup_hits++;
+		  m_rcvd_duplicate = true;
+		  STOMP_TRACE("dropping duplicate message %1% on %2%", id, dest);
+	  }
+  }
+
+  // ------------------------------------------
+  void BoostStomp::check_filter()
+  // ------------------------------------------
+  {
+	  // after check_duplicate: duplicates are dropped anyway
+	  m_rcvd_rejected = false;
+	  if (m_filters.empty() || m_rcvd_duplicate || (m_rcvd_frame->command_id() != CMD_MESSAGE)) return;
+	  boost::string_view dest;
+	  if (!m_rcvd_frame->find_header(HDR_DESTINATION, dest)) return;
+	  filter_map::iterator it = m_filters.find(rcvd_key(dest));
+	  if (it == m_filters.end()) return;
+	  m_filter_checks++;
+	  if (!it->second->accept(*m_rcvd_frame)) {
+		  m_filter_rejects++;
+		  m_rcvd_rejected = true;
+		  m_rcvd_action = it->second->action();
+	  }
+  }
+
+  // ------------------------------------------
+  void BoostStomp::drop_received()
+  // ------------------------------------------
+  {
+	  if ((m_ackmode == ACK_CLIENT) || (m_ackmode == ACK_CLIENT_INDIVIDUAL)) {
+		  if (m_rcvd_duplicate) {
+			  // the broker redelivered it because the ACK never made it: ACK it again
+			  acknowledge(m_rcvd_frame, true);
+		  } else if (m_rcvd_action != FILTER_DROP) {
+			  acknowledge(m_rcvd_frame, m_rcvd_action == FILTER_ACK);
+		  }
+	  }
+	  delete m_rcvd_spare;
+	  m_rcvd_spare = m_rcvd_frame;
+	  m_rcvd_frame = NULL;
+	  m_rcvd_dedup.reset();
+	  m_rcvd_duplicate = false;
+	  m_rcvd_rejected = false;
+  }
+
+  // ------------------------------------------
+  void BoostStomp::do_set_dedup(const std::string& topic, boost::shared_ptr<DedupFilter> filter)
+  // ------------------------------------------
+  {
+	  // on the IO thread, maybe between the headers and the body of a frame:
+	  // that frame is finished with the filter it was checked by (m_rcvd_dedup)
+	  if (filter) m_dedup[topic] = filter;
+	  else m_dedup.erase(topic);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::do_set_filter(const std::string& topic, boost::shared_ptr<HeaderFilter> filter)
+  // ------------------------------------------
+  {
+	  // the frame being read keeps the verdict (and the action) of the
+	  // filter it was checked by, this one may free that filter
+	  if (filter) m_filters[topic] = filter;
+	  else m_filters.erase(topic);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::trace_queued(Frame* frame)
+  // ------------------------------------------
+  {
+	  // caller thread, before the frame is queued
+	  uint32_t every = m_trace_every.load();
+	  if ((every == 0) || (frame->command_id() != CMD_SEND) || ((m_trace_counter++ % every) != 0)) return;
+	  TraceRecorder::stamp_queued(frame->headers()[TRACE_HEADER]);
+	  m_trace_pending++;
+  }
+
+  // ------------------------------------------
+  void BoostStomp::trace_written(Frame* frame)
+  // ------------------------------------------
+  {
+	  // on the strand, right before the frame is encoded
+	  if (frame->command_id() != CMD_SEND) return;
+	  hdrmap& headers = frame->headers();
+	  hdrmap::iterator it = headers.find(TRACE_HEADER);
+	  if (it == headers.end()) return;
+	  TraceRecorder::Stamp stamp;
+	  // written again after a reconnect: the time in the lanes was counted already
+	  if (!TraceRecorder::stamp_written(it->second, stamp)) return;
+	  m_trace_pending--;
+	  hdrmap::iterator dest = headers.find("destination");
+	  if (dest != headers.end())
+		  m_trace.record(dest->second, TraceRecorder::QUEUED, stamp.written - std::min(stamp.queued, stamp.written));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::trace_received()
+  // ------------------------------------------
+  {
+	  // with the headers of a new frame
+	  m_rcvd_traced_at = 0;
+	  boost::string_view value, dest;
+	  TraceRecorder::Stamp stamp;
+	  if ((m_rcvd_frame->command_id() != CMD_MESSAGE) || !m_rcvd_frame->find_header(TRACE_HEADER, value) ||
+			  !TraceRecorder::parse(value, stamp) || (stamp.written == 0) || !m_rcvd_frame->find_header(HDR_DESTINATION, dest))
+		  return;
+	  uint64_t now = TraceRecorder::clock_us();
+	  // the monotonic clocks only compare on the same host, else trust the
+	  // wall clocks to be in sync (a sender ahead of us counts as 0)
+	  uint64_t transit;
+	  if (stamp.host == TraceRecorder::host_tag()) {
+		  transit = now - std::min(stamp.written, now);
+	  } else {
+		  uint64_t wall = TraceRecorder::wall_us();
+		  transit = wall - std::min(stamp.wall, wall);
+	  }
+	  m_trace.record(dest, TraceRecorder::TRANSIT, transit);
+	  if (!m_rcvd_duplicate && !m_rcvd_rejected) m_rcvd_traced_at = now;
+  }
+
   // ------------------------------------------------
   // ---------- OUTPUT ACTOR SETUP ------------------
   // ------------------------------------------------
@@ -338,69 +1002,139 @@ namespace STOMP {
   void BoostStomp::start_stomp_write()
   // -----------------------------------------------
   {
-    if ((m_stopped) || (!m_connected))
+    // from here on, new frames need a new run
+    m_write_scheduled = false;
+    if ((m_stopped) || (!m_connected) || (m_draining))
       return;
 
-    //debug_print("start_stomp_write");
-    Frame* frame = NULL;
-
-    // send all STOMP frames in queue
-    while (m_sendqueue.try_pop(frame)) {
-    		debug_print(boost::format("Sending %1% frame...") %  frame->command() );
-    		frame->encode(stomp_request);
-    		try {
-    			boost::asio::write(
-					*m_socket,
-					stomp_request
-    	    		);
-    			debug_print("Sent!");
-    			delete frame;
-    		} catch (boost::system::system_error& err){
-    			m_connected = false;
-    			debug_print(boost::format("Error writing to STOMP server: error code:%1%, message:%2%") % err.code() % err.what());
-    			// put! the kot! down! slowly!
-    			m_sendqueue.push(frame);
-    			stop();
-    		}
-    };
+    //STOMP_TRACE("start_stomp_write");
+    std::vector<OutputScheduler::Entry> batch;
+
+    // encode the next batch of STOMP frames back to back, then send them with a
+    // single write (a TLS stream encrypts straight out of this buffer). The
+    // batch is bounded, so control frames never wait behind a whole backlog.
+    boost::posix_time::time_duration delay;
+    bool more = m_sendqueue.next_batch(batch, OutputScheduler::BATCH_BYTES, &delay);
+    if (batch.empty()) {
+    	if (more) start_pacing_timer(delay);
+    	return;
+    }
+    size_t nframes = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+    	Frame* frame = batch[i].frame;
+    	if (frame == NULL) {
+    		stomp_request->sputc('\n'); // heartbeat
+    		continue;
+    	}
+    	STOMP_TRACE("Sending %1% frame...", frame->command());
+    	if (m_trace_pending.load() > 0) trace_written(frame);
+    	const vector<char>& body = frame->body().v;
+    	if (body.size() >= GATHER_MIN_BODY) {
+    		// large body: written from the frame itself, the send buffer only
+    		// gets the head and the NULL that follows the body
+    		m_codec.load()->encode_head(*frame, *stomp_request);
+    		m_gathered.push_back(std::make_pair(stomp_request->size(), boost::asio::buffer(body)));
+    		stomp_request->sputc('\0');
+    	} else {
+    		frame->encode(*stomp_request, *m_codec.load());
+    	}
+    	nframes++;
+    }
+
+    size_t bytes = stomp_request->size();
+    for (size_t i = 0; i < m_gathered.size(); i++) bytes += m_gathered[i].second.size();
+    // adaptive mode: hold back partial segments while a large drain is written
+    bool corked = (m_nagle_mode == TransportOptions::NAGLE_ADAPTIVE) && (bytes >= m_options.cork_bytes);
+    if (corked) m_transport->cork(*m_socket, true);
+    boost::system::error_code ec;
+    if (m_gathered.empty()) {
+    	boost::asio::write(m_stream, *stomp_request, ec);
+    } else {
+    	// one gather write: send buffer pieces interleaved with the bodies
+    	const char* head = boost::asio::buffer_cast<const char*>(stomp_request->data());
+    	size_t from = 0;
+    	m_write_buffers.clear();
+    	for (size_t i = 0; i < m_gathered.size(); i++) {
+    		m_write_buffers.push_back(boost::asio::buffer(head + from, m_gathered[i].first - from));
+    		m_write_buffers.push_back(m_gathered[i].second);
+    		from = m_gathered[i].first;
+    	}
+    	m_write_buffers.push_back(boost::asio::buffer(head + from, stomp_request->size() - from));
+    	boost::asio::write(m_stream, m_write_buffers, ec);
+    	stomp_request->consume(stomp_request->size());
+    	m_gathered.clear();
+    }
+    if (corked) m_transport->cork(*m_socket, false);
+    if (!ec) {
+    	STOMP_TRACE("Sent %1% frames!", nframes);
+    	m_frames_sent += nframes;
+    	m_bytes_sent += bytes;
+    	m_write_batches++;
+    	if (corked) m_corked_batches++;
+    	// SEND frames go back to the pool for emplace_send()
+    	for (size_t i = 0; i < batch.size(); i++) {
+    		if (batch[i].frame) m_frame_pool.release(batch[i].frame);
+    	}
+    	// more to go: come back after whatever else is waiting on the strand,
+    	// or once the rate limits let the rest through
+    	if (more) {
+    		if (delay.is_special()) schedule_write();
+    		else start_pacing_timer(delay);
+    	}
+    } else {
+    	STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "Error writing to STOMP server: error code:%1%, message:%2%", ec.value(), ec.message());
+    	// put! the kot! down! slowly! (they go out again after reconnecting,
+    	// but for the ACKs and SUBSCRIBEs of this session)
+    	m_sendqueue.restore(batch);
+    	connection_lost();
+    }
+  }
+
+  // -----------------------------------------------
+  void BoostStomp::start_pacing_timer(const boost::posix_time::time_duration& delay)
+  // -----------------------------------------------
+  {
+	  // runs on the strand. One wakeup at a time, sends meanwhile just queue up.
+	  if (m_pacing_armed || delay.is_special()) return;
+	  m_pacing_armed = true;
+	  m_paced_waits++;
+	  m_pacing_timer.expires_from_now(delay);
+	  m_pacing_timer.async_wait(m_strand->wrap(
+			  boost::bind(&BoostStomp::handle_pacing_timer, this, boost::asio::placeholders::error)));
+  }
+
+  // -----------------------------------------------
+  void BoostStomp::handle_pacing_timer(const boost::system::error_code& ec)
+  // -----------------------------------------------
+  {
+	  m_pacing_armed = false;
+	  if ((m_stopped) || (ec == boost::asio::error::operation_aborted))
+		  return;
+	  start_stomp_write();
   }
 
   // -----------------------------------------------
   void BoostStomp::start_stomp_heartbeat()
   // -----------------------------------------------
   {
-			// Start an asynchronous operation to send a heartbeat message.
-			//debug_print("Sending heartbeat...");
-			boost::asio::async_write(
-					*m_socket,
-					m_heartbeat,
-					boost::bind(&BoostStomp::handle_stomp_heartbeat, this, _1)
-			);
+      // Wait 10 seconds before sending the next heartbeat. It goes through the
+      // control lane, so neither a publish backlog nor a write in progress delays it.
+      m_heartbeat_timer.async_wait(boost::posix_time::seconds(10), m_strand->wrap(
+    		  boost::bind(&BoostStomp::handle_stomp_heartbeat, this, boost::asio::placeholders::error)));
   }
 
   // -----------------------------------------------
   void BoostStomp::handle_stomp_heartbeat(const boost::system::error_code& ec)
   // -----------------------------------------------
   {
-    if (m_stopped)
+    if ((m_stopped) || (ec == boost::asio::error::operation_aborted))
       return;
 
-    if (!ec)
-    {
-      // Wait 10 seconds before sending the next heartbeat.
-      m_heartbeat_timer->expires_from_now(boost::posix_time::seconds(10));
-      m_heartbeat_timer->async_wait(
-    		  boost::bind(
-    				 &BoostStomp::start_stomp_heartbeat,
-    				 this
-    		  )
-      );
-    }
-    else
-    {
-      std::cout << "Error on sending heartbeat: " << ec.message() << "\n";
-      stop();
-    }
+    //STOMP_TRACE("Sending heartbeat...");
+    m_sendqueue.push_heartbeat();
+    start_stomp_heartbeat();
+    // write errors are handled (and the connection restarted) by the output actor
+    start_stomp_write();
   }
 
   //-----------------------------------------
@@ -408,25 +1142,41 @@ namespace STOMP {
   //-----------------------------------------
   {
 	  m_connected = true;
+	  boost::posix_time::time_duration rtt = boost::posix_time::microsec_clock::universal_time() - m_connect_sent;
+	  m_transport->connected(rtt);
+	  STOMP_DEBUG("CONNECTED to %1% after %2% us", m_transport->describe(), rtt.total_microseconds());
+	  if (!m_transport->preferred())
+		  start_failback_timer(boost::posix_time::seconds(FAILBACK_INTERVAL));
 	  // try to get supported protocol version from headers
 	  hdrmap _headers = m_rcvd_frame->headers();
-	  if (_headers.find("version") != _headers.end()) {
-		  m_protocol_version = _headers["version"];
-		  debug_print(boost::format("server supports STOMP version %1%") % m_protocol_version);
-	  }
-	  if (m_protocol_version == "1.1") {
-		  // we are connected to a version 1.1 STOMP server, setup heartbeat
-			m_heartbeat_timer = boost::shared_ptr< deadline_timer> ( new deadline_timer( *m_io_service ));
-			std::ostream os( &m_heartbeat);
-			os << "\n";
-		  // we can start the heartbeat actor
+	  // (no version header means STOMP 1.0). From now on every frame goes through this codec.
+	  m_codec = &FrameCodec::for_version(_headers["version"]);
+	  STOMP_DEBUG("server supports STOMP version %1%", m_codec.load()->version_string());
+	  if (m_codec.load()->supports_heartbeat()) {
+		  // we are connected to a version 1.1+ STOMP server: start the heartbeat actor
 		  start_stomp_heartbeat();
 	  }
+	  // ACKs and SUBSCRIBEs queued meanwhile belong to the previous session
+	  // (or duplicate the resubscribes below)
+	  std::vector<string> aborted;
+	  size_t stale = m_sendqueue.discard_session_frames(&aborted);
+	  if (stale > 0) STOMP_DEBUG("dropped %1% frames queued for the previous session", stale);
+	  // so did the transactions begun on it, tell the application
+	  for (size_t i = 0; i < aborted.size(); i++) {
+		  STOMP_LOG_IF(true, ::STOMP::log::LOG_WARN, this, "transaction %1% was aborted by the reconnect", aborted[i]);
+		  if (m_error_callback) m_error_callback(make_error_code(TRANSACTION_ABORTED));
+	  }
 	  // in case of reconnection, we need to re-subscribe to all subscriptions
 	  for (subscription_map::iterator it = m_subscriptions.begin(); it != m_subscriptions.end(); it++) {
 		  //string topic = (*it).first;
 		  do_subscribe((*it).first);
 	  };
+	  for (subscription_queue_map::iterator it = m_subscription_queues.begin(); it != m_subscription_queues.end(); it++) {
+		  do_subscribe((*it).first);
+	  };
+	  complete_connect_waiters(boost::system::error_code());
+	  // flush any frames queued while we were still connecting
+	  schedule_write();
   }
 
   //-----------------------------------------
@@ -434,15 +1184,31 @@ namespace STOMP {
   //-----------------------------------------
   {
 	  bool acked = true;
-	  hdrmap& _headers =  m_rcvd_frame->headers();
-	  if (_headers.find("destination") != _headers.end()) {
-		  string& dest = _headers["destination"];
+	  // routing only needs this header, the others are decoded if a handler asks
+	  boost::string_view destination;
+	  if (m_rcvd_frame->find_header(HDR_DESTINATION, destination)) {
+		  if (m_rcvd_traced_at != 0) {
+			  m_trace.record(destination, TraceRecorder::DISPATCH, TraceRecorder::clock_us() - m_rcvd_traced_at);
+			  m_rcvd_traced_at = 0;
+		  }
+		  const string& dest = rcvd_key(destination);
 		  //
-		  if (pfnOnStompMessage_t callback_function = m_subscriptions[dest]) {
-			  //debug_print(boost::format("-- consume_frame: firing callback for %1%") % dest);
+		  subscription_map::iterator it = m_subscriptions.find(dest);
+		  if (it != m_subscriptions.end() && it->second) {
+			  //STOMP_TRACE("-- consume_frame: firing callback for %1%", dest);
 			  //
-			  acked = callback_function(m_rcvd_frame);
-		  };
+			  acked = it->second(m_rcvd_frame);
+		  } else {
+			  subscription_queue_map::iterator q = m_subscription_queues.find(dest);
+			  if (q != m_subscription_queues.end()) {
+				  // pull-mode subscription: the frame is acknowledged when it is handed out,
+				  // long after the receive buffer has moved on
+				  m_rcvd_frame->detach();
+				  q->second->deliver(m_rcvd_frame);
+				  m_rcvd_frame = NULL;
+				  return;
+			  }
+		  }
 	  };
 	  // acknowledge frame, if in "Client" or "Client-Individual" ack mode
 	  if ((m_ackmode == ACK_CLIENT) || (m_ackmode == ACK_CLIENT_INDIVIDUAL)) {
@@ -454,11 +1220,16 @@ namespace STOMP {
   void BoostStomp::process_RECEIPT()
   //-----------------------------------------
   {
-	  hdrmap& _headers =  m_rcvd_frame->headers();
-	  if (_headers.find("receipt_id") != _headers.end()) {
-		  string& receipt_id = _headers["receipt_id"];
-		  // do something with receipt...
-		  debug_print(boost::format("receipt-id == %1%") % receipt_id);
+	  boost::string_view id;
+	  if (m_rcvd_frame->find_header(HDR_RECEIPT_ID, id)) {
+		  string receipt_id(id.data(), id.size());
+		  STOMP_DEBUG("receipt-id == %1%", receipt_id);
+		  if (m_draining && (receipt_id == FAILBACK_RECEIPT)) {
+			  // everything we sent has been processed. Not from within the read handler.
+			  m_strand->post(boost::bind(&BoostStomp::switch_broker, this));
+			  return;
+		  }
+		  complete_receipt(receipt_id, boost::system::error_code());
 	  };
   }
 
@@ -470,27 +1241,88 @@ namespace STOMP {
   		  string errormessage = (_headers.find("message") != _headers.end()) ?
   				  _headers["message"] :
   				  "(unknown error!)";
-  		  errormessage += m_rcvd_frame->body().c_str();
+  		  // the body is neither NULL terminated nor allocated when empty
+  		  boost::string_view body = m_rcvd_frame->body_view();
+  		  errormessage.append(body.data(), body.size());
   		  //throw(errormessage);
-  		  cerr << endl << "============= BoostStomp got an ERROR frame from server: =================" << endl << errormessage << endl;
+  		  STOMP_LOG_IF(true, ::STOMP::log::LOG_ERROR, this, "got an ERROR frame from %1%: %2%", m_transport->describe(), errormessage);
+  		  // an ERROR in response to a frame sent with a receipt request fails that operation
+  		  if (_headers.find("receipt-id") != _headers.end()) {
+  			  complete_receipt(_headers["receipt-id"], boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+  		  }
   }
 
 
   //-----------------------------------------
-  bool BoostStomp::send_frame( Frame* frame )
+  bool BoostStomp::send_frame( Frame* frame, int lane )
   //-----------------------------------------
   {
-	  // send_frame is called from the application thread. Do not dereference frame here!!! (shared data)
-	  //debug_print(boost::format("send_frame: Adding frame to send queue...") %  frame->command() );
-	  //debug_print("send_frame: Adding frame to send queue...");
-	  m_sendqueue.push(frame); // concurrent_queue does all the thread safety stuff
+	  // send_frame is called from the application thread. Do not dereference frame once queued!!! (shared data)
+	  //STOMP_TRACE("send_frame: Adding frame to send queue...");
+	  if (m_trace_every.load() > 0) trace_queued(frame);
+	  m_sendqueue.push(frame, lane); // the scheduler does all the thread safety stuff
 	  // tell io_service to start the output actor so as the frame get sent from the worker thread
-	  m_strand->post(
-			boost::bind(&BoostStomp::start_stomp_write, this)
-	  );
+	  schedule_write();
 	  return(true);
   }
 
+  //-----------------------------------------
+  bool BoostStomp::emplace_send( boost::string_view topic, const header_view* headers, size_t n,
+		  boost::string_view body, int lane )
+  //-----------------------------------------
+  {
+	  Frame* frame = m_frame_pool.acquire();
+	  frame->rebuild(CMD_SEND, topic, headers, n, body);
+	  return(send_frame(frame, lane));
+  }
+
+  //-----------------------------------------
+  bool BoostStomp::emplace_send( boost::string_view topic, const header_view* headers, size_t n,
+		  binbody&& body, int lane )
+  //-----------------------------------------
+  {
+	  Frame* frame = m_frame_pool.acquire();
+	  frame->rebuild(CMD_SEND, topic, headers, n, std::move(body));
+	  return(send_frame(frame, lane));
+  }
+
+  //-----------------------------------------
+  void BoostStomp::schedule_write()
+  //-----------------------------------------
+  {
+	  // one pending run is enough: it clears the flag before it takes the
+	  // next batch, so a frame queued meanwhile is either in that batch or
+	  // posts a run of its own
+	  if (m_write_scheduled.exchange(true)) return;
+	  m_write_wakeups++;
+	  m_strand->post(boost::bind(&BoostStomp::start_stomp_write, this));
+  }
+
+  //-----------------------------------------
+  size_t BoostStomp::send_batch( PublishBatch& batch, bool transactional, int lane )
+  //-----------------------------------------
+  {
+	  std::vector<Frame*> frames;
+	  batch.release(frames);
+	  size_t n = frames.size();
+	  if (n == 0) return(0);
+	  if (transactional) {
+		  // BEGIN goes out on the control lane ahead of the SENDs, COMMIT is
+		  // held back until they are all written
+		  hdrmap hm;
+		  hm["transaction"] = lexical_cast<string>(m_transaction_id++);
+		  for (size_t i = 0; i < n; i++) frames[i]->headers()["transaction"] = hm["transaction"];
+		  frames.insert(frames.begin(), new Frame( CMD_BEGIN, hm ));
+		  frames.push_back(new Frame( CMD_COMMIT, hm ));
+	  }
+	  if (m_trace_every.load() > 0) {
+		  for (size_t i = 0; i < frames.size(); i++) trace_queued(frames[i]);
+	  }
+	  m_sendqueue.push(&frames[0], frames.size(), lane);
+	  schedule_write();
+	  return(n);
+  }
+
   // ---------------------------------------------------------------------------------------
   // ---------------------------------------------------------------------------------------
   // ------------------------ 			PUBLIC INTERFACE 			------------------------
@@ -502,11 +1334,22 @@ namespace STOMP {
   bool BoostStomp::subscribe( string& topic, pfnOnStompMessage_t callback )
   // ------------------------------------------
   {
-	  //debug_print(boost::format("Setting callback function for %1%") % topic);
+	  //STOMP_TRACE("Setting callback function for %1%", topic);
 	  m_subscriptions[topic] = callback;
 	  return(do_subscribe(topic));
   }
 
+  // ------------------------------------------
+  boost::shared_ptr<Subscription> BoostStomp::subscribe( string& topic, size_t capacity )
+  // ------------------------------------------
+  {
+	  boost::shared_ptr<Subscription> sub(new Subscription(this, topic, capacity));
+	  // process_MESSAGE looks the queue up on the IO thread
+	  m_strand->post(boost::bind(&BoostStomp::do_set_queue, this, topic, sub));
+	  do_subscribe(topic);
+	  return(sub);
+  }
+
   // ------------------------------------------
   bool BoostStomp::do_subscribe(const string& topic)
   // ------------------------------------------
@@ -514,7 +1357,10 @@ namespace STOMP {
 	  hdrmap hm;
 	  hm["id"] = lexical_cast<string>(boost::this_thread::get_id());
 	  hm["destination"] = topic;
-	  return(send_frame(new Frame( "SUBSCRIBE", hm )));
+	  // without it the broker acknowledges for us, and ACK frames are refused
+	  if (m_ackmode == ACK_CLIENT) hm["ack"] = "client";
+	  if (m_ackmode == ACK_CLIENT_INDIVIDUAL) hm["ack"] = "client-individual";
+	  return(send_frame(new Frame( CMD_SUBSCRIBE, hm )));
   }
 
 
@@ -525,15 +1371,129 @@ namespace STOMP {
 	  hdrmap hm;
 	  hm["destination"] = topic;
 	  m_subscriptions.erase(topic);
-	  return(send_frame(new Frame( "UNSUBSCRIBE", hm )));
+	  m_strand->post(boost::bind(&BoostStomp::do_set_queue, this, topic, boost::shared_ptr<Subscription>()));
+	  return(send_frame(new Frame( CMD_UNSUBSCRIBE, hm )));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::enable_dedup(const std::string& topic, size_t capacity, const boost::posix_time::time_duration& window)
+  // ------------------------------------------
+  {
+	  boost::shared_ptr<DedupFilter> filter(new DedupFilter(capacity, window));
+	  m_strand->post(boost::bind(&BoostStomp::do_set_dedup, this, topic, filter));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::disable_dedup(const std::string& topic)
+  // ------------------------------------------
+  {
+	  m_strand->post(boost::bind(&BoostStomp::do_set_dedup, this, topic, boost::shared_ptr<DedupFilter>()));
+  }
+
+  // ------------------------------------------
+  boost::shared_ptr<HeaderFilter> BoostStomp::set_filter(const std::string& topic, const std::string& expression, FilterAction action)
+  // ------------------------------------------
+  {
+	  boost::shared_ptr<HeaderFilter> filter(new HeaderFilter(expression, action));
+	  m_strand->post(boost::bind(&BoostStomp::do_set_filter, this, topic, filter));
+	  return(filter);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::enable_tracing(const TraceOptions& options)
+  // ------------------------------------------
+  {
+	  m_trace.set_max_destinations(options.max_destinations);
+	  uint32_t every = 0;
+	  if (options.sample_rate > 0)
+		  every = (options.sample_rate >= 1) ? 1 : uint32_t(1.0 / options.sample_rate + 0.5);
+	  m_trace_every = every;
+	  m_tracing = true;
+  }
+
+  // ------------------------------------------
+  void BoostStomp::disable_tracing()
+  // ------------------------------------------
+  {
+	  // frames stamped already still get their write stamp
+	  m_trace_every = 0;
+	  m_tracing = false;
+  }
+
+  // ------------------------------------------
+  void BoostStomp::clear_filter(const std::string& topic)
+  // ------------------------------------------
+  {
+	  m_strand->post(boost::bind(&BoostStomp::do_set_filter, this, topic, boost::shared_ptr<HeaderFilter>()));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::start_capture(const std::string& path, size_t capacity)
+  // ------------------------------------------
+  {
+	  // set up the file here, so that errors reach the caller
+	  boost::shared_ptr<CaptureWriter> capture(new CaptureWriter(path, capacity));
+	  m_strand->post(boost::bind(&BoostStomp::do_set_capture, this, capture));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::stop_capture()
+  // ------------------------------------------
+  {
+	  m_strand->post(boost::bind(&BoostStomp::do_set_capture, this, boost::shared_ptr<CaptureWriter>()));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::set_receive_limits(const ReceiveLimits& limits)
+  // ------------------------------------------
+  {
+	  m_strand->post(boost::bind(&BoostStomp::do_set_receive_limits, this, limits));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::set_thread_options(const ThreadOptions& options)
+  // ------------------------------------------
+  {
+	  if (m_reactor) {
+		  ThreadOptions buffers;
+		  buffers.numa_local_buffers = options.numa_local_buffers;
+		  m_strand->post(boost::bind(&BoostStomp::do_set_thread_options, this, buffers));
+	  }
+	  else if (worker_thread == NULL) m_threading = options; // applied when the IO thread starts
+	  else m_strand->post(boost::bind(&BoostStomp::do_set_thread_options, this, options));
+  }
+
+  // ------------------------------------------
+  void BoostStomp::do_set_thread_options(const ThreadOptions& options)
+  // ------------------------------------------
+  {
+	  m_threading = options;
+	  apply_thread_options();
+  }
+
+  // ------------------------------------------
+  void BoostStomp::do_set_capture(boost::shared_ptr<CaptureWriter> capture)
+  // ------------------------------------------
+  {
+	  // runs on the IO thread, so no read or write is recording meanwhile.
+	  // A read in progress keeps the previous capture open until it completes.
+	  if (capture) STOMP_DEBUG("capturing wire traffic to %1%", capture->path());
+	  m_stream.set_capture(capture);
   }
 
   // ------------------------------------------
   bool BoostStomp::acknowledge(Frame* frame, bool acked = true)
   // ------------------------------------------
   {
-	  hdrmap hm = frame->headers();
-	  string _ack_cmd = (acked ? "ACK" : "NACK");
+	  // called from any thread: use one codec for the whole frame
+	  const FrameCodec* codec = m_codec.load();
+	  if (!acked && !codec->supports_nack()) {
+		  // STOMP 1.0 has no NACK, leave the message unacknowledged
+		  return(false);
+	  }
+	  hdrmap hm;
+	  codec->ack_headers(*frame, hm);
+	  stomp_command _ack_cmd = (acked ? CMD_ACK : CMD_NACK);
 	  return(send_frame(new Frame( _ack_cmd, hm )));
   }
 
@@ -544,10 +1504,11 @@ namespace STOMP {
   {
 	  hdrmap hm;
 	  // create a new transaction id
-	  hm["transaction"] = lexical_cast<string>(m_transaction_id++);
-	  Frame* frame = new Frame( "BEGIN", hm );
+	  int transaction_id = m_transaction_id++;
+	  hm["transaction"] = lexical_cast<string>(transaction_id);
+	  Frame* frame = new Frame( CMD_BEGIN, hm );
 	  send_frame(frame);
-	  return(m_transaction_id);
+	  return(transaction_id);
   };
 
   // ------------------------------------------
@@ -557,7 +1518,7 @@ namespace STOMP {
 	  hdrmap hm;
 	  // add required header
 	  hm["transaction"] = lexical_cast<string>(transaction_id);
-	  return(send_frame(new Frame( "COMMIT", hm )));
+	  return(send_frame(new Frame( CMD_COMMIT, hm )));
   };
 
   // ------------------------------------------
@@ -567,33 +1528,142 @@ namespace STOMP {
 	  hdrmap hm;
 	  // add required header
 	  hm["transaction"] = lexical_cast<string>(transaction_id);
-	  return(send_frame(new Frame( "ABORT", hm )));
+	  return(send_frame(new Frame( CMD_ABORT, hm )));
   };
 
   // ------------------------------------------
-  void BoostStomp::enable_debug_msgs(bool b)
+  void BoostStomp::wait_connected(detail::completion* op)
   // ------------------------------------------
   {
-      m_showDebug = b;
+	  boost::mutex::scoped_lock lock(m_async_mutex);
+	  if (m_connected) {
+		  lock.unlock();
+		  op->complete(boost::system::error_code());
+		  return;
+	  }
+	  m_connect_waiters.push_back(op);
+	  lock.unlock();
+	  if (m_stopped) start();
   }
-  
-  void BoostStomp::debug_print(string& str) {
-	  boost::format fmt = boost::format(str.c_str());
-	  debug_print(fmt);
+
+  // ------------------------------------------
+  void BoostStomp::complete_connect_waiters(const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  std::vector<detail::completion*> waiters;
+	  {
+		  boost::mutex::scoped_lock lock(m_async_mutex);
+		  waiters.swap(m_connect_waiters);
+	  }
+	  for (size_t i = 0; i < waiters.size(); i++) waiters[i]->complete(ec);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::send_with_receipt(Frame* frame, detail::completion* op)
+  // ------------------------------------------
+  {
+	  {
+		  boost::mutex::scoped_lock lock(m_async_mutex);
+		  string receipt_id = "bs-" + lexical_cast<string>(m_receipt_id++);
+		  frame->headers()["receipt"] = receipt_id;
+		  m_receipt_waiters[receipt_id] = op;
+	  }
+	  send_frame(frame);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::complete_receipt(const string& receipt_id, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  detail::completion* op = NULL;
+	  {
+		  boost::mutex::scoped_lock lock(m_async_mutex);
+		  std::map<string, detail::completion*>::iterator it = m_receipt_waiters.find(receipt_id);
+		  if (it == m_receipt_waiters.end()) return;
+		  op = it->second;
+		  m_receipt_waiters.erase(it);
+	  }
+	  op->complete(ec);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::fail_receipt_waiters(const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  std::map<string, detail::completion*> waiters;
+	  {
+		  boost::mutex::scoped_lock lock(m_async_mutex);
+		  waiters.swap(m_receipt_waiters);
+	  }
+	  for (std::map<string, detail::completion*>::iterator it = waiters.begin(); it != waiters.end(); it++)
+		  it->second->complete(ec);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::hold_reading()
+  // ------------------------------------------
+  {
+	  m_read_holds++;
   }
 
-  void BoostStomp::debug_print(const char* cstr) {
-	  boost::format fmt = boost::format(cstr);
-  	  BoostStomp::debug_print(fmt);
+  // ------------------------------------------
+  void BoostStomp::release_reading()
+  // ------------------------------------------
+  {
+	  // the pause state belongs to the IO thread, let it decide
+	  if (m_read_holds.fetch_sub(1) == 1)
+		  m_strand->post(boost::bind(&BoostStomp::resume_reading, this));
   }
 
-  void BoostStomp::debug_print(boost::format& fmt) {
-      using namespace boost::posix_time;
-      if (m_showDebug) {
-        ptime now = second_clock::universal_time();
-        global_stream_lock.lock();
-        std::cout << "[" << FormatTime(now) << ": " << boost::this_thread::get_id() << "] BoostStomp:" << fmt.str() << endl;
-        global_stream_lock.unlock();
-	 }
+  // ------------------------------------------
+  void BoostStomp::resume_reading()
+  // ------------------------------------------
+  {
+	  // a reconnect in between started reading already (and cleared m_read_paused),
+	  // a read still running or another hold leave the reader alone
+	  if ((m_stopped) || (!m_connected) || (!m_read_paused) || (m_read_holds.load() > 0)) return;
+	  m_read_paused = false;
+	  STOMP_DEBUG("reading resumed");
+	  start_stomp_read_headers();
   }
+
+  // ------------------------------------------
+  ClientStats BoostStomp::stats() const
+  // ------------------------------------------
+  {
+	  ClientStats st;
+	  st.nagle_mode 		= TransportOptions::NagleMode(m_nagle_mode.load());
+	  st.frames_sent 		= m_frames_sent;
+	  st.bytes_sent 		= m_bytes_sent;
+	  st.write_batches 		= m_write_batches;
+	  st.corked_batches 	= m_corked_batches;
+	  st.frames_received 	= m_frames_received;
+	  st.frames_queued 		= m_sendqueue.pending();
+	  st.write_wakeups 		= m_write_wakeups;
+	  st.paced_waits 		= m_paced_waits;
+	  st.dedup_lookups 		= m_dedup_lookups;
+	  st.dedup_hits 		= m_dedup_hits;
+	  st.filter_checks 		= m_filter_checks;
+	  st.filter_rejects 	= m_filter_rejects;
+	  st.receive_buffer 	= m_receive_capacity;
+	  st.receive_shrinks 	= m_receive_shrinks;
+	  st.io_sleeps 			= m_io_sleeps;
+	  return st;
+  }
+
+  // ------------------------------------------
+  void BoostStomp::cancel()
+  // ------------------------------------------
+  {
+	  complete_connect_waiters(boost::asio::error::operation_aborted);
+	  fail_receipt_waiters(boost::asio::error::operation_aborted);
+  }
+
+  // ------------------------------------------
+  void BoostStomp::enable_debug_msgs(bool b)
+  // ------------------------------------------
+  {
+      m_showDebug = b;
+  }
+  
 } // end namespace STOMP
@@ -33,16 +33,31 @@ http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
 #include <iostream>
 //#include <queue>
 #include <map>
+#include <future>
 #include <set>
+#include <initializer_list>
 
 #include <boost/asio.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 
 #include "StompFrame.hpp"
+#include "StompCodec.hpp"
+#include "StompAsync.hpp"
+#include "StompTransport.hpp"
+#include "StompScheduler.hpp"
+#include "StompDedup.hpp"
+#include "StompFilter.hpp"
+#include "StompTrace.hpp"
+#include "StompCapture.hpp"
+#include "StompThreads.hpp"
+#include "StompReactor.hpp"
 #include "helpers.h"
+#include "StompLog.hpp"
 
 
 namespace STOMP {
@@ -60,23 +75,95 @@ namespace STOMP {
 
     // Stomp message callback function prototype
     typedef bool (*pfnOnStompMessage_t)( Frame* );
+    // called (on the IO thread) when the client drops the connection for good
+    // because of what it received, eg. a frame over the ReceiveLimits
+    typedef void (*pfnOnStompError_t)( const boost::system::error_code& );
 
     // Stomp subscription map (topic => callback)
     typedef std::map<std::string, pfnOnStompMessage_t> subscription_map;
+    // pull-mode subscriptions (topic => frame queue)
+    typedef std::map<std::string, boost::shared_ptr<Subscription> > subscription_queue_map;
+    // duplicate filters (topic => message-ids seen)
+    typedef std::map<std::string, boost::shared_ptr<DedupFilter> > dedup_map;
+    typedef std::map<std::string, boost::shared_ptr<HeaderFilter> > filter_map;
+
+    // receive side memory budget, per connection. Exceeding a limit closes
+    // the connection and reports a FrameError (no reconnect).
+    struct ReceiveLimits {
+    	size_t 	max_header_bytes; 	// command line plus header lines
+    	size_t 	max_frame_bytes; 	// headers plus body
+    	size_t 	max_buffered_bytes; // the read buffer, raised to max_header_bytes + max_frame_bytes + 64K
+    	ReceiveLimits():
+    		max_header_bytes(256 * 1024), max_frame_bytes(64 << 20), max_buffered_bytes(80 << 20) {};
+    };
+
+    // ----------------------------------------
+    // frames to publish together with BoostStomp::send_batch(), for one or
+    // several destinations. Owns its frames until they are sent.
+    // ----------------------------------------
+    class PublishBatch {
+    	std::vector<Frame*> m_frames;
+    	PublishBatch(const PublishBatch&);
+    	PublishBatch& operator=(const PublishBatch&);
+    public:
+    	PublishBatch() {};
+    	~PublishBatch() { clear(); };
+
+    	template <typename BodyType>
+    	void add ( const std::string& destination, hdrmap headers, BodyType& body ) {
+    		headers["destination"] = destination;
+    		m_frames.push_back(new Frame( CMD_SEND, std::move(headers), body ));
+    	}
+    	// a SEND frame built by the caller (takes ownership)
+    	void add ( Frame* frame ) 	{ m_frames.push_back(frame); };
+    	void reserve ( size_t n ) 	{ m_frames.reserve(n); };
+    	size_t size() const 		{ return m_frames.size(); };
+    	bool empty() const 			{ return m_frames.empty(); };
+    	void clear() {
+    		for (size_t i = 0; i < m_frames.size(); i++) delete m_frames[i];
+    		m_frames.clear();
+    	}
+    	// hands the frames over, the batch is empty afterwards
+    	void release(std::vector<Frame*>& out) { out.swap(m_frames); m_frames.clear(); };
+    };
+
+    // client counters, see BoostStomp::stats()
+    struct ClientStats {
+    	TransportOptions::NagleMode nagle_mode; // in effect on the current connection
+    	uint64_t 	frames_sent;
+    	uint64_t 	bytes_sent;
+    	uint64_t 	write_batches; 		// writes of coalesced frames
+    	uint64_t 	corked_batches; 	// of which sent with TCP_CORK (adaptive mode)
+    	uint64_t 	frames_received;
+    	uint64_t 	frames_queued; 		// waiting in the output lanes
+    	uint64_t 	write_wakeups; 		// output actor runs posted by send() & co
+    	uint64_t 	paced_waits; 		// times the output actor waited for rate limit tokens
+    	uint64_t 	dedup_lookups; 		// MESSAGE frames checked by a duplicate filter
+    	uint64_t 	dedup_hits; 		// of which dropped as duplicates
+    	uint64_t 	filter_checks; 		// MESSAGE frames run through a header filter
+    	uint64_t 	filter_rejects; 	// of which dropped before their body was read
+    	uint64_t 	receive_buffer; 	// bytes allocated for the read buffer
+    	uint64_t 	receive_shrinks; 	// times it was given back after large frames
+    	uint64_t 	io_sleeps; 			// WAIT_SPIN_THEN_BLOCK: times the IO thread stopped spinning
+    };
 
     // here we go
 	// -------------
     class BoostStomp
     // -------------
     {        
+    	friend class Subscription;
         //----------------
         protected:
         //----------------
     		Frame* 				m_rcvd_frame;
     		//boost::shared_ptr< std::queue<Frame*> >  m_sendqueue;
     		//boost::shared_ptr< boost::mutex >        m_sendqueue_mutex;
-    		concurrent_queue<Frame*>	m_sendqueue;
+    		OutputScheduler 	m_sendqueue; // control lane + weighted publish lanes
             subscription_map    m_subscriptions;
+            subscription_queue_map m_subscription_queues;
+            dedup_map 			m_dedup; // only touched by the IO thread
+            filter_map 			m_filters; // the same
             //
             std::string         m_hostname;
             int                 m_port;
@@ -85,27 +172,105 @@ namespace STOMP {
             bool		m_stopped;
             bool		m_connected; // have we completed application-level STOMP connection?
 
+            // the reactor hosting us and our thread in it, or NULL: a thread of our own
+            StompReactor* 						m_reactor;
+            size_t 								m_reactor_thread;
             boost::shared_ptr< io_service > 		m_io_service;
 			boost::shared_ptr< io_service::work > 	m_io_service_work;
 			boost::shared_ptr< io_service::strand>	m_strand;
-			tcp::socket* 						m_socket;
+			boost::shared_ptr< Transport > 		m_transport;
+			Transport::socket_type* 			m_socket;
+			Stream 								m_stream; // m_socket, or TLS on top of it
+			TransportOptions 					m_options;
 
 
 
-			boost::asio::streambuf	stomp_request, stomp_response;
+			// re-allocated by the IO thread for ThreadOptions::numa_local_buffers
+			boost::scoped_ptr<boost::asio::streambuf> stomp_request;
+			// sized after the frames seen lately, replaced (never while a read is pending) to shrink it
+			boost::scoped_ptr<boost::asio::streambuf> stomp_response;
         //----------------
         private:
         //----------------
             boost::mutex 			stream_mutex;
             boost::thread*		worker_thread;
-            boost::shared_ptr<deadline_timer>	m_heartbeat_timer;
-            boost::asio::streambuf m_heartbeat;
-            string	m_protocol_version;
-            int 	m_transaction_id;
+            // on the timer wheel of our reactor, if any. Pacing needs a finer
+            // resolution than the wheel's ticks.
+            SessionTimer 						m_heartbeat_timer;
+            SessionTimer 						m_retry_timer;
+            boost::asio::deadline_timer 		m_pacing_timer;
+            bool 					m_pacing_armed;
+            // broker failover: RTT measurement, moving back to a better broker
+            boost::posix_time::ptime 			m_connect_sent;
+            SessionTimer 						m_failback_timer;
+            bool 					m_draining; // no more frames for this connection
+            static const int 		FAILBACK_INTERVAL = 30; // seconds between checks for a better broker
+            std::string 			m_login, m_passcode;
+            // negotiated protocol version: set on the IO thread, read by ack() /
+            // nack() on the caller's
+            boost::atomic<const FrameCodec*> m_codec;
+            boost::atomic<int> 	m_transaction_id;
             bool   m_showDebug;
+            static const pfnStompCommandHandler_t s_dispatch[CMD_COUNT];
+            // pending asynchronous operations
+            boost::mutex 			m_async_mutex;
+            std::vector<detail::completion*> 			m_connect_waiters;
+            std::map<std::string, detail::completion*> 	m_receipt_waiters;
+            unsigned int 			m_receipt_id;
+            // statistics
+            boost::atomic<int> 		m_nagle_mode;
+            boost::atomic<uint64_t> m_frames_sent, m_bytes_sent, m_write_batches, m_corked_batches, m_frames_received, m_paced_waits;
+            boost::atomic<uint64_t> m_dedup_lookups, m_dedup_hits, m_write_wakeups;
+            boost::atomic<uint64_t> m_filter_checks, m_filter_rejects;
+            // an output actor run is posted and has not looked at the queue yet
+            boost::atomic<bool> 	m_write_scheduled;
+            // sent SEND frames, rebuilt by emplace_send()
+            FramePool 				m_frame_pool;
+            // bodies of at least GATHER_MIN_BODY bytes are not copied into
+            // stomp_request: (offset in stomp_request, body) of the batch
+            static const size_t 	GATHER_MIN_BODY = 2048;
+            std::vector< std::pair<size_t, boost::asio::const_buffer> > m_gathered;
+            std::vector<boost::asio::const_buffer> m_write_buffers;
+            // duplicate filter of the MESSAGE being read (held: the topic's
+            // filter may be replaced while the body is read), and the verdict
+            boost::shared_ptr<DedupFilter> m_rcvd_dedup;
+            bool 					m_rcvd_duplicate;
+            // the MESSAGE being read was rejected by a filter, and what the
+            // filter wants done with it (copied: the filter may be gone by then)
+            bool 					m_rcvd_rejected;
+            FilterAction 			m_rcvd_action;
+            // latency tracing: on for received frames, every Nth SEND stamped
+            // (0: none), stamped frames not written yet, and when the traced
+            // MESSAGE being read arrived (0: not traced)
+            TraceRecorder 			m_trace;
+            boost::atomic<bool> 	m_tracing;
+            boost::atomic<uint32_t> m_trace_every, m_trace_counter;
+            boost::atomic<int> 		m_trace_pending;
+            uint64_t 				m_rcvd_traced_at;
+            // the last received frame, parsed into again unless it was kept,
+            // and the key for looking up received headers in our maps
+            Frame* 					m_rcvd_spare;
+            string 					m_rcvd_key;
+            const string& 			rcvd_key(boost::string_view v) { m_rcvd_key.assign(v.data(), v.size()); return m_rcvd_key; };
+            // receive budget, the sizes of the frame being read
+            ReceiveLimits 			m_limits;
+            pfnOnStompError_t 		m_error_callback;
+            size_t 					m_rcvd_header_bytes, m_rcvd_bodysize;
+            size_t 					m_recent_frame; // decaying maximum frame size
+            boost::atomic<uint64_t> m_receive_capacity, m_receive_shrinks;
+            static const size_t 	RECEIVE_BUFFER_MIN = 16384;
+            // IO thread placement, only touched by the IO thread once it runs
+            ThreadOptions 			m_threading;
+            bool 					m_io_pinned;
+            bool 					m_relocate_response; // at the next frame boundary
+            boost::atomic<uint64_t> m_io_sleeps;
+            // flow control for pull subscriptions
+            boost::atomic<int> 		m_read_holds; // full subscriptions
+            bool 					m_read_paused; // IO thread only
 
             //
-            bool send_frame( Frame* _frame );
+            bool send_frame( Frame* _frame, int lane = OutputScheduler::AUTO_LANE );
+            void schedule_write();
             bool do_subscribe (const string& topic);
             //
             void consume_received_frame();
@@ -113,9 +278,40 @@ namespace STOMP {
             void process_MESSAGE();
             void process_RECEIPT();
             void process_ERROR();
-
-            void start_connect(tcp::resolver::iterator endpoint_iter, string& login, string& passcode);
-            void handle_connect(const boost::system::error_code& ec, tcp::resolver::iterator endpoint_iter);
+            void do_set_queue(const std::string& topic, boost::shared_ptr<Subscription> sub);
+            void check_duplicate();
+            void check_filter();
+            void drop_received();
+            void trace_queued(Frame* frame);
+            void trace_written(Frame* frame);
+            void trace_received();
+            void do_set_dedup(const std::string& topic, boost::shared_ptr<DedupFilter> filter);
+            void do_set_filter(const std::string& topic, boost::shared_ptr<HeaderFilter> filter);
+            void do_set_receive_limits(const ReceiveLimits& limits);
+            void resize_receive_buffer(size_t capacity);
+            void receive_failed(const boost::system::error_code& ec);
+            void do_set_capture(boost::shared_ptr<CaptureWriter> capture);
+            void do_set_thread_options(const ThreadOptions& options);
+            void apply_thread_options();
+
+            void do_stop();
+            void stop_and_signal(std::promise<void>* done);
+            // every public constructor ends up here
+            BoostStomp(StompReactor* reactor, boost::shared_ptr<Transport> transport, AckMode ackmode,
+            		const TransportOptions& options);
+            bool on_io_thread() const;
+            void leave_reactor();
+            void reactor_barrier(std::promise<void>* done, int rounds);
+            void start_connect();
+            void handle_connect(const boost::system::error_code& ec);
+            void handle_handshake(const boost::system::error_code& ec);
+            void retry_connect(const boost::system::error_code& ec);
+            void handle_retry_timer(const boost::system::error_code& ec);
+            void connection_lost();
+            void start_failback_timer(const boost::posix_time::time_duration& delay);
+            void handle_failback_timer(const boost::system::error_code& ec);
+            void handle_failback_probe(bool better);
+            void switch_broker();
 
             //TODO: void setup_stomp_heartbeat(int cx, int cy);
 
@@ -123,27 +319,69 @@ namespace STOMP {
             void handle_stomp_heartbeat(const boost::system::error_code& ec);
 
             void start_stomp_read_headers();
-            void handle_stomp_read_headers(const boost::system::error_code& ec);
+            void handle_stomp_read_headers(const boost::system::error_code& ec, std::size_t bytes_transferred);
             void start_stomp_read_body(std::size_t);
             void handle_stomp_read_body(const boost::system::error_code& ec, std::size_t bytes_transferred);
 
             void start_stomp_write();
+            void start_pacing_timer(const boost::posix_time::time_duration& delay);
+            void handle_pacing_timer(const boost::system::error_code& ec);
             //void handle_stomp_write(const boost::system::error_code& ec);
 
             void worker( boost::shared_ptr< boost::asio::io_service > io_service );
-
-            void debug_print(boost::format& fmt);
-            void debug_print(string& str);
-            void debug_print(const char* str);
+            void run_io( boost::asio::io_service& io_service );
+
+            // asynchronous operation support
+            void wait_connected(detail::completion* op);
+            void send_with_receipt(Frame* frame, detail::completion* op);
+            void complete_connect_waiters(const boost::system::error_code& ec);
+            void complete_receipt(const std::string& receipt_id, const boost::system::error_code& ec);
+            void fail_receipt_waiters(const boost::system::error_code& ec);
+            // called by Subscription when its buffer fills up / drains
+            void hold_reading();
+            void release_reading();
+            void resume_reading();
+
+            struct initiate_connect {
+            	BoostStomp* self;
+            	template <typename Handler>
+            	void operator()(Handler&& handler) {
+            		typedef detail::completion_impl<typename std::decay<Handler>::type> op;
+            		self->wait_connected(detail::new_op<op>(handler));
+            	}
+            };
+            struct initiate_send_confirmed {
+            	BoostStomp* self;
+            	Frame* frame;
+            	template <typename Handler>
+            	void operator()(Handler&& handler) {
+            		typedef detail::completion_impl<typename std::decay<Handler>::type> op;
+            		self->send_with_receipt(frame, detail::new_op<op>(handler));
+            	}
+            };
             
         //----------------
         public:
         //----------------
             // constructor
-            BoostStomp(string& hostname, int& port, AckMode ackmode = ACK_AUTO);
+            BoostStomp(string& hostname, int& port, AckMode ackmode = ACK_AUTO,
+            		const TransportOptions& options = TransportOptions());
+            // connect through a transport URI: tcp://host:port, ssl://host:port or unix:///path/to/socket
+            BoostStomp(const string& uri, AckMode ackmode = ACK_AUTO,
+            		const TransportOptions& options = TransportOptions());
+            // connect through any transport, eg. a PairTransport in tests
+            BoostStomp(boost::shared_ptr<Transport> transport, AckMode ackmode = ACK_AUTO,
+            		const TransportOptions& options = TransportOptions());
+            // the same, hosted by a reactor: no thread of our own, see StompReactor.
+            // Destroy the client before the reactor, and not from its own handlers.
+            BoostStomp(StompReactor& reactor, const string& uri, AckMode ackmode = ACK_AUTO,
+            		const TransportOptions& options = TransportOptions());
+            BoostStomp(StompReactor& reactor, boost::shared_ptr<Transport> transport, AckMode ackmode = ACK_AUTO,
+            		const TransportOptions& options = TransportOptions());
             // destructor
             ~BoostStomp();
 
+            // handlers for custom server commands (standard ones are dispatched through s_dispatch)
             stomp_server_command_map_t	cmd_map;
 
             void start();
@@ -157,14 +395,141 @@ namespace STOMP {
             template <typename BodyType>
             bool send      ( std::string& _topic, hdrmap _headers, BodyType& _body, pfnOnStompMessage_t callback = NULL)  {
           	  _headers["destination"] = _topic;
-          	  Frame* frame = new Frame( "SEND", _headers, _body );
+          	  Frame* frame = new Frame( CMD_SEND, std::move(_headers), _body );
           	  return(send_frame(frame));
             }
-
+            // the same, through one of the lanes made by add_lane()
+            template <typename BodyType>
+            bool send_on   ( int lane, std::string& _topic, hdrmap _headers, BodyType& _body )  {
+          	  _headers["destination"] = _topic;
+          	  Frame* frame = new Frame( CMD_SEND, std::move(_headers), _body );
+          	  return(send_frame(frame, lane));
+            }
+            // Move-aware publishing: the destination is only read, the headers
+            // and the body are taken over, so nothing is copied on the way
+            bool send      ( boost::string_view _topic, hdrmap&& _headers, binbody&& _body,
+            		int lane = OutputScheduler::AUTO_LANE ) {
+          	  _headers["destination"].assign(_topic.data(), _topic.size());
+          	  return(send_frame(new Frame( CMD_SEND, std::move(_headers), std::move(_body) ), lane));
+            }
+            // Build the frame in place, inside a frame recycled from an earlier
+            // send (see FramePool): the views are copied straight into storage
+            // that is already there. A steady stream of messages with the same
+            // header names and similar sizes is published without allocating.
+            bool emplace_send ( boost::string_view _topic, std::initializer_list<header_view> _headers,
+            		boost::string_view _body, int lane = OutputScheduler::AUTO_LANE ) {
+            	return(emplace_send(_topic, _headers.begin(), _headers.size(), _body, lane));
+            }
+            bool emplace_send ( boost::string_view _topic, const header_view* _headers, size_t n,
+            		boost::string_view _body, int lane = OutputScheduler::AUTO_LANE );
+            // the same, taking the body over
+            bool emplace_send ( boost::string_view _topic, const header_view* _headers, size_t n,
+            		binbody&& _body, int lane = OutputScheduler::AUTO_LANE );
+            // Serialize the body in place: writer(BodyWriter&) runs right away, on
+            // the calling thread, and writes into the storage of a pooled frame.
+            // The content-length follows from what it wrote, and a large body
+            // goes to the socket from there, so it is written to memory once.
+            template <typename Writer>
+            bool send_with_writer ( boost::string_view _topic, std::initializer_list<header_view> _headers,
+            		Writer writer, int lane = OutputScheduler::AUTO_LANE ) {
+            	return(send_with_writer(_topic, _headers.begin(), _headers.size(), writer, lane));
+            }
+            template <typename Writer>
+            bool send_with_writer ( boost::string_view _topic, const header_view* _headers, size_t n,
+            		Writer writer, int lane = OutputScheduler::AUTO_LANE ) {
+            	Frame* frame = m_frame_pool.acquire();
+            	try {
+            		frame->rebuild(CMD_SEND, _topic, _headers, n);
+            		BodyWriter body(frame->body());
+            		writer(body);
+            	} catch (...) {
+            		m_frame_pool.release(frame);
+            		throw;
+            	}
+            	return(send_frame(frame, lane));
+            }
+            // Output lanes: ACK/NACK, (UN)SUBSCRIBE, transaction frames and heartbeats
+            // always go out first, SEND frames share the rest by lane weight
+            // (send() uses OutputScheduler::DEFAULT_LANE, weight 1). Frames keep
+            // their order within a lane.
+            int  add_lane ( unsigned weight ) 				{ return m_sendqueue.add_lane(weight); };
+            bool set_lane_weight ( int lane, unsigned weight ) 	{ return m_sendqueue.set_weight(lane, weight); };
+            // Publish pacing: SEND frames over the limit wait in their lane (the
+            // calling thread never blocks) and are released by a timer, a few
+            // at a time. Control frames are never paced. RateLimit() lifts a limit.
+            void set_rate_limit ( const RateLimit& limit ) 	{ m_sendqueue.set_rate_limit(limit); };
+            bool set_lane_rate_limit ( int lane, const RateLimit& limit ) { return m_sendqueue.set_lane_rate_limit(lane, limit); };
+            void set_destination_rate_limit ( const std::string& destination, const RateLimit& limit ) {
+            	m_sendqueue.set_destination_rate_limit(destination, limit);
+            };
+
+            // Queue a whole batch at once: one lock on the output lanes and at most
+            // one wakeup of the IO thread, instead of one per frame. In a
+            // transaction, the frames are wrapped in BEGIN / COMMIT. Returns the
+            // number of frames queued (the batch is empty afterwards).
+            size_t send_batch ( PublishBatch& batch, bool transactional = false,
+            		int lane = OutputScheduler::AUTO_LANE );
+            // the same for a range of bodies to one destination
+            template <typename BodyIterator>
+            size_t send_batch ( const std::string& _topic, const hdrmap& _headers, BodyIterator first, BodyIterator last,
+            		bool transactional = false, int lane = OutputScheduler::AUTO_LANE ) {
+            	PublishBatch batch;
+            	for (; first != last; ++first) batch.add(_topic, _headers, *first);
+            	return(send_batch(batch, transactional, lane));
+            }
             //bool send      ( std::string& topic, hdrmap _headers, std::string& body );
             //
             bool subscribe 	( std::string& topic, pfnOnStompMessage_t callback );
+            // pull-mode subscription buffering up to capacity frames, consume it with
+            // poll() or Subscription::async_next / async_next_batch
+            boost::shared_ptr<Subscription> subscribe ( std::string& topic, size_t capacity = Subscription::DEFAULT_CAPACITY );
+            // wait up to timeout for frames of a pull subscription, append up to max_n of them to out
+            size_t poll ( boost::shared_ptr<Subscription> subscription, std::vector< boost::shared_ptr<Frame> >& out,
+            		size_t max_n, const boost::posix_time::time_duration& timeout = boost::posix_time::pos_infin ) {
+            	return subscription->poll(out, max_n, timeout);
+            }
             bool unsubscribe ( std::string& topic );
+            // Drop MESSAGE frames whose message-id was already delivered on this
+            // topic, eg. redeliveries after a reconnect. Duplicates are still
+            // acknowledged in client ack modes, but never reach the callback or
+            // the pull queue. See DedupFilter for the memory / window bounds.
+            void enable_dedup ( const std::string& topic, size_t capacity = DedupFilter::DEFAULT_CAPACITY,
+            		const boost::posix_time::time_duration& window = boost::posix_time::minutes(10) );
+            void disable_dedup ( const std::string& topic );
+            // Only let MESSAGE frames on topic through when their headers match
+            // a filter expression (see StompFilter.hpp), eg.
+            //     "type == 'order' && priority >= 5"
+            // The filter runs as soon as the headers are read; rejected frames
+            // are skipped without reading their body into a frame and, in client
+            // ack modes, acknowledged according to action. The expression is
+            // compiled here: a syntax error throws std::invalid_argument. The
+            // returned filter counts checked / rejected frames.
+            boost::shared_ptr<HeaderFilter> set_filter ( const std::string& topic, const std::string& expression,
+            		FilterAction action = FILTER_ACK );
+            void clear_filter ( const std::string& topic );
+            // Trace latencies end to end (see StompTrace.hpp): a share of the SEND
+            // frames is stamped with queue and write times, and stamped MESSAGEs
+            // are timed through the broker and the local dispatch. Enable it on
+            // both ends; latency_report() has the histograms per destination.
+            void enable_tracing ( const TraceOptions& options = TraceOptions() );
+            void disable_tracing ();
+            LatencyReport latency_report ( bool reset = false ) { return m_trace.report(reset); };
+            // Record the raw bytes exchanged with the broker (decrypted, for TLS)
+            // into a memory-mapped ring file of capacity bytes, see StompCapture.hpp.
+            // src/stompreplay plays a capture back. Throws if the file cannot be
+            // created; capturing starts with the next read or write.
+            void start_capture ( const std::string& path, size_t capacity = CaptureWriter::DEFAULT_CAPACITY );
+            void stop_capture ();
+            // receive budget for the connection, see ReceiveLimits
+            void set_receive_limits ( const ReceiveLimits& limits );
+            // be told when the client gives up on a connection (it is stopped by then)
+            void set_error_callback ( pfnOnStompError_t callback ) { m_error_callback = callback; };
+            // Pin the IO thread to CPUs, choose how it waits for work and where
+            // its buffers live, see ThreadOptions. Takes effect right away, or
+            // when the IO thread starts. The log formatter thread is placed with
+            // log::set_formatter_cpus(). On a reactor the threads are the
+            // reactor's, only numa_local_buffers is taken.
+            void set_thread_options ( const ThreadOptions& options );
             bool acknowledge ( Frame* _frame, bool acked );
 
             // STOMP transactions
@@ -172,7 +537,46 @@ namespace STOMP {
             bool commit(int transaction_id);
             bool abort(int transaction_id);
             //
+            // ---- asio-style asynchronous operations (any completion token) ----
+
+            // complete when the STOMP session is established (starts the client if needed)
+            template <typename CompletionToken>
+            BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(CompletionToken, void(boost::system::error_code))
+            async_connect(CompletionToken&& token) {
+            	initiate_connect init = { this };
+            	return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code)>(init, token);
+            }
+
+            // send a frame and complete when the broker has confirmed it with a RECEIPT
+            template <typename BodyType, typename CompletionToken>
+            BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(CompletionToken, void(boost::system::error_code))
+            async_send_confirmed(const std::string& _topic, hdrmap _headers, BodyType& _body, CompletionToken&& token) {
+            	_headers["destination"] = _topic;
+            	initiate_send_confirmed init = { this, new Frame( CMD_SEND, std::move(_headers), _body ) };
+            	return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code)>(init, token);
+            }
+
+            // abort pending async_connect / async_send_confirmed operations (operation_aborted)
+            void cancel();
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            // coroutine flavours: co_await client.connect(), co_await client.send_confirmed(...)
+            boost::asio::awaitable<void> connect() {
+            	co_await async_connect(boost::asio::use_awaitable);
+            }
+            template <typename BodyType>
+            boost::asio::awaitable<void> send_confirmed(std::string _topic, hdrmap _headers, BodyType _body) {
+            	co_await async_send_confirmed(_topic, _headers, _body, boost::asio::use_awaitable);
+            }
+#endif
+
             AckMode get_ackmode() { return m_ackmode; };
+            ProtocolVersion get_protocol_version() { return m_codec.load()->version(); };
+            bool is_connected() { return m_connected; };
+            // the transport, eg. to inspect a FailoverTransport's endpoints
+            boost::shared_ptr<Transport> transport() const { return m_transport; };
+            // a snapshot of the client counters
+            ClientStats stats() const;
             //
     }; //class
 
@@ -0,0 +1,511 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//
+// FrameBench.cpp: micro-benchmarks for the Frame codec hot paths
+//
+// Every case runs against an in-memory corpus (no sockets involved) and
+// reports ns/frame, MB/s and heap allocations per frame. The send/ cases
+// publish through a client connected to a drained socketpair and count the
+// allocations of the publishing thread only. Results can be saved to a
+// baseline file and later runs compared against it:
+//
+//    framebench --save framebench.baseline
+//    framebench --compare framebench.baseline [--tolerance 10]
+//
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "BoostStomp.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+// -------------------------------
+// allocation counter, per thread: the send/ cases leave out the IO thread
+// -------------------------------
+// Every form goes through malloc / free. They are kept out of line: once a
+// delete is inlined, gcc pairs its free() with the operator new call site and
+// warns (-Wmismatched-new-delete).
+static thread_local size_t alloc_count = 0;
+
+static inline void* counted_malloc(size_t n) {
+	alloc_count++;
+	return malloc(n ? n : 1);
+}
+
+#define BENCH_NOINLINE __attribute__((noinline))
+
+BENCH_NOINLINE void* operator new(size_t n) {
+	if (void* p = counted_malloc(n)) return p;
+	throw std::bad_alloc();
+}
+BENCH_NOINLINE void* operator new[](size_t n) {
+	if (void* p = counted_malloc(n)) return p;
+	throw std::bad_alloc();
+}
+BENCH_NOINLINE void* operator new(size_t n, const std::nothrow_t&) throw() 		{ return counted_malloc(n); }
+BENCH_NOINLINE void* operator new[](size_t n, const std::nothrow_t&) throw() 	{ return counted_malloc(n); }
+BENCH_NOINLINE void operator delete(void* p) throw() 							{ free(p); }
+BENCH_NOINLINE void operator delete[](void* p) throw() 							{ free(p); }
+BENCH_NOINLINE void operator delete(void* p, size_t) throw() 					{ free(p); }
+BENCH_NOINLINE void operator delete[](void* p, size_t) throw() 					{ free(p); }
+BENCH_NOINLINE void operator delete(void* p, const std::nothrow_t&) throw() 	{ free(p); }
+BENCH_NOINLINE void operator delete[](void* p, const std::nothrow_t&) throw() 	{ free(p); }
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec);
+}
+
+// -------------------------------
+// benchmark harness
+// -------------------------------
+struct BenchResult {
+	string 	name;
+	double 	ns_per_frame;
+	double 	mb_per_s;
+	double 	allocs_per_frame;
+};
+
+// a benchmark case processes 'batch' frames per call and returns the bytes it handled
+class BenchCase {
+public:
+	string 	name;
+	size_t 	batch;
+	BenchCase(const string& n, size_t b): name(n), batch(b) {};
+	virtual ~BenchCase() {};
+	virtual void 	setup() {};
+	virtual size_t 	run() = 0;
+};
+
+static BenchResult measure(BenchCase& bc, double min_seconds) {
+	uint64_t elapsed = 0, frames = 0, bytes = 0, allocs = 0;
+	bc.setup(); bc.run(); // warm up caches and buffers
+	while (elapsed < uint64_t(min_seconds * 1e9)) {
+		bc.setup();
+		size_t a0 = alloc_count;
+		uint64_t t0 = now_ns();
+		bytes += bc.run();
+		elapsed += now_ns() - t0;
+		allocs += alloc_count - a0;
+		frames += bc.batch;
+	}
+	BenchResult r;
+	r.name = bc.name;
+	r.ns_per_frame = double(elapsed) / frames;
+	r.mb_per_s = (bytes / 1e6) / (elapsed / 1e9);
+	r.allocs_per_frame = double(allocs) / frames;
+	return r;
+}
+
+// -------------------------------
+// frame corpus
+// -------------------------------
+struct CorpusFrame {
+	string 	name;
+	hdrmap 	headers;
+	string 	body;
+	bool 	content_length; // false: body terminated by the NULL only
+};
+
+static vector<CorpusFrame> build_corpus() {
+	vector<CorpusFrame> corpus;
+	CorpusFrame f;
+	f.headers["destination"] = "/queue/orders";
+	f.headers["message-id"] = "ID:broker-1-4711-1";
+	f.headers["subscription"] = "0";
+	f.content_length = true;
+
+	f.name = "small"; 	f.body = string(64, 'x');
+	corpus.push_back(f);
+	f.name = "small_nocl"; f.content_length = false;
+	corpus.push_back(f);
+	f.content_length = true;
+
+	f.name = "large"; 	f.body = string(64 * 1024, 'x');
+	corpus.push_back(f);
+	f.name = "large_nocl"; f.content_length = false;
+	corpus.push_back(f);
+	f.content_length = true;
+
+	f.name = "many_headers"; f.body = string(256, 'x');
+	for (int i = 0; i < 32; i++)
+		f.headers["x-custom-header-" + lexical_cast<string>(i)] = "value-" + lexical_cast<string>(i * 7919);
+	corpus.push_back(f);
+
+	f.name = "escaped_headers";
+	f.headers.clear();
+	f.headers["destination"] = "/queue/orders";
+	f.headers["message-id"] = "ID:broker-1:4711:1";
+	for (int i = 0; i < 8; i++)
+		f.headers["x-path:" + lexical_cast<string>(i)] = "C:\\data\\file" + lexical_cast<string>(i) + "\nline2";
+	corpus.push_back(f);
+	return corpus;
+}
+
+// raw wire bytes of a received MESSAGE frame
+static string wire_bytes(const CorpusFrame& cf) {
+	hdrmap h = cf.headers;
+	Frame frame("MESSAGE", h, cf.body);
+	boost::asio::streambuf sb;
+	frame.encode(sb);
+	string raw(boost::asio::buffer_cast<const char*>(sb.data()), sb.size());
+	if (!cf.content_length) {
+		size_t p = raw.find("content-length:");
+		raw.erase(p, raw.find('\n', p) - p + 1);
+	}
+	return raw;
+}
+
+// -------------------------------
+// benchmark cases
+// -------------------------------
+class EncodeCase: public BenchCase {
+	Frame 					m_frame;
+	boost::asio::streambuf 	m_sb;
+public:
+	EncodeCase(const CorpusFrame& cf):
+		BenchCase("encode/" + cf.name, 100),
+		m_frame("SEND", cf.headers, cf.body) {};
+	size_t run() {
+		size_t bytes = 0;
+		for (size_t i = 0; i < batch; i++) {
+			m_frame.encode(m_sb);
+			bytes += m_sb.size();
+			m_sb.consume(m_sb.size());
+		}
+		return bytes;
+	}
+};
+
+class ParseCase: public BenchCase {
+	string 						m_raw;
+	boost::asio::streambuf 		m_sb;
+	stomp_server_command_map_t 	m_cmd_map;
+	bool 						m_route;
+	Frame 						m_frame;
+public:
+	// route: what the client does with a message it only dispatches on its
+	// destination, parsing into the same frame without decoding or copying
+	ParseCase(const CorpusFrame& cf, bool route = false):
+		BenchCase((route ? "route/" : "parse/") + cf.name, 100),
+		m_raw(wire_bytes(cf)),
+		m_route(route),
+		m_frame(CMD_UNKNOWN)
+	{
+		m_cmd_map["CONNECTED"] = NULL;
+		m_cmd_map["MESSAGE"] = NULL;
+		m_cmd_map["RECEIPT"] = NULL;
+		m_cmd_map["ERROR"] = NULL;
+	};
+	// refill the receive buffer outside of the timed section
+	void setup() {
+		m_sb.consume(m_sb.size());
+		for (size_t i = 0; i < batch; i++) m_sb.sputn(m_raw.data(), m_raw.size());
+	}
+	size_t run() {
+		for (size_t i = 0; i < batch; i++) {
+			if (m_route) {
+				m_frame.parse_head(m_sb, m_cmd_map);
+				if (m_frame.header("destination").empty()) abort();
+				m_sb.consume(m_frame.attach_body(m_sb));
+			} else {
+				Frame frame(m_sb, m_cmd_map);
+				frame.parse_body(m_sb);
+				frame.headers();
+			}
+		}
+		return batch * m_raw.size();
+	}
+};
+
+// a subscription filter rejecting frames before their body is read
+class FilterCase: public BenchCase {
+	string 						m_raw;
+	boost::asio::streambuf 		m_sb;
+	stomp_server_command_map_t 	m_cmd_map;
+	HeaderFilter 				m_filter;
+	Frame 						m_frame;
+public:
+	FilterCase(const CorpusFrame& cf, const char* expression):
+		BenchCase("filter/" + cf.name, 100),
+		m_raw(wire_bytes(cf)),
+		m_filter(expression),
+		m_frame(CMD_UNKNOWN)
+	{
+		m_cmd_map["MESSAGE"] = NULL;
+	};
+	void setup() {
+		m_sb.consume(m_sb.size());
+		for (size_t i = 0; i < batch; i++) m_sb.sputn(m_raw.data(), m_raw.size());
+	}
+	size_t run() {
+		for (size_t i = 0; i < batch; i++) {
+			m_frame.parse_head(m_sb, m_cmd_map);
+			if (m_filter.accept(m_frame)) abort();
+			m_frame.skip_body(m_sb);
+		}
+		return batch * m_raw.size();
+	}
+};
+
+class HeaderTokenCase: public BenchCase {
+	vector<string> 	m_tokens;
+	bool 			m_encode;
+public:
+	HeaderTokenCase(bool enc):
+		BenchCase(enc ? "header_token/encode" : "header_token/decode", 1000),
+		m_encode(enc)
+	{
+		const char* plain[] = { "destination", "/queue/orders", "ID:broker-1:4711:1", "C:\\data\\file\nline2" };
+		for (size_t i = 0; i < batch; i++) {
+			string s = plain[i % 4];
+			if (!m_encode) encode_header_token(s);
+			m_tokens.push_back(s);
+		}
+	};
+	size_t run() {
+		size_t bytes = 0;
+		for (size_t i = 0; i < batch; i++) {
+			string s = m_tokens[i];
+			bytes += (m_encode ? encode_header_token(s) : decode_header_token(s)).size();
+		}
+		return bytes;
+	}
+};
+
+// -------------------------------
+// a client whose broker end is read and thrown away by a thread of its own.
+// Shared by the send/ cases.
+// -------------------------------
+class SendFixture {
+	boost::shared_ptr<PairTransport> 	m_pair;
+	boost::asio::io_service 			m_io;
+	Transport::socket_type 				m_peer;
+	boost::thread* 						m_drain;
+	uint64_t 							m_base;
+
+	void drain() {
+		char buf[65536];
+		boost::system::error_code ec;
+		while (!ec) m_peer.read_some(boost::asio::buffer(buf), ec);
+	}
+public:
+	BoostStomp* 	client;
+	uint64_t 		sent; 	// frames published by the cases
+
+	SendFixture(): m_pair(new PairTransport()), m_peer(m_io), m_drain(NULL), m_base(0), client(NULL), sent(0) {
+		client = new BoostStomp(boost::shared_ptr<Transport>(m_pair));
+		m_pair->assign_peer(m_peer);
+		client->start();
+		string connected = "CONNECTED\nversion:1.2\n\n";
+		connected += '\0';
+		boost::asio::write(m_peer, boost::asio::buffer(connected));
+		for (int i = 0; (i < 1000) && !client->is_connected(); i++) usleep(1000);
+		m_drain = new boost::thread(boost::bind(&SendFixture::drain, this));
+		m_base = client->stats().frames_sent;
+	}
+	~SendFixture() {
+		client->stop();
+		boost::system::error_code ec;
+		m_peer.shutdown(Transport::socket_type::shutdown_both, ec);
+		m_drain->join();
+		delete m_drain;
+		delete client;
+	}
+	// until the IO thread has written (and recycled) everything
+	void wait_sent() {
+		while (client->stats().frames_sent < m_base + sent) usleep(50);
+	}
+};
+
+class SendCase: public BenchCase {
+public:
+	typedef enum { SEND_COPY, SEND_MOVE, SEND_EMPLACE, SEND_WRITER } Mode;
+private:
+	boost::shared_ptr<SendFixture> 	m_fixture;
+	Mode 				m_mode;
+	string 				m_topic;
+	hdrmap 				m_headers;
+	binbody 			m_body;
+	vector<header_view> m_views;
+	static const char* mode_name(Mode m) {
+		return (m == SEND_COPY) ? "copy" : (m == SEND_MOVE) ? "move" : (m == SEND_EMPLACE) ? "emplace" : "writer";
+	}
+public:
+	SendCase(boost::shared_ptr<SendFixture> fixture, Mode mode, size_t body_size):
+		BenchCase(string("send/") + mode_name(mode) + "_" + lexical_cast<string>(body_size), 100),
+		m_fixture(fixture), m_mode(mode), m_topic("/queue/orders")
+	{
+		m_headers["content-type"] = "application/octet-stream";
+		m_headers["correlation-id"] = "order-4711-0001-a";
+		m_headers["persistent"] = "true";
+		m_headers["x-trace-id"] = "b7f2c1d0a9e84411";
+		m_body.v.assign(body_size, 'x');
+		for (hdrmap::iterator it = m_headers.begin(); it != m_headers.end(); it++)
+			m_views.push_back(header_view(it->first, it->second));
+	};
+	void setup() { m_fixture->wait_sent(); }
+	size_t run() {
+		BoostStomp* client = m_fixture->client;
+		for (size_t i = 0; i < batch; i++) {
+			switch (m_mode) {
+			case SEND_COPY:
+				// the classic API: headers and body stay with the caller
+				client->send(m_topic, m_headers, m_body);
+				break;
+			case SEND_MOVE: {
+				// headers and body built for this message, then handed over
+				hdrmap h;
+				for (size_t j = 0; j < m_views.size(); j++)
+					h[string(m_views[j].first)] = string(m_views[j].second);
+				client->send(m_topic, std::move(h), binbody(m_body.v.data(), m_body.v.size()));
+				break;
+			}
+			case SEND_EMPLACE:
+				client->emplace_send(m_topic, m_views.data(), m_views.size(),
+						boost::string_view(m_body.v.data(), m_body.v.size()));
+				break;
+			case SEND_WRITER: {
+				// the payload serialized straight into the frame
+				const binbody& payload = m_body;
+				client->send_with_writer(m_topic, m_views.data(), m_views.size(), [&payload](BodyWriter& w) {
+					memcpy(w.prepare(payload.v.size()), payload.v.data(), payload.v.size());
+					w.commit(payload.v.size());
+				});
+				break;
+			}
+			}
+		}
+		m_fixture->sent += batch;
+		return batch * m_body.v.size();
+	}
+};
+
+// -------------------------------
+// baseline files: one "name ns_per_frame mb_per_s allocs_per_frame" line per case
+// -------------------------------
+static map<string, BenchResult> load_baseline(const char* path) {
+	map<string, BenchResult> results;
+	ifstream in(path);
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream ls(line);
+		BenchResult r;
+		if (ls >> r.name >> r.ns_per_frame >> r.mb_per_s >> r.allocs_per_frame)
+			results[r.name] = r;
+	}
+	return results;
+}
+
+static void usage() {
+	cerr << "usage: framebench [--filter SUBSTR] [--time SECONDS] [--save FILE] [--compare FILE] [--tolerance PCT]" << endl;
+	exit(1);
+}
+
+// -----------------------------------------
+int main(int argc, char *argv[]) {
+// -----------------------------------------
+	const char 	*save_path = NULL, *compare_path = NULL, *filter = "";
+	double 		tolerance = 10.0, seconds = 0.2;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if 		(arg == "--save" && i + 1 < argc) 		save_path = argv[++i];
+		else if (arg == "--compare" && i + 1 < argc) 	compare_path = argv[++i];
+		else if (arg == "--tolerance" && i + 1 < argc) 	tolerance = atof(argv[++i]);
+		else if (arg == "--time" && i + 1 < argc) 		seconds = atof(argv[++i]);
+		else if (arg == "--filter" && i + 1 < argc) 	filter = argv[++i];
+		else usage();
+	}
+
+	vector<BenchCase*> cases;
+	vector<CorpusFrame> corpus = build_corpus();
+	for (size_t i = 0; i < corpus.size(); i++) cases.push_back(new EncodeCase(corpus[i]));
+	for (size_t i = 0; i < corpus.size(); i++) cases.push_back(new ParseCase(corpus[i]));
+	for (size_t i = 0; i < corpus.size(); i++) cases.push_back(new ParseCase(corpus[i], true));
+	for (size_t i = 0; i < corpus.size(); i++)
+		cases.push_back(new FilterCase(corpus[i], "destination ^= '/topic/' || (subscription == '0' && x-priority >= 5)"));
+	cases.push_back(new HeaderTokenCase(true));
+	cases.push_back(new HeaderTokenCase(false));
+	boost::shared_ptr<SendFixture> fixture(new SendFixture());
+	size_t send_sizes[] = { 64, 16384 };
+	for (int m = SendCase::SEND_COPY; m <= SendCase::SEND_WRITER; m++)
+		for (size_t i = 0; i < 2; i++) cases.push_back(new SendCase(fixture, SendCase::Mode(m), send_sizes[i]));
+
+	map<string, BenchResult> baseline;
+	if (compare_path) baseline = load_baseline(compare_path);
+
+	vector<BenchResult> results;
+	int regressions = 0;
+	printf("%-28s %12s %12s %10s", "case", "ns/frame", "MB/s", "allocs");
+	if (compare_path) printf(" %10s %10s", "ns delta", "allocs delta");
+	printf("\n");
+	for (size_t i = 0; i < cases.size(); i++) {
+		if (cases[i]->name.find(filter) == string::npos) continue;
+		BenchResult r = measure(*cases[i], seconds);
+		results.push_back(r);
+		printf("%-28s %12.1f %12.1f %10.2f", r.name.c_str(), r.ns_per_frame, r.mb_per_s, r.allocs_per_frame);
+		if (compare_path && baseline.count(r.name)) {
+			const BenchResult& b = baseline[r.name];
+			double delta = 100.0 * (r.ns_per_frame - b.ns_per_frame) / b.ns_per_frame;
+			bool regressed = (delta > tolerance) || (r.allocs_per_frame > b.allocs_per_frame + 0.01);
+			printf(" %+9.1f%% %+10.2f%s", delta, r.allocs_per_frame - b.allocs_per_frame, regressed ? "  REGRESSION" : "");
+			if (regressed) regressions++;
+		}
+		printf("\n");
+		delete cases[i];
+	}
+
+	if (save_path) {
+		ofstream out(save_path);
+		out << "# framebench baseline: name ns_per_frame mb_per_s allocs_per_frame" << endl;
+		for (size_t i = 0; i < results.size(); i++)
+			out << results[i].name << " " << results[i].ns_per_frame << " "
+				<< results[i].mb_per_s << " " << results[i].allocs_per_frame << endl;
+	}
+	if (compare_path && baseline.empty()) {
+		cerr << "framebench: no baseline found in " << compare_path << endl;
+		return 2;
+	}
+	return (regressions > 0) ? 1 : 0;
+}
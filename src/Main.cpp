@@ -98,14 +98,6 @@ int main(int argc, char *argv[]) {
         bb2 << "TWO NULLs in it.";
         stomp_client->send(notifications_topic, headers, bb2);
         sleep(2);
-        // now some stress test (100 frames)
-        STOMP::hdrmap headers2;
-        for (int i = 0;  i < 100; i++) {
-        	cout << "Sending stress frame " << i << endl;
-        	headers2["count"] = to_string<int>(i);
-        	stomp_client->send(notifications_topic, headers2, "");
-        };
-        sleep(2);
         stomp_client->stop();
         delete stomp_client;
     } 
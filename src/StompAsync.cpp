@@ -0,0 +1,181 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include "BoostStomp.hpp"
+#include "StompAsync.hpp"
+
+namespace STOMP {
+
+  // ------------------------------------------
+  Subscription::~Subscription()
+  // ------------------------------------------
+  {
+	  fail(boost::asio::error::operation_aborted);
+	  for (size_t i = 0; i < m_frames.size(); i++) delete m_frames[i];
+  }
+
+  // ------------------------------------------
+  size_t Subscription::pending()
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_frames.size();
+  }
+
+  // ------------------------------------------
+  void Subscription::deliver(Frame* frame)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  m_frames.push_back(frame);
+	  if (!m_throttled && (m_frames.size() >= m_capacity) && m_client) {
+		  // buffer full: hold the reader until consumers catch up
+		  m_throttled = true;
+		  m_client->hold_reading();
+	  }
+	  m_cond.notify_all();
+	  if (detail::frames_completion* op = m_waiter) {
+		  m_waiter = NULL;
+		  std::vector< boost::shared_ptr<Frame> > frames;
+		  take(lock, op->max_frames, frames);
+		  op->complete(boost::system::error_code(), frames);
+	  }
+  }
+
+  // ------------------------------------------
+  void Subscription::wait(detail::frames_completion* op)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (m_waiter != NULL) {
+		  // only one outstanding async_next* per subscription
+		  lock.unlock();
+		  std::vector< boost::shared_ptr<Frame> > none;
+		  op->complete(boost::asio::error::in_progress, none);
+	  } else if (m_frames.empty() && (m_client == NULL)) {
+		  // detached: nothing is going to be delivered any more
+		  lock.unlock();
+		  std::vector< boost::shared_ptr<Frame> > none;
+		  op->complete(boost::asio::error::operation_aborted, none);
+	  } else if (m_frames.empty()) {
+		  m_waiter = op;
+	  } else {
+		  std::vector< boost::shared_ptr<Frame> > frames;
+		  take(lock, op->max_frames, frames);
+		  op->complete(boost::system::error_code(), frames);
+	  }
+  }
+
+  // ------------------------------------------
+  size_t Subscription::poll(std::vector< boost::shared_ptr<Frame> >& out, size_t max_n,
+		  const boost::posix_time::time_duration& timeout)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (timeout.is_pos_infinity()) {
+		  while (m_frames.empty() && m_client) m_cond.wait(lock);
+	  } else {
+		  boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + timeout;
+		  while (m_frames.empty() && m_client) {
+			  if (!m_cond.timed_wait(lock, deadline)) break;
+		  }
+	  }
+	  return take(lock, max_n, out);
+  }
+
+  // ------------------------------------------
+  size_t Subscription::take(size_t max, std::vector< boost::shared_ptr<Frame> >& out)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return take(lock, max, out);
+  }
+
+  // ------------------------------------------
+  size_t Subscription::take(boost::mutex::scoped_lock& lock, size_t max, std::vector< boost::shared_ptr<Frame> >& out)
+  // ------------------------------------------
+  {
+	  // called with m_mutex held, returns with it released
+	  size_t n = 0;
+	  while (!m_frames.empty() && n < std::max(max, size_t(1))) {
+		  out.push_back(boost::shared_ptr<Frame>(m_frames.front()));
+		  m_frames.pop_front();
+		  n++;
+	  }
+	  if (m_throttled && (m_frames.size() <= m_capacity / 2)) {
+		  // drained below the low watermark: let the reader go again
+		  m_throttled = false;
+		  if (m_client) m_client->release_reading();
+	  }
+	  // frames handed to the application count as processed. In client ack
+	  // modes, unread frames are not acknowledged, which throttles the broker.
+	  // Still under m_mutex: detach() waits for it, so the client is not
+	  // destroyed meanwhile (acknowledging only queues the frames).
+	  if (m_client != NULL) {
+		  AckMode ackmode = m_client->get_ackmode();
+		  if ((ackmode == ACK_CLIENT) || (ackmode == ACK_CLIENT_INDIVIDUAL)) {
+			  for (size_t i = out.size() - n; i < out.size(); i++)
+				  m_client->acknowledge(out[i].get(), true);
+		  }
+	  }
+	  lock.unlock();
+	  return n;
+  }
+
+  // ------------------------------------------
+  void Subscription::fail(const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (detail::frames_completion* op = m_waiter) {
+		  m_waiter = NULL;
+		  lock.unlock();
+		  std::vector< boost::shared_ptr<Frame> > none;
+		  op->complete(ec, none);
+	  }
+  }
+
+  // ------------------------------------------
+  void Subscription::detach()
+  // ------------------------------------------
+  {
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  if (m_throttled && m_client) m_client->release_reading();
+		  m_throttled = false;
+		  m_client = NULL;
+		  // wake up pollers, they get whatever is left
+		  m_cond.notify_all();
+	  }
+	  fail(boost::asio::error::operation_aborted);
+  }
+
+  // ------------------------------------------
+  void Subscription::cancel()
+  // ------------------------------------------
+  {
+	  fail(boost::asio::error::operation_aborted);
+  }
+
+} // namespace STOMP
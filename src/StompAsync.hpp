@@ -0,0 +1,289 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompAsync.hpp
+//
+// Plumbing for the asio-style asynchronous operations of BoostStomp
+// (async_connect, async_send_confirmed, Subscription::async_next...).
+// They accept any asio completion token: plain callbacks, use_future,
+// or use_awaitable from C++20 coroutines. Completion handlers always run
+// on their own associated executor, never on the client's IO thread.
+//
+
+#ifndef __StompAsync_H_
+#define __StompAsync_H_
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <new>
+#include <vector>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif
+
+#include "StompFrame.hpp"
+
+namespace STOMP {
+
+  class BoostStomp;
+
+  namespace detail {
+
+	// ----------------------------------------
+	// a handler bound to its completion arguments
+	// ----------------------------------------
+	template <typename Handler, typename Arg1>
+	struct binder1 {
+		Handler 	handler;
+		Arg1 		arg1;
+		binder1(Handler& h, const Arg1& a1): handler(std::move(h)), arg1(a1) {};
+		void operator()() { handler(arg1); };
+	};
+
+	template <typename Handler, typename Arg1, typename Arg2>
+	struct binder2 {
+		Handler 	handler;
+		Arg1 		arg1;
+		Arg2 		arg2;
+		binder2(Handler& h, const Arg1& a1, Arg2& a2): handler(std::move(h)), arg1(a1), arg2(std::move(a2)) {};
+		void operator()() { handler(arg1, std::move(arg2)); };
+	};
+
+	// ----------------------------------------
+	// Operations are allocated with their handler's associated allocator,
+	// and freed before the handler is posted, as asio's own are: a handler
+	// that carries a recycling allocator makes them cost no heap allocation.
+	// ----------------------------------------
+	template <typename Op, typename Handler>
+	struct op_alloc {
+		typedef typename boost::asio::associated_allocator<Handler>::type handler_allocator;
+		typedef typename std::allocator_traits<handler_allocator>::template rebind_alloc<Op> type;
+		typedef std::allocator_traits<type> traits;
+	};
+
+	template <typename Op, typename Handler, typename... Args>
+	Op* new_op(Handler& handler, Args... args) {
+		typedef op_alloc<Op, Handler> A;
+		typename A::type alloc(boost::asio::get_associated_allocator(handler));
+		Op* op = A::traits::allocate(alloc, 1);
+		try {
+			new (op) Op(handler, args...);
+		} catch (...) {
+			A::traits::deallocate(alloc, op, 1);
+			throw;
+		}
+		return op;
+	}
+
+	// the allocator is taken from the handler before it is moved out
+	template <typename Op, typename Alloc>
+	void delete_op(Alloc& alloc, Op* op) {
+		op->~Op();
+		std::allocator_traits<Alloc>::deallocate(alloc, op, 1);
+	}
+
+	// ----------------------------------------
+	// pending operation completing with void(error_code)
+	// ----------------------------------------
+	class completion {
+	public:
+		virtual ~completion() {};
+		// post the handler to its executor and destroy this object
+		virtual void complete(const boost::system::error_code& ec) = 0;
+	};
+
+	template <typename Handler>
+	class completion_impl: public completion {
+		typedef typename boost::asio::associated_executor<Handler>::type executor_type;
+		typedef typename op_alloc<completion_impl, Handler>::type allocator_type;
+		Handler 										m_handler;
+		boost::asio::executor_work_guard<executor_type> m_work;
+	public:
+		completion_impl(Handler& h):
+			m_handler(std::move(h)),
+			m_work(boost::asio::get_associated_executor(m_handler)) {};
+		void complete(const boost::system::error_code& ec) {
+			allocator_type alloc(boost::asio::get_associated_allocator(m_handler));
+			executor_type ex = m_work.get_executor();
+			binder1<Handler, boost::system::error_code> bound(m_handler, ec);
+			// the posted handler keeps the executor busy from here on
+			delete_op(alloc, this);
+			boost::asio::post(ex, std::move(bound));
+		}
+	};
+
+	// ----------------------------------------
+	// pending operation completing with received frames
+	// ----------------------------------------
+	class frames_completion {
+	public:
+		size_t max_frames;
+		frames_completion(size_t max): max_frames(max) {};
+		virtual ~frames_completion() {};
+		virtual void complete(const boost::system::error_code& ec, std::vector< boost::shared_ptr<Frame> >& frames) = 0;
+	};
+
+	// Batch == false: void(error_code, shared_ptr<Frame>)
+	// Batch == true:  void(error_code, vector< shared_ptr<Frame> >)
+	template <typename Handler, bool Batch>
+	class frames_completion_impl: public frames_completion {
+		typedef typename boost::asio::associated_executor<Handler>::type executor_type;
+		typedef typename op_alloc<frames_completion_impl, Handler>::type allocator_type;
+		Handler 										m_handler;
+		boost::asio::executor_work_guard<executor_type> m_work;
+	public:
+		frames_completion_impl(Handler& h, size_t max):
+			frames_completion(max),
+			m_handler(std::move(h)),
+			m_work(boost::asio::get_associated_executor(m_handler)) {};
+		void complete(const boost::system::error_code& ec, std::vector< boost::shared_ptr<Frame> >& frames) {
+			allocator_type alloc(boost::asio::get_associated_allocator(m_handler));
+			executor_type ex = m_work.get_executor();
+			Handler handler(std::move(m_handler));
+			delete_op(alloc, this);
+			post_frames(ex, handler, ec, frames, boost::integral_constant<bool, Batch>());
+		}
+	private:
+		static void post_frames(executor_type& ex, Handler& handler, const boost::system::error_code& ec,
+				std::vector< boost::shared_ptr<Frame> >& frames, boost::true_type) {
+			binder2<Handler, boost::system::error_code, std::vector< boost::shared_ptr<Frame> > > bound(handler, ec, frames);
+			boost::asio::post(ex, std::move(bound));
+		}
+		static void post_frames(executor_type& ex, Handler& handler, const boost::system::error_code& ec,
+				std::vector< boost::shared_ptr<Frame> >& frames, boost::false_type) {
+			boost::shared_ptr<Frame> frame;
+			if (!frames.empty()) frame = frames.front();
+			binder2<Handler, boost::system::error_code, boost::shared_ptr<Frame> > bound(handler, ec, frame);
+			boost::asio::post(ex, std::move(bound));
+		}
+	};
+
+  } // namespace detail
+
+  // ----------------------------------------
+  // A pull-mode subscription: frames are queued by the IO thread and
+  // handed out to poll / async_next / async_next_batch, in client ack modes
+  // the ACK is sent when a frame is handed out.
+  // The queue is bounded: once it holds capacity() frames the client stops
+  // reading from the socket until consumers have drained half of it.
+  // ----------------------------------------
+  class Subscription {
+	  friend class BoostStomp;
+
+	  BoostStomp* 					m_client;
+	  std::string 					m_topic;
+	  size_t 						m_capacity;
+	  boost::mutex 					m_mutex;
+	  boost::condition_variable 	m_cond;
+	  std::deque<Frame*> 			m_frames;
+	  detail::frames_completion* 	m_waiter;
+	  bool 							m_throttled; // full, holding the client's reads
+
+	  // IO thread: queue a received frame (takes ownership)
+	  void deliver(Frame* frame);
+	  // complete the waiter (if any) with an error, eg. on unsubscribe
+	  void fail(const boost::system::error_code& ec);
+	  // the client is going away: fail the waiter, release the reader
+	  void detach();
+	  // try to satisfy a new waiter right away, or park it
+	  void wait(detail::frames_completion* op);
+	  // hand frames over to the application, acknowledging them
+	  size_t take(size_t max, std::vector< boost::shared_ptr<Frame> >& out);
+	  size_t take(boost::mutex::scoped_lock& lock, size_t max, std::vector< boost::shared_ptr<Frame> >& out);
+
+	  template <bool Batch>
+	  struct initiate_next {
+		  Subscription* self;
+		  size_t max;
+		  template <typename Handler>
+		  void operator()(Handler&& handler) {
+			  typedef detail::frames_completion_impl<typename std::decay<Handler>::type, Batch> op;
+			  self->wait(detail::new_op<op>(handler, max));
+		  }
+	  };
+
+  public:
+	  static const size_t DEFAULT_CAPACITY = 1024;
+
+	  Subscription(BoostStomp* client, const std::string& topic, size_t capacity = DEFAULT_CAPACITY):
+		  m_client(client), m_topic(topic), m_capacity(std::max(capacity, size_t(1))),
+		  m_waiter(NULL), m_throttled(false) {};
+	  ~Subscription();
+
+	  const std::string& topic() const { return m_topic; };
+	  size_t capacity() const { return m_capacity; };
+	  // number of frames buffered and not yet handed out
+	  size_t pending();
+
+	  // Blocking batch consumer: wait up to timeout for at least one frame,
+	  // then append up to max_n buffered frames to out. Returns the number
+	  // of frames appended (0 on timeout). Safe to call from several threads.
+	  size_t poll(std::vector< boost::shared_ptr<Frame> >& out, size_t max_n,
+			  const boost::posix_time::time_duration& timeout = boost::posix_time::pos_infin);
+
+	  // wait for the next frame: void(error_code, shared_ptr<Frame>). Once the
+	  // client is gone and the frames left are taken, operation_aborted.
+	  template <typename CompletionToken>
+	  BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(CompletionToken, void(boost::system::error_code, boost::shared_ptr<Frame>))
+	  async_next(CompletionToken&& token) {
+		  initiate_next<false> init = { this, 1 };
+		  return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, boost::shared_ptr<Frame>)>(init, token);
+	  }
+
+	  // wait for at least one frame, returns up to max_frames of them at once:
+	  // void(error_code, vector< shared_ptr<Frame> >)
+	  template <typename CompletionToken>
+	  BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(CompletionToken, void(boost::system::error_code, std::vector< boost::shared_ptr<Frame> >))
+	  async_next_batch(size_t max_frames, CompletionToken&& token) {
+		  initiate_next<true> init = { this, max_frames };
+		  return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, std::vector< boost::shared_ptr<Frame> >)>(init, token);
+	  }
+
+	  // complete a pending async_next* with boost::asio::error::operation_aborted
+	  void cancel();
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+	  // coroutine flavours: co_await sub->next(), co_await sub->next_batch(64)
+	  boost::asio::awaitable< boost::shared_ptr<Frame> > next() {
+		  co_return co_await async_next(boost::asio::use_awaitable);
+	  }
+	  boost::asio::awaitable< std::vector< boost::shared_ptr<Frame> > > next_batch(size_t max_frames) {
+		  co_return co_await async_next_batch(max_frames, boost::asio::use_awaitable);
+	  }
+#endif
+  };
+
+} // namespace STOMP
+
+#endif
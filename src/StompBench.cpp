@@ -0,0 +1,462 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//
+// StompBench.cpp: throughput / latency load generator for BoostStomp
+//
+// Producer threads publish timestamped frames through a set of shared
+// publishing connections, consumers each hold their own connection and
+// subscription. Results are printed on stdout as a single JSON object
+// so that runs can be compared across releases.
+//
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "BoostStomp.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+// monotonic clock in nanoseconds (producers and consumers share this process)
+static inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec);
+}
+
+// -------------------------------
+// benchmark configuration
+// -------------------------------
+struct BenchConfig {
+	string 			host;
+	int 			port;
+	string 			uri;		// transport URI, overrides host/port
+	string 			topic;
+	int 			producers;
+	int 			consumers;
+	int 			connections;
+	long 			count;		// messages per producer
+	vector<size_t> 	sizes;		// message body sizes, used round-robin
+	AckMode 		ackmode;
+	string 			ackmode_name;
+	int 			tx_batch;	// 0: no transactions
+	int 			batch;		// frames per send_batch() call, 0: send() each
+	double 			rate;		// total target msgs/s, 0: unlimited
+	double 			pace;		// client side pacing per connection in msgs/s, 0: none
+	bool 			dedup;		// duplicate filter on the consumers
+	double 			trace;		// share of messages traced end to end, 0: none
+	int 			reactor;	// IO threads of a shared StompReactor, 0: a thread per connection
+	int 			drain_timeout;
+	TransportOptions sockopts;
+	ThreadOptions 	threading;	// IO threads of every connection
+	CpuSet 			producer_cpus;
+};
+
+static BenchConfig 					cfg;
+static boost::atomic<uint64_t> 		rcvd_msgs(0), rcvd_bytes(0), sent_msgs(0), sent_bytes(0);
+static boost::mutex 				hist_mutex;
+static LatencyHistogram 			latency;
+
+// -------------------------------------------------------
+// consumer callback: the body starts with the producer's send timestamp
+// -------------------------------------------------------
+bool bench_callback(Frame* _frame) {
+	uint64_t t1 = now_ns();
+	vector<char>& v = _frame->body().v;
+	if (v.size() >= sizeof(uint64_t)) {
+		uint64_t t0;
+		memcpy(&t0, v.data(), sizeof(t0));
+		boost::mutex::scoped_lock lock(hist_mutex);
+		latency.record(t1 - t0);
+	}
+	rcvd_bytes += v.size();
+	rcvd_msgs++;
+	return(true);
+}
+
+// -------------------------------------------------------
+// producer thread: open-loop pacing against an absolute schedule
+// -------------------------------------------------------
+void producer(BoostStomp* client, int id) {
+	if (!cfg.producer_cpus.empty()) pin_current_thread(cfg.producer_cpus);
+	double 		interval_ns = (cfg.rate > 0) ? (1e9 * cfg.producers / cfg.rate) : 0;
+	uint64_t 	start = now_ns();
+	int 		txid = 0;
+	hdrmap 		headers;
+	headers["producer"] = lexical_cast<string>(id);
+	for (long i = 0; i < cfg.count; i++) {
+		if (interval_ns > 0) {
+			uint64_t due = start + uint64_t(i * interval_ns), t = now_ns();
+			if (due > t) usleep((due - t) / 1000);
+		}
+		if (cfg.batch > 0) {
+			// stamp and queue a whole batch, one wakeup of the IO thread
+			PublishBatch batch;
+			long n = std::min(long(cfg.batch), cfg.count - i);
+			batch.reserve(n);
+			uint64_t bytes = 0, t0 = now_ns();
+			for (long j = 0; j < n; j++) {
+				binbody body;
+				body.v.resize(std::max(cfg.sizes[(i + j) % cfg.sizes.size()], sizeof(uint64_t)), 'x');
+				memcpy(body.v.data(), &t0, sizeof(t0));
+				bytes += body.v.size();
+				batch.add(cfg.topic, headers, body);
+			}
+			client->send_batch(batch, cfg.tx_batch > 0);
+			sent_msgs += n;
+			sent_bytes += bytes;
+			i += n - 1;
+			continue;
+		}
+		if (cfg.tx_batch > 0 && (i % cfg.tx_batch) == 0) {
+			txid = client->begin();
+			headers["transaction"] = lexical_cast<string>(txid);
+		}
+		binbody body;
+		body.v.resize(std::max(cfg.sizes[i % cfg.sizes.size()], sizeof(uint64_t)), 'x');
+		uint64_t t0 = now_ns();
+		memcpy(body.v.data(), &t0, sizeof(t0));
+		client->send(cfg.topic, headers, body);
+		sent_msgs++;
+		sent_bytes += body.v.size();
+		if (cfg.tx_batch > 0 && ((i + 1) % cfg.tx_batch == 0 || i + 1 == cfg.count)) {
+			client->commit(txid);
+			headers.erase("transaction");
+		}
+	}
+}
+
+static string broker_uri() {
+	if (!cfg.uri.empty()) return cfg.uri;
+	std::ostringstream os;
+	os << "tcp://" << cfg.host << ":" << cfg.port;
+	return os.str();
+}
+
+static void wait_connected(BoostStomp* client) {
+	for (int i = 0; (i < 1000) && !client->is_connected(); i++) usleep(10000);
+	if (!client->is_connected()) {
+		cerr << "stompbench: could not connect to " << broker_uri() << endl;
+		exit(2);
+	}
+}
+
+static void usage() {
+	cerr << "usage: stompbench [options]" << endl
+		 << "  -H, --host HOST          broker host (localhost)" << endl
+		 << "  -p, --port PORT          broker port (61613)" << endl
+		 << "  -u, --uri URI            broker transport URI, tcp://host:port or unix:///path" << endl
+		 << "  -t, --topic DEST         destination (/topic/stompbench)" << endl
+		 << "  -P, --producers N        producer threads (1)" << endl
+		 << "  -C, --consumers N        consumer connections (1)" << endl
+		 << "  -c, --connections N      publishing connections shared by producers (1)" << endl
+		 << "  -n, --count N            messages per producer (10000)" << endl
+		 << "  -s, --size N[,N...]      body sizes in bytes, used round-robin (128)" << endl
+		 << "  -a, --ack MODE           auto|client|client-individual (auto)" << endl
+		 << "  -x, --tx-batch N         wrap every N sends in BEGIN/COMMIT (0)" << endl
+		 << "  -b, --batch N            publish with send_batch(), N frames at a time (0)" << endl
+		 << "                           with -x, every batch is a transaction" << endl
+		 << "  -r, --rate N             total target rate in msgs/s, 0=unlimited (0)" << endl
+		 << "  -R, --pace N             client side pacing per connection in msgs/s (0)" << endl
+		 << "  -D, --dedup              drop redelivered duplicates on the consumers" << endl
+		 << "  -d, --drain-timeout S    seconds to wait for consumers to drain (10)" << endl
+		 << "  -N, --nagle MODE         on|off|adaptive, TCP_NODELAY / TCP_CORK policy (off)" << endl
+		 << "      --sndbuf N           SO_SNDBUF in bytes, 0=system default (0)" << endl
+		 << "      --rcvbuf N           SO_RCVBUF in bytes, 0=system default (0)" << endl
+		 << "      --quickack           re-arm TCP_QUICKACK after every read" << endl
+		 << "      --io-cpus LIST       pin the client IO threads, eg. 2-3,6 (unpinned)" << endl
+		 << "      --producer-cpus LIST pin the producer threads (unpinned)" << endl
+		 << "      --spin US            IO threads spin US microseconds before sleeping (0=block)" << endl
+		 << "      --numa-local         allocate the client buffers from the pinned IO threads" << endl
+		 << "      --trace RATE         trace this share of the messages through the client lanes," << endl
+		 << "                           the broker and the dispatch, eg. 0.01 (0)" << endl
+		 << "      --reactor N          host every connection on a reactor of N IO threads," << endl
+		 << "                           placed with --io-cpus and --spin (0=a thread each)" << endl;
+	exit(1);
+}
+
+static void parse_args(int argc, char *argv[]) {
+	cfg.host = "localhost"; 	cfg.port = 61613;
+	cfg.topic = "/topic/stompbench";
+	cfg.producers = 1;			cfg.consumers = 1;			cfg.connections = 1;
+	cfg.count = 10000;
+	cfg.ackmode = ACK_AUTO;		cfg.ackmode_name = "auto";
+	cfg.tx_batch = 0;			cfg.batch = 0;			cfg.rate = 0;				cfg.pace = 0;				cfg.dedup = false;				cfg.drain_timeout = 10;
+	cfg.trace = 0;
+	cfg.reactor = 0;
+	cfg.sockopts.nagle = TransportOptions::NAGLE_OFF;
+	string sizes = "128";
+	static struct option longopts[] = {
+		{"host", required_argument, 0, 'H'}, 		{"port", required_argument, 0, 'p'},
+		{"uri", required_argument, 0, 'u'},
+		{"topic", required_argument, 0, 't'}, 		{"producers", required_argument, 0, 'P'},
+		{"consumers", required_argument, 0, 'C'}, 	{"connections", required_argument, 0, 'c'},
+		{"count", required_argument, 0, 'n'}, 		{"size", required_argument, 0, 's'},
+		{"ack", required_argument, 0, 'a'}, 		{"tx-batch", required_argument, 0, 'x'},
+		{"batch", required_argument, 0, 'b'},
+		{"rate", required_argument, 0, 'r'}, 		{"drain-timeout", required_argument, 0, 'd'},
+		{"pace", required_argument, 0, 'R'}, 		{"dedup", no_argument, 0, 'D'},
+		{"nagle", required_argument, 0, 'N'}, 		{"sndbuf", required_argument, 0, 1},
+		{"rcvbuf", required_argument, 0, 2}, 		{"quickack", no_argument, 0, 3},
+		{"io-cpus", required_argument, 0, 4}, 		{"producer-cpus", required_argument, 0, 5},
+		{"spin", required_argument, 0, 6}, 			{"numa-local", no_argument, 0, 7},
+		{"trace", required_argument, 0, 8}, 		{"reactor", required_argument, 0, 9},
+		{"help", no_argument, 0, 'h'},				{0, 0, 0, 0}
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "H:p:u:t:P:C:c:n:s:a:x:b:r:R:Dd:N:h", longopts, NULL)) != -1) {
+		switch (c) {
+		case 'H': cfg.host = optarg; break;
+		case 'p': cfg.port = atoi(optarg); break;
+		case 'u': cfg.uri = optarg; break;
+		case 't': cfg.topic = optarg; break;
+		case 'P': cfg.producers = atoi(optarg); break;
+		case 'C': cfg.consumers = atoi(optarg); break;
+		case 'c': cfg.connections = atoi(optarg); break;
+		case 'n': cfg.count = atol(optarg); break;
+		case 's': sizes = optarg; break;
+		case 'a':
+			cfg.ackmode_name = optarg;
+			if 		(cfg.ackmode_name == "auto") 				cfg.ackmode = ACK_AUTO;
+			else if (cfg.ackmode_name == "client") 				cfg.ackmode = ACK_CLIENT;
+			else if (cfg.ackmode_name == "client-individual") 	cfg.ackmode = ACK_CLIENT_INDIVIDUAL;
+			else usage();
+			break;
+		case 'x': cfg.tx_batch = atoi(optarg); break;
+		case 'b': cfg.batch = atoi(optarg); break;
+		case 'r': cfg.rate = atof(optarg); break;
+		case 'R': cfg.pace = atof(optarg); break;
+		case 'D': cfg.dedup = true; break;
+		case 'd': cfg.drain_timeout = atoi(optarg); break;
+		case 'N':
+			if 		(string(optarg) == "on") 		cfg.sockopts.nagle = TransportOptions::NAGLE_ON;
+			else if (string(optarg) == "off") 		cfg.sockopts.nagle = TransportOptions::NAGLE_OFF;
+			else if (string(optarg) == "adaptive") 	cfg.sockopts.nagle = TransportOptions::NAGLE_ADAPTIVE;
+			else usage();
+			break;
+		case 1: cfg.sockopts.send_buffer = atoi(optarg); break;
+		case 2: cfg.sockopts.receive_buffer = atoi(optarg); break;
+		case 3: cfg.sockopts.quick_ack = true; break;
+		case 4:
+		case 5:
+			try {
+				(c == 4 ? cfg.threading.io_cpus : cfg.producer_cpus) = parse_cpu_set(optarg);
+			} catch (std::invalid_argument& e) {
+				cerr << "stompbench: " << e.what() << endl;
+				usage();
+			}
+			break;
+		case 6:
+			cfg.threading.spin_us = atoi(optarg);
+			cfg.threading.wait = (cfg.threading.spin_us > 0) ? ThreadOptions::WAIT_SPIN_THEN_BLOCK : ThreadOptions::WAIT_BLOCK;
+			break;
+		case 7: cfg.threading.numa_local_buffers = true; break;
+		case 8: cfg.trace = atof(optarg); break;
+		case 9: cfg.reactor = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	std::stringstream ss(sizes);
+	string tok;
+	while (getline(ss, tok, ',')) cfg.sizes.push_back(strtoul(tok.c_str(), NULL, 10));
+	if (cfg.sizes.empty() || cfg.producers < 1 || cfg.connections < 1 || cfg.consumers < 0 || cfg.reactor < 0) usage();
+	try {
+		Transport::from_uri(broker_uri());
+	} catch (std::invalid_argument& e) {
+		cerr << "stompbench: " << e.what() << endl;
+		usage();
+	}
+}
+
+// a JSON string literal: the URI and the topic come from the command line
+static string json_string(const string& s) {
+	string out = "\"";
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if ((c == '"') || (c == '\\')) {
+			out += '\\';
+			out += c;
+		} else if (c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out += esc;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+// a histogram of microseconds as a JSON object
+static void print_histogram(const LatencyHistogram& h) {
+	cout << "{\"samples\": " << h.count() << ", \"p50\": " << h.percentile(50)
+		 << ", \"p99\": " << h.percentile(99) << ", \"max\": " << h.max() << "}";
+}
+
+// -----------------------------------------
+int main(int argc, char *argv[]) {
+// -----------------------------------------
+	parse_args(argc, argv);
+
+	boost::scoped_ptr<StompReactor> reactor(cfg.reactor ? new StompReactor(cfg.reactor, cfg.threading) : NULL);
+	vector<BoostStomp*> publishers, subscribers;
+	for (int i = 0; i < cfg.connections; i++) {
+		publishers.push_back(reactor ? new BoostStomp(*reactor, broker_uri(), ACK_AUTO, cfg.sockopts)
+				: new BoostStomp(broker_uri(), ACK_AUTO, cfg.sockopts));
+		if (cfg.pace > 0) publishers.back()->set_rate_limit(RateLimit(cfg.pace));
+		publishers.back()->set_thread_options(cfg.threading);
+		if (cfg.trace > 0) {
+			TraceOptions trace;
+			trace.sample_rate = cfg.trace;
+			publishers.back()->enable_tracing(trace);
+		}
+		publishers.back()->start();
+	}
+	for (int i = 0; i < cfg.consumers; i++) {
+		subscribers.push_back(reactor ? new BoostStomp(*reactor, broker_uri(), cfg.ackmode, cfg.sockopts)
+				: new BoostStomp(broker_uri(), cfg.ackmode, cfg.sockopts));
+		subscribers.back()->set_thread_options(cfg.threading);
+		if (cfg.trace > 0) subscribers.back()->enable_tracing();
+		subscribers.back()->start();
+	}
+	for (size_t i = 0; i < publishers.size(); i++) wait_connected(publishers[i]);
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		wait_connected(subscribers[i]);
+		if (cfg.dedup) subscribers[i]->enable_dedup(cfg.topic);
+		subscribers[i]->subscribe(cfg.topic, &bench_callback);
+	}
+	// give the broker a moment to register the subscriptions
+	usleep(200000);
+
+	uint64_t t_start = now_ns();
+	boost::thread_group producers;
+	for (int i = 0; i < cfg.producers; i++)
+		producers.create_thread(boost::bind(&producer, publishers[i % publishers.size()], i));
+	producers.join_all();
+	uint64_t t_sent = now_ns();
+
+	// queues deliver to one consumer, topics fan out to all of them
+	uint64_t expected = sent_msgs;
+	if (cfg.topic.compare(0, 7, "/queue/") != 0) expected *= cfg.consumers;
+	uint64_t deadline = t_sent + uint64_t(cfg.drain_timeout) * 1000000000ULL;
+	while ((rcvd_msgs < expected) && (now_ns() < deadline)) usleep(1000);
+	uint64_t t_end = now_ns();
+
+	// socket level counters, summed over the publishing connections
+	ClientStats sockstats = publishers[0]->stats();
+	for (size_t i = 1; i < publishers.size(); i++) {
+		ClientStats st = publishers[i]->stats();
+		sockstats.write_batches += st.write_batches;
+		sockstats.corked_batches += st.corked_batches;
+		sockstats.paced_waits += st.paced_waits;
+		sockstats.io_sleeps += st.io_sleeps;
+		sockstats.write_wakeups += st.write_wakeups;
+	}
+	if (reactor) sockstats.io_sleeps = reactor->io_sleeps();
+
+	// traced messages of the benchmark topic, over all connections
+	DestinationLatency traced;
+	for (size_t i = 0; i < publishers.size() + subscribers.size(); i++) {
+		BoostStomp* client = (i < publishers.size()) ? publishers[i] : subscribers[i - publishers.size()];
+		LatencyReport report = client->latency_report();
+		LatencyReport::const_iterator it = report.find(cfg.topic);
+		if (it == report.end()) continue;
+		traced.queued.merge(it->second.queued);
+		traced.transit.merge(it->second.transit);
+		traced.dispatch.merge(it->second.dispatch);
+	}
+
+	uint64_t dup_lookups = 0, dup_hits = 0;
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		ClientStats st = subscribers[i]->stats();
+		dup_lookups += st.dedup_lookups;
+		dup_hits += st.dedup_hits;
+	}
+
+	double send_s = (t_sent - t_start) / 1e9, recv_s = (t_end - t_start) / 1e9;
+	boost::mutex::scoped_lock lock(hist_mutex);
+	cout.setf(ios::fixed);
+	cout.precision(3);
+	cout << "{" << endl
+		 << "  \"config\": {\"uri\": " << json_string(broker_uri())
+		 << ", \"topic\": " << json_string(cfg.topic) << ", \"producers\": " << cfg.producers
+		 << ", \"consumers\": " << cfg.consumers << ", \"connections\": " << cfg.connections
+		 << ", \"count\": " << cfg.count << ", \"sizes\": [";
+	for (size_t i = 0; i < cfg.sizes.size(); i++) cout << (i ? ", " : "") << cfg.sizes[i];
+	cout << "], \"ack\": \"" << cfg.ackmode_name << "\", \"tx_batch\": " << cfg.tx_batch << ", \"batch\": " << cfg.batch
+		 << ", \"rate\": " << cfg.rate << ", \"pace\": " << cfg.pace
+		 << ", \"io_cpus\": \"" << format_cpu_set(cfg.threading.io_cpus) << "\""
+		 << ", \"wait\": \"" << ThreadOptions::wait_name(cfg.threading.wait) << "\""
+		 << ", \"reactor\": " << cfg.reactor << "}," << endl
+		 << "  \"socket\": {\"mode\": \"" << TransportOptions::nagle_name(sockstats.nagle_mode) << "\""
+		 << ", \"write_batches\": " << sockstats.write_batches
+		 << ", \"corked_batches\": " << sockstats.corked_batches
+		 << ", \"paced_waits\": " << sockstats.paced_waits
+		 << ", \"io_sleeps\": " << sockstats.io_sleeps
+		 << ", \"write_wakeups\": " << sockstats.write_wakeups << "}," << endl
+		 << "  \"sent\": {\"msgs\": " << sent_msgs << ", \"bytes\": " << sent_bytes
+		 << ", \"seconds\": " << send_s
+		 << ", \"msgs_per_s\": " << (send_s > 0 ? sent_msgs / send_s : 0)
+		 << ", \"mb_per_s\": " << (send_s > 0 ? sent_bytes / send_s / 1e6 : 0) << "}," << endl
+		 << "  \"received\": {\"msgs\": " << rcvd_msgs << ", \"expected\": " << expected
+		 << ", \"bytes\": " << rcvd_bytes << ", \"seconds\": " << recv_s
+		 << ", \"msgs_per_s\": " << (recv_s > 0 ? rcvd_msgs / recv_s : 0)
+		 << ", \"mb_per_s\": " << (recv_s > 0 ? rcvd_bytes / recv_s / 1e6 : 0)
+		 << ", \"dedup_lookups\": " << dup_lookups << ", \"dedup_hits\": " << dup_hits << "}," << endl
+		 << "  \"latency_us\": {\"samples\": " << latency.count()
+		 << ", \"p50\": " << latency.percentile(50) / 1e3
+		 << ", \"p99\": " << latency.percentile(99) / 1e3
+		 << ", \"p99.9\": " << latency.percentile(99.9) / 1e3
+		 << ", \"max\": " << latency.max() / 1e3 << "}";
+	if (cfg.trace > 0) {
+		cout << "," << endl << "  \"trace_us\": {\"queued\": ";
+		print_histogram(traced.queued);
+		cout << ", \"transit\": ";
+		print_histogram(traced.transit);
+		cout << ", \"dispatch\": ";
+		print_histogram(traced.dispatch);
+		cout << "}";
+	}
+	cout << endl << "}" << endl;
+	lock.unlock();
+
+	for (size_t i = 0; i < publishers.size(); i++) { publishers[i]->stop(); delete publishers[i]; }
+	for (size_t i = 0; i < subscribers.size(); i++) { subscribers[i]->stop(); delete subscribers[i]; }
+	return (rcvd_msgs < expected) ? 3 : 0;
+}
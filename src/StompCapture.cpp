@@ -0,0 +1,244 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/system/system_error.hpp>
+
+#include "StompCapture.hpp"
+
+namespace STOMP {
+
+  const size_t CaptureWriter::DEFAULT_CAPACITY;
+  const uint32_t CaptureWriter::VERSION;
+
+  static const char CAPTURE_MAGIC[8] = { 'S', 'T', 'O', 'M', 'P', 'C', 'A', 'P' };
+  static const size_t RECORD_SIZE = sizeof(CaptureRecord);
+  static const size_t MIN_CAPACITY = 64 * 1024;
+
+  static inline size_t padded(size_t len) {
+	  return (len + 7) & ~size_t(7);
+  }
+
+  static inline uint64_t clock_ns(clockid_t clock) {
+	  struct timespec ts;
+	  clock_gettime(clock, &ts);
+	  return (uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec);
+  }
+
+  static void throw_errno(const char* what) {
+	  throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), what);
+  }
+
+  // ------------------------------------------
+  CaptureWriter::CaptureWriter(const std::string& path, size_t capacity):
+  // ------------------------------------------
+	  m_path(path),
+	  m_fd(-1),
+	  m_map(NULL)
+  {
+	  capacity = padded(std::max(capacity, MIN_CAPACITY));
+	  m_map_size = padded(sizeof(CaptureFileHeader)) + capacity;
+	  m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	  if (m_fd < 0) throw_errno("capture: open");
+	  void* map = MAP_FAILED;
+	  if (::ftruncate(m_fd, m_map_size) == 0)
+		  // populate right away, so that recording never waits for a page fault
+		  map = ::mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, 0);
+	  if (map == MAP_FAILED) {
+		  int err = errno;
+		  ::close(m_fd);
+		  errno = err;
+		  throw_errno("capture: mmap");
+	  }
+	  m_map = (char*) map;
+	  m_header = (CaptureFileHeader*) m_map;
+	  m_ring = m_map + padded(sizeof(CaptureFileHeader));
+	  // a quarter of the ring per record keeps plenty of history around big writes
+	  m_max_record = (capacity / 4) - RECORD_SIZE;
+
+	  memcpy(m_header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+	  m_header->version = VERSION;
+	  m_header->header_size = padded(sizeof(CaptureFileHeader));
+	  m_header->capacity = capacity;
+	  m_header->head = m_header->tail = 0;
+	  m_header->records = 0;
+	  m_header->realtime_ns = clock_ns(CLOCK_REALTIME);
+	  m_header->monotonic_ns = clock_ns(CLOCK_MONOTONIC);
+  }
+
+  // ------------------------------------------
+  CaptureWriter::~CaptureWriter()
+  // ------------------------------------------
+  {
+	  ::munmap(m_map, m_map_size);
+	  ::close(m_fd);
+  }
+
+  // ------------------------------------------
+  void CaptureWriter::record(CaptureRecordType type, const void* data, size_t len)
+  // ------------------------------------------
+  {
+	  const char* p = (const char*) data;
+	  do {
+		  size_t n = std::min(len, m_max_record);
+		  append(type, p, n);
+		  p += n;
+		  len -= n;
+	  } while (len > 0);
+  }
+
+  // ------------------------------------------
+  void CaptureWriter::append(CaptureRecordType type, const char* data, size_t len)
+  // ------------------------------------------
+  {
+	  const uint64_t capacity = m_header->capacity;
+	  uint64_t head = m_header->head, tail = m_header->tail;
+	  size_t pos = head % capacity, need = RECORD_SIZE + padded(len);
+	  for (int pass = 0; pass < 2; pass++) {
+		  // a record must fit before the end of the ring, or we start over at 0
+		  size_t take = (pos + need <= capacity) ? need : (capacity - pos);
+		  // overwrite the oldest records until there is room
+		  while (head + take > tail + capacity) {
+			  size_t tpos = tail % capacity;
+			  const CaptureRecord* old = (const CaptureRecord*) (m_ring + tpos);
+			  if ((capacity - tpos < RECORD_SIZE) || (old->type == CAPTURE_PAD))
+				  tail += capacity - tpos;
+			  else
+				  tail += RECORD_SIZE + padded(old->length);
+		  }
+		  __atomic_store_n(&m_header->tail, tail, __ATOMIC_RELEASE);
+		  if (take == need) break;
+		  if (take >= RECORD_SIZE) {
+			  CaptureRecord* pad = (CaptureRecord*) (m_ring + pos);
+			  pad->timestamp_ns = 0;
+			  pad->length = take - RECORD_SIZE;
+			  pad->type = CAPTURE_PAD;
+			  pad->reserved = 0;
+		  }
+		  head += take;
+		  pos = 0;
+	  }
+	  CaptureRecord* rec = (CaptureRecord*) (m_ring + pos);
+	  rec->timestamp_ns = clock_ns(CLOCK_MONOTONIC);
+	  rec->length = len;
+	  rec->type = type;
+	  rec->reserved = 0;
+	  if (len > 0) memcpy(rec + 1, data, len);
+	  m_header->records++;
+	  // readers of a live capture only look up to head
+	  __atomic_store_n(&m_header->head, head + need, __ATOMIC_RELEASE);
+  }
+
+  // ------------------------------------------
+  void CaptureWriter::sync()
+  // ------------------------------------------
+  {
+	  ::msync(m_map, m_map_size, MS_SYNC);
+  }
+
+  // ------------------------------------------
+  CaptureReader::CaptureReader(const std::string& path):
+  // ------------------------------------------
+	  m_fd(-1),
+	  m_map(NULL),
+	  m_map_size(0)
+  {
+	  m_fd = ::open(path.c_str(), O_RDONLY);
+	  if (m_fd < 0) throw_errno("capture: open");
+	  struct stat st;
+	  if (::fstat(m_fd, &st) != 0) {
+		  ::close(m_fd);
+		  throw_errno("capture: stat");
+	  }
+	  m_map_size = st.st_size;
+	  void* map = (m_map_size >= sizeof(CaptureFileHeader)) ?
+			  ::mmap(NULL, m_map_size, PROT_READ, MAP_SHARED, m_fd, 0) : MAP_FAILED;
+	  if (map == MAP_FAILED) {
+		  ::close(m_fd);
+		  throw std::runtime_error("capture: " + path + " is not a capture file");
+	  }
+	  m_map = (const char*) map;
+	  m_header = (const CaptureFileHeader*) m_map;
+	  const char* problem = NULL;
+	  if (memcmp(m_header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) problem = "is not a capture file";
+	  else if (m_header->version != CaptureWriter::VERSION) problem = "has an unsupported version";
+	  else if ((m_header->capacity == 0) || (m_header->header_size + m_header->capacity > m_map_size)) problem = "is truncated";
+	  if (problem) {
+		  ::munmap((void*) m_map, m_map_size);
+		  ::close(m_fd);
+		  throw std::runtime_error("capture: " + path + " " + problem);
+	  }
+	  m_ring = m_map + m_header->header_size;
+	  rewind();
+  }
+
+  // ------------------------------------------
+  CaptureReader::~CaptureReader()
+  // ------------------------------------------
+  {
+	  ::munmap((void*) m_map, m_map_size);
+	  ::close(m_fd);
+  }
+
+  // ------------------------------------------
+  void CaptureReader::rewind()
+  // ------------------------------------------
+  {
+	  m_head = __atomic_load_n(&m_header->head, __ATOMIC_ACQUIRE);
+	  m_pos = __atomic_load_n(&m_header->tail, __ATOMIC_ACQUIRE);
+  }
+
+  // ------------------------------------------
+  bool CaptureReader::next(Record& record)
+  // ------------------------------------------
+  {
+	  const uint64_t capacity = m_header->capacity;
+	  while (m_pos < m_head) {
+		  size_t pos = m_pos % capacity;
+		  const CaptureRecord* rec = (const CaptureRecord*) (m_ring + pos);
+		  if ((capacity - pos < RECORD_SIZE) || (rec->type == CAPTURE_PAD)) {
+			  m_pos += capacity - pos;
+			  continue;
+		  }
+		  if ((rec->type > CAPTURE_OPEN) || (RECORD_SIZE + rec->length > capacity - pos))
+			  throw std::runtime_error("capture: corrupt record");
+		  record.timestamp_ns = rec->timestamp_ns;
+		  record.type = CaptureRecordType(rec->type);
+		  record.data = (const char*) (rec + 1);
+		  record.length = rec->length;
+		  m_pos += RECORD_SIZE + padded(rec->length);
+		  return true;
+	  }
+	  return false;
+  }
+
+} // namespace STOMP
@@ -0,0 +1,152 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompCapture.hpp
+//
+// Wire capture: the raw bytes a client reads from and writes to its broker
+// (after TLS decryption), timestamped, in a memory-mapped ring file. Taking
+// a record is a clock read and a memcpy into the mapping, the kernel writes
+// the pages back on its own. When the ring is full the oldest records are
+// overwritten, so a capture can stay on in production and holds the last
+// N megabytes of traffic when something odd happens.
+//
+// The file is a CaptureFileHeader followed by the ring. Every record is a
+// CaptureRecord header plus its payload, padded to 8 bytes; records never
+// wrap around the end of the ring (a PAD record fills the gap instead).
+// src/stompreplay feeds a capture back through the client.
+//
+
+#ifndef __StompCapture_H_
+#define __StompCapture_H_
+
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+#include <boost/asio/buffer.hpp>
+
+namespace STOMP {
+
+  typedef enum {
+	  CAPTURE_IN = 0, 	// bytes read from the broker
+	  CAPTURE_OUT, 		// bytes written to the broker
+	  CAPTURE_OPEN, 	// a new connection starts here (no payload)
+	  CAPTURE_PAD 		// filler up to the end of the ring
+  } CaptureRecordType;
+
+  // on-disk layout, host byte order
+  struct CaptureFileHeader {
+	  char 		magic[8]; 		// "STOMPCAP"
+	  uint32_t 	version;
+	  uint32_t 	header_size; 	// file offset of the ring
+	  uint64_t 	capacity; 		// ring size in bytes
+	  uint64_t 	head; 			// bytes ever written to the ring: the next record goes at head % capacity
+	  uint64_t 	tail; 			// the oldest record still in the ring, on the same scale
+	  uint64_t 	records; 		// ever written, PAD records excluded
+	  uint64_t 	realtime_ns; 	// wall clock when the capture started...
+	  uint64_t 	monotonic_ns; 	// ...and the record clock at that moment
+  };
+
+  struct CaptureRecord {
+	  uint64_t 	timestamp_ns; 	// CLOCK_MONOTONIC
+	  uint32_t 	length; 		// payload bytes
+	  uint16_t 	type; 			// CaptureRecordType
+	  uint16_t 	reserved;
+  };
+
+  // ----------------------------------------
+  // Appends records to a capture file, created (or truncated) with room for
+  // capacity bytes of records. Not thread-safe: the client only records
+  // from its IO thread.
+  // ----------------------------------------
+  class CaptureWriter {
+	  std::string 			m_path;
+	  int 					m_fd;
+	  char* 				m_map;
+	  size_t 				m_map_size;
+	  CaptureFileHeader* 	m_header;
+	  char* 				m_ring;
+	  size_t 				m_max_record; 	// longer payloads are split
+
+	  void append(CaptureRecordType type, const char* data, size_t len);
+  public:
+	  static const size_t DEFAULT_CAPACITY = 64 << 20;
+	  static const uint32_t VERSION = 1;
+
+	  // throws boost::system::system_error when the file cannot be set up
+	  CaptureWriter(const std::string& path, size_t capacity = DEFAULT_CAPACITY);
+	  ~CaptureWriter();
+
+	  void record(CaptureRecordType type, const void* data, size_t len);
+	  // the first n bytes of a buffer sequence, eg. what a read_some returned
+	  template <typename BufferSequence>
+	  void record_buffers(CaptureRecordType type, const BufferSequence& buffers, size_t n) {
+		  auto end = boost::asio::buffer_sequence_end(buffers);
+		  for (auto it = boost::asio::buffer_sequence_begin(buffers); (n > 0) && (it != end); ++it) {
+			  boost::asio::const_buffer b(*it);
+			  size_t len = std::min(b.size(), n);
+			  record(type, b.data(), len);
+			  n -= len;
+		  }
+	  }
+	  // flush the mapping to disk (it is also written back on its own)
+	  void sync();
+
+	  const std::string& path() const { return m_path; };
+	  uint64_t 	records() const { return m_header->records; };
+  };
+
+  // ----------------------------------------
+  // Reads the records of a capture file, oldest first. Opening a capture
+  // that is still being written gives whatever was complete at the time.
+  // ----------------------------------------
+  class CaptureReader {
+	  int 					m_fd;
+	  const char* 			m_map;
+	  size_t 				m_map_size;
+	  const CaptureFileHeader* m_header;
+	  const char* 			m_ring;
+	  uint64_t 				m_pos, m_head;
+  public:
+	  struct Record {
+		  uint64_t 			timestamp_ns;
+		  CaptureRecordType type;
+		  const char* 		data; 	// points into the mapping
+		  size_t 			length;
+	  };
+
+	  // throws std::runtime_error (boost::system::system_error for I/O errors)
+	  CaptureReader(const std::string& path);
+	  ~CaptureReader();
+
+	  // the next record, false at the end of the capture
+	  bool next(Record& record);
+	  void rewind();
+
+	  const CaptureFileHeader& header() const { return *m_header; };
+  };
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "StompCodec.hpp"
+
+namespace STOMP {
+
+  const char* const stomp_accept_versions = "1.0,1.1,1.2";
+
+  static const Stomp10Codec codec_1_0;
+  static const Stomp11Codec codec_1_1;
+  static const Stomp12Codec codec_1_2;
+
+  const FrameCodec& default_codec() {
+	  return codec_1_1;
+  }
+
+  const FrameCodec& FrameCodec::for_version(ProtocolVersion v) {
+	  switch (v) {
+	  case STOMP_1_2: return codec_1_2;
+	  case STOMP_1_1: return codec_1_1;
+	  default: 		return codec_1_0;
+	  }
+  }
+
+  const FrameCodec& FrameCodec::for_version(const string& v) {
+	  if (v == "1.2") return codec_1_2;
+	  if (v == "1.1") return codec_1_1;
+	  return codec_1_0;
+  }
+
+  template <class Policy>
+  const char* BasicFrameCodec<Policy>::version_string() const {
+	  static const char* names[] = { "1.0", "1.1", "1.2" };
+	  return names[Policy::version];
+  }
+
+  /*
+   * Escaping is needed to allow header keys and values to contain those frame header
+   * delimiting octets as values. The CONNECT and CONNECTED frames do not escape the
+   * colon or newline octets in order to remain backward compatible with STOMP 1.0.
+   * C style string literal escapes are used to encode any colons and newlines that
+   * are found within the UTF-8 encoded headers. When decoding frame headers, the
+   * following transformations MUST be applied:
+   *
+   * \r (octet 92 and 114) translates to carriage return (octet 13) (STOMP 1.2 only)
+   * \n (octet 92 and 110) translates to newline (octet 10)
+   * \c (octet 92 and 99) translates to : (octet 58)
+   * \\ (octet 92 and 92) translates to \ (octet 92)
+   */
+  template <class Policy>
+  void BasicFrameCodec<Policy>::encode_token(boost::asio::streambuf& out, const char* s, size_t len) {
+	  const char *end = s + len, *run = s;
+	  if (Policy::escape_headers) {
+		  for (const char* p = s; p != end; p++) {
+			  const char* esc;
+			  switch (*p) {
+			  case '\\': 	esc = "\\\\"; break;
+			  case '\n': 	esc = "\\n"; break;
+			  case ':': 	esc = "\\c"; break;
+			  case '\r': 	esc = Policy::escape_cr ? "\\r" : NULL; break;
+			  default: 		esc = NULL;
+			  }
+			  if (esc) {
+				  out.sputn(run, p - run);
+				  out.sputn(esc, 2);
+				  run = p + 1;
+			  }
+		  }
+	  }
+	  out.sputn(run, end - run);
+  }
+
+  template <class Policy>
+  string BasicFrameCodec<Policy>::decode_token(const char* s, size_t len) {
+	  if (!Policy::escape_headers || memchr(s, '\\', len) == NULL)
+		  return string(s, len);
+	  string result;
+	  result.reserve(len);
+	  for (size_t i = 0; i < len; i++) {
+		  if (s[i] == '\\' && i + 1 < len) {
+			  switch (s[++i]) {
+			  case 'n': 	result += '\n'; continue;
+			  case 'c': 	result += ':'; continue;
+			  case '\\': 	result += '\\'; continue;
+			  case 'r': 	if (Policy::escape_cr) { result += '\r'; continue; } break;
+			  }
+			  // undefined escape sequence: keep it verbatim
+			  result += '\\';
+		  }
+		  result += s[i];
+	  }
+	  return result;
+  }
+
+  template <class Policy>
+  void BasicFrameCodec<Policy>::encode(const Frame& frame, boost::asio::streambuf& out) const {
+	  encode_head(frame, out);
+	  // step 3. Write the body
+	  boost::string_view body = frame.body_view();
+	  if (body.size() > 0) {
+		  out.sputn(body.data(), body.size());
+	  }
+	  // write terminating NULL char
+	  out.sputc('\0');
+  }
+
+  template <class Policy>
+  void BasicFrameCodec<Policy>::encode_head(const Frame& frame, boost::asio::streambuf& out) const {
+	  // step 1. write the command
+	  if (frame.m_cmd != CMD_UNKNOWN) {
+		  const string& line = stomp_command_lines[frame.m_cmd];
+		  out.sputn(line.data(), line.size());
+	  } else if (frame.m_command.length() > 0) {
+		  out.sputn(frame.m_command.data(), frame.m_command.size());
+		  out.sputc('\n');
+	  } else {
+		  throw("stomp_write: command not set!!");
+	  }
+	  // step 2. Write the headers (key-value pairs). CONNECT is never escaped.
+	  frame.decode_headers();
+	  bool raw = (frame.m_cmd == CMD_CONNECT) || (frame.m_cmd == CMD_STOMP);
+	  for (hdrmap::const_iterator it = frame.m_headers.begin(); it != frame.m_headers.end(); it++) {
+		  const string& key = it->first;
+		  const string& val = it->second;
+		  if (raw) {
+			  out.sputn(key.data(), key.size());
+			  out.sputc(':');
+			  out.sputn(val.data(), val.size());
+		  } else {
+			  encode_token(out, key.data(), key.size());
+			  out.sputc(':');
+			  encode_token(out, val.data(), val.size());
+		  }
+		  out.sputc('\n');
+	  }
+	  // special header: content-length
+	  size_t bodysize = frame.body_view().size();
+	  if (bodysize > 0) {
+		  char cl[40];
+		  int n = snprintf(cl, sizeof(cl), "content-length:%lu\n", (unsigned long) bodysize);
+		  out.sputn(cl, n);
+	  }
+	  // write newline signifying end of headers
+	  out.sputc('\n');
+  }
+
+  template <class Policy>
+  void BasicFrameCodec<Policy>::decode_headers(const char* block, size_t len, bool raw, hdrmap& headers) const {
+	  const char* end = block + len;
+	  for (const char* line = block; line < end; ) {
+		  const char* eol = (const char*) memchr(line, '\n', end - line);
+		  size_t n = (eol != NULL) ? (eol - line) : (end - line);
+		  const char* next = line + n + 1;
+		  if (Policy::crlf && n > 0 && line[n - 1] == '\r') n--;
+		  const char* colon = (const char*) memchr(line, ':', n);
+		  if (colon != NULL) {
+			  size_t klen = colon - line, vlen = n - klen - 1;
+			  // repeated headers: only the first occurrence counts
+			  if (raw) {
+				  headers.insert(make_pair(string(line, klen), string(colon + 1, vlen)));
+			  } else {
+				  headers.insert(make_pair(decode_token(line, klen), decode_token(colon + 1, vlen)));
+			  }
+		  }
+		  line = next;
+	  }
+  }
+
+  template <class Policy>
+  bool BasicFrameCodec<Policy>::find_header(const char* block, size_t len, bool raw, boost::string_view key,
+		  boost::string_view& value, bool& escaped) const {
+	  bool escapes = Policy::escape_headers && !raw;
+	  const char* end = block + len;
+	  for (const char* line = block; line < end; ) {
+		  const char* eol = (const char*) memchr(line, '\n', end - line);
+		  size_t n = (eol != NULL) ? (eol - line) : (end - line);
+		  const char* next = line + n + 1;
+		  if (Policy::crlf && n > 0 && line[n - 1] == '\r') n--;
+		  const char* colon = (const char*) memchr(line, ':', n);
+		  if (colon != NULL) {
+			  boost::string_view k(line, colon - line);
+			  // an escaped key is rare enough to be decoded for the comparison
+			  bool match = (escapes && (k.find('\\') != boost::string_view::npos)) ?
+					  (decode_token(k.data(), k.size()) == key) : (k == key);
+			  if (match) {
+				  value = boost::string_view(colon + 1, n - k.size() - 1);
+				  escaped = escapes && (value.find('\\') != boost::string_view::npos);
+				  return(true);
+			  }
+		  }
+		  line = next;
+	  }
+	  return(false);
+  }
+
+  template <class Policy>
+  void BasicFrameCodec<Policy>::index_headers(const char* block, size_t len, bool raw, HeaderIndex& index) const {
+	  bool escapes = Policy::escape_headers && !raw;
+	  index.clear();
+	  const char* end = block + len;
+	  for (const char* line = block; line < end; ) {
+		  const char* eol = (const char*) memchr(line, '\n', end - line);
+		  size_t n = (eol != NULL) ? (eol - line) : (end - line);
+		  const char* next = line + n + 1;
+		  if (Policy::crlf && n > 0 && line[n - 1] == '\r') n--;
+		  const char* colon = (const char*) memchr(line, ':', n);
+		  if (colon != NULL) {
+			  size_t klen = colon - line, vlen = n - klen - 1;
+			  header_atom atom = lookup_header(line, klen);
+			  if ((atom == HDR_UNKNOWN) && escapes && (memchr(line, '\\', klen) != NULL)) {
+				  string k = decode_token(line, klen);
+				  atom = lookup_header(k.data(), k.size());
+			  }
+			  if (atom != HDR_UNKNOWN)
+				  index.set(atom, colon + 1 - block, vlen, escapes && (memchr(colon + 1, '\\', vlen) != NULL));
+		  }
+		  line = next;
+	  }
+  }
+
+  template <class Policy>
+  void BasicFrameCodec<Policy>::ack_headers(const Frame& message, hdrmap& headers) const {
+	  boost::string_view value;
+	  if (message.find_header(Policy::ack_id_source(), value))
+		  headers[Policy::ack_id_header()].assign(value.data(), value.size());
+	  if (Policy::ack_subscription && message.find_header(HDR_SUBSCRIPTION, value))
+		  headers["subscription"].assign(value.data(), value.size());
+  }
+
+  template class BasicFrameCodec<Stomp10Policy>;
+  template class BasicFrameCodec<Stomp11Policy>;
+  template class BasicFrameCodec<Stomp12Policy>;
+
+} // namespace STOMP
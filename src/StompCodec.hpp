@@ -0,0 +1,150 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompCodec.hpp
+//
+// Protocol version specific frame codecs. Each STOMP version is described
+// by a policy struct (header escaping, line endings, ACK headers...) and
+// BasicFrameCodec<Policy> compiles the encoder and header parser for it.
+// The client picks the matching codec instance once, when the CONNECTED
+// frame tells it which version was negotiated.
+//
+
+#ifndef __StompCodec_H_
+#define __StompCodec_H_
+
+#include <string>
+#include <boost/asio.hpp>
+
+#include "StompFrame.hpp"
+
+namespace STOMP {
+
+  typedef enum {
+	  STOMP_1_0 = 0,
+	  STOMP_1_1,
+	  STOMP_1_2
+  } ProtocolVersion;
+
+  // the accept-version header sent in CONNECT
+  extern const char* const stomp_accept_versions;
+
+  // -------------------------------
+  // version policies
+  // -------------------------------
+  struct Stomp10Policy {
+	  static const ProtocolVersion version = STOMP_1_0;
+	  static const bool escape_headers = false; 	// no header escaping at all
+	  static const bool escape_cr = false;
+	  static const bool crlf = false; 				// frames use plain \n line endings
+	  static const bool heartbeat = false;
+	  static const bool nack = false;
+	  static const char* ack_id_header() 	{ return "message-id"; }; 	// ACK header naming the message
+	  static header_atom ack_id_source() 	{ return HDR_MESSAGE_ID; }; 	// MESSAGE header it is copied from
+	  static const bool ack_subscription = false;
+  };
+
+  struct Stomp11Policy {
+	  static const ProtocolVersion version = STOMP_1_1;
+	  static const bool escape_headers = true; 		// \n, : and backslash
+	  static const bool escape_cr = false;
+	  static const bool crlf = false;
+	  static const bool heartbeat = true;
+	  static const bool nack = true;
+	  static const char* ack_id_header() 	{ return "message-id"; };
+	  static header_atom ack_id_source() 	{ return HDR_MESSAGE_ID; };
+	  static const bool ack_subscription = true; 	// ACK must name the subscription too
+  };
+
+  struct Stomp12Policy {
+	  static const ProtocolVersion version = STOMP_1_2;
+	  static const bool escape_headers = true; 		// as 1.1, plus \r
+	  static const bool escape_cr = true;
+	  static const bool crlf = true; 				// lines may end with \r\n
+	  static const bool heartbeat = true;
+	  static const bool nack = true;
+	  static const char* ack_id_header() 	{ return "id"; };
+	  static header_atom ack_id_source() 	{ return HDR_ACK; };
+	  static const bool ack_subscription = false;
+  };
+
+  // -------------------------------
+  // codec interface (one virtual call per frame)
+  // -------------------------------
+  class FrameCodec {
+  public:
+	  virtual ~FrameCodec() {};
+	  virtual ProtocolVersion version() const = 0;
+	  virtual const char* 	version_string() const = 0;
+	  virtual bool 			supports_heartbeat() const = 0;
+	  virtual bool 			supports_nack() const = 0;
+	  // serialize a frame at the end of a streambuf
+	  virtual void 			encode(const Frame& frame, boost::asio::streambuf& out) const = 0;
+	  // the same up to the blank line after the headers: the body and the
+	  // terminating NULL are left to the caller, eg. for a gather write
+	  virtual void 			encode_head(const Frame& frame, boost::asio::streambuf& out) const = 0;
+	  // decode a received header block (the header lines, without the blank
+	  // line) into headers. raw: not escaped (CONNECTED)
+	  virtual void 			decode_headers(const char* block, size_t len, bool raw, hdrmap& headers) const = 0;
+	  // look up one header in a header block without decoding the others:
+	  // value is the raw value, escaped tells that it still needs decoding
+	  virtual bool 			find_header(const char* block, size_t len, bool raw, boost::string_view key,
+			  	  	  	  	  	  	  boost::string_view& value, bool& escaped) const = 0;
+	  // note where the well-known headers of a header block are, see HeaderIndex
+	  virtual void 			index_headers(const char* block, size_t len, bool raw, HeaderIndex& index) const = 0;
+	  // fill the headers of an ACK / NACK frame for a received MESSAGE
+	  virtual void 			ack_headers(const Frame& message, hdrmap& headers) const = 0;
+
+	  // the codec for a negotiated version ("1.0", "1.1", "1.2"; anything else is 1.0)
+	  static const FrameCodec& for_version(ProtocolVersion v);
+	  static const FrameCodec& for_version(const string& v);
+  };
+
+  template <class Policy>
+  class BasicFrameCodec: public FrameCodec {
+  public:
+	  ProtocolVersion version() const 		{ return Policy::version; };
+	  const char* 	version_string() const;
+	  bool 			supports_heartbeat() const 	{ return Policy::heartbeat; };
+	  bool 			supports_nack() const 		{ return Policy::nack; };
+	  void 			encode(const Frame& frame, boost::asio::streambuf& out) const;
+	  void 			encode_head(const Frame& frame, boost::asio::streambuf& out) const;
+	  void 			decode_headers(const char* block, size_t len, bool raw, hdrmap& headers) const;
+	  bool 			find_header(const char* block, size_t len, bool raw, boost::string_view key,
+			  	  	  	  	  boost::string_view& value, bool& escaped) const;
+	  void 			index_headers(const char* block, size_t len, bool raw, HeaderIndex& index) const;
+	  void 			ack_headers(const Frame& message, hdrmap& headers) const;
+
+	  // escape / unescape a single header token according to Policy
+	  static void 	encode_token(boost::asio::streambuf& out, const char* s, size_t len);
+	  static string decode_token(const char* s, size_t len);
+  };
+
+  typedef BasicFrameCodec<Stomp10Policy> Stomp10Codec;
+  typedef BasicFrameCodec<Stomp11Policy> Stomp11Codec;
+  typedef BasicFrameCodec<Stomp12Policy> Stomp12Codec;
+
+} // namespace STOMP
+
+#endif
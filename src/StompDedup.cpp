@@ -0,0 +1,86 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+
+#include "StompDedup.hpp"
+
+namespace STOMP {
+
+  const size_t DedupFilter::DEFAULT_CAPACITY;
+
+  // ------------------------------------------
+  DedupFilter::DedupFilter(size_t capacity, const boost::posix_time::time_duration& window):
+  // ------------------------------------------
+	  m_capacity(std::max(capacity, size_t(2))),
+	  m_window(window),
+	  m_rotated(boost::posix_time::microsec_clock::universal_time()),
+	  m_lookups(0),
+	  m_hits(0)
+  {
+	  m_current.reserve(m_capacity / 2);
+	  m_previous.reserve(m_capacity / 2);
+  }
+
+  // ------------------------------------------
+  uint64_t DedupFilter::key(const std::string& id)
+  // ------------------------------------------
+  {
+	  return boost::hash_range(id.begin(), id.end());
+  }
+
+  // ------------------------------------------
+  void DedupFilter::rotate_if_due()
+  // ------------------------------------------
+  {
+	  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	  if ((m_current.size() < m_capacity / 2) && (now - m_rotated < m_window)) return;
+	  m_previous.swap(m_current);
+	  m_current.clear(); 	// keeps its buckets, no rehashing
+	  m_rotated = now;
+  }
+
+  // ------------------------------------------
+  bool DedupFilter::seen(const std::string& id)
+  // ------------------------------------------
+  {
+	  uint64_t k = key(id);
+	  m_lookups++;
+	  if ((m_current.find(k) != m_current.end()) || (m_previous.find(k) != m_previous.end())) {
+		  m_hits++;
+		  return true;
+	  }
+	  return false;
+  }
+
+  // ------------------------------------------
+  void DedupFilter::insert(const std::string& id)
+  // ------------------------------------------
+  {
+	  rotate_if_due();
+	  m_current.insert(key(id));
+  }
+
+} // namespace STOMP
@@ -0,0 +1,83 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompDedup.hpp
+//
+// Duplicate suppression for received MESSAGE frames. After a reconnect the
+// broker redelivers whatever was not acknowledged yet; a DedupFilter
+// remembers the message-ids seen on a subscription so that those frames can
+// be dropped (and acknowledged) before their body is even copied.
+//
+
+#ifndef __StompDedup_H_
+#define __StompDedup_H_
+
+#include <string>
+#include <stdint.h>
+
+#include <boost/unordered_set.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace STOMP {
+
+  // ----------------------------------------
+  // A time-windowed set of message-id hashes in two generations: new ids go
+  // into the current one, which becomes the previous one (dropping the old
+  // previous) once it holds capacity/2 ids or is older than the window. So
+  // memory stays bounded by capacity, and an id is remembered for at least
+  // the window, or as long as capacity/2 newer ids, whichever is shorter.
+  // 64-bit hashes make false positives negligible. Not thread-safe: the
+  // client only uses it from its IO thread.
+  // ----------------------------------------
+  class DedupFilter {
+	  typedef boost::unordered_set<uint64_t> generation;
+
+	  generation 					m_current, m_previous;
+	  size_t 						m_capacity;
+	  boost::posix_time::time_duration m_window;
+	  boost::posix_time::ptime 		m_rotated;
+	  uint64_t 						m_lookups, m_hits;
+
+	  static uint64_t key(const std::string& id);
+	  void rotate_if_due();
+  public:
+	  static const size_t DEFAULT_CAPACITY = 65536;
+
+	  DedupFilter(size_t capacity = DEFAULT_CAPACITY,
+			  const boost::posix_time::time_duration& window = boost::posix_time::minutes(10));
+
+	  // has this message-id been recorded? (counted in lookups / hits)
+	  bool seen(const std::string& id);
+	  // record a message-id, once its frame has been delivered
+	  void insert(const std::string& id);
+
+	  size_t 	size() const 	{ return m_current.size() + m_previous.size(); };
+	  size_t 	capacity() const { return m_capacity; };
+	  uint64_t 	lookups() const { return m_lookups; };
+	  uint64_t 	hits() const 	{ return m_hits; };
+  };
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include "StompFilter.hpp"
+#include "StompFrame.hpp"
+
+namespace STOMP {
+
+  const size_t HeaderFilter::MAX_HEADERS;
+  const size_t HeaderFilter::MAX_DEPTH;
+
+  // characters of an unquoted header name or value
+  static inline bool is_word_char(char c) {
+	  return isalnum((unsigned char) c) || (c != '\0' && strchr("_-.:/@+*#$%", c) != NULL);
+  }
+
+  // the whole of v as a number
+  static bool to_number(boost::string_view v, double& x) {
+	  char buf[64];
+	  if (v.empty() || (v.size() >= sizeof(buf))) return(false);
+	  memcpy(buf, v.data(), v.size());
+	  buf[v.size()] = '\0';
+	  char* end;
+	  x = strtod(buf, &end);
+	  return(end == buf + v.size());
+  }
+
+  // ----------------------------------------
+  // recursive descent over the expression, one token of lookahead. Every
+  // rule leaves its result on the (simulated) stack, so that the depth the
+  // program needs is known when it is compiled.
+  // ----------------------------------------
+  struct HeaderFilter::Parser {
+	  typedef enum { T_END, T_LPAREN, T_RPAREN, T_NOT, T_AND, T_OR, T_OP, T_WORD, T_STRING } TokenType;
+
+	  HeaderFilter& 		f;
+	  const std::string& 	s;
+	  size_t 				pos, start, depth;
+	  size_t 				nesting; 	// of '!' and '(', bounds the recursion
+	  TokenType 			type;
+	  OpCode 				op;
+	  std::string 			text;
+
+	  Parser(HeaderFilter& filter, const std::string& expression):
+		  f(filter), s(expression), pos(0), start(0), depth(0), nesting(0), type(T_END), op(OP_EXISTS) {};
+
+	  void fail(const char* what) {
+		  throw std::invalid_argument(boost::str(boost::format("filter: %1% at position %2% of '%3%'") % what % start % s));
+	  }
+
+	  void next() {
+		  while ((pos < s.size()) && isspace((unsigned char) s[pos])) pos++;
+		  start = pos;
+		  text.clear();
+		  if (pos == s.size()) { type = T_END; return; }
+		  char c = s[pos], d = (pos + 1 < s.size()) ? s[pos + 1] : '\0';
+		  type = T_OP;
+		  if (c == '(') 					{ type = T_LPAREN; pos++; }
+		  else if (c == ')') 				{ type = T_RPAREN; pos++; }
+		  else if (c == '&' && d == '&') 	{ type = T_AND; pos += 2; }
+		  else if (c == '|' && d == '|') 	{ type = T_OR; pos += 2; }
+		  else if (c == '!' && d == '=') 	{ op = OP_NE; pos += 2; }
+		  else if (c == '!') 				{ type = T_NOT; pos++; }
+		  else if (c == '=') 				{ op = OP_EQ; pos += (d == '=') ? 2 : 1; }
+		  else if (c == '^' && d == '=') 	{ op = OP_PREFIX; pos += 2; }
+		  else if (c == '<') 				{ op = (d == '=') ? OP_LE : OP_LT; pos += (d == '=') ? 2 : 1; }
+		  else if (c == '>') 				{ op = (d == '=') ? OP_GE : OP_GT; pos += (d == '=') ? 2 : 1; }
+		  else if (c == '\'' || c == '"') {
+			  size_t end = s.find(c, pos + 1);
+			  if (end == std::string::npos) fail("unterminated string");
+			  text.assign(s, pos + 1, end - pos - 1);
+			  type = T_STRING;
+			  pos = end + 1;
+		  } else if (is_word_char(c)) {
+			  while ((pos < s.size()) && is_word_char(s[pos])) text += s[pos++];
+			  type = T_WORD;
+			  if (text == "and") 		type = T_AND;
+			  else if (text == "or") 	type = T_OR;
+			  else if (text == "not") 	type = T_NOT;
+		  } else {
+			  fail("unexpected character");
+		  }
+	  }
+
+	  void emit(OpCode code, uint16_t header = 0, const std::string& operand = std::string(), double number = 0) {
+		  Instr in;
+		  in.op = code;
+		  in.header = header;
+		  in.text = operand;
+		  in.number = number;
+		  f.m_program.push_back(in);
+		  if (code < OP_AND) {
+			  if (++depth > MAX_DEPTH) fail("expression too deeply nested");
+		  } else if (code != OP_NOT) {
+			  depth--;
+		  }
+	  }
+
+	  void expr() {
+		  term();
+		  while (type == T_OR) { next(); term(); emit(OP_OR); }
+	  }
+
+	  void term() {
+		  factor();
+		  while (type == T_AND) { next(); factor(); emit(OP_AND); }
+	  }
+
+	  void nest() {
+		  // a user-supplied '!!!!...' or '((((...' must not exhaust the C++ stack
+		  if (++nesting > MAX_DEPTH) fail("expression too deeply nested");
+	  }
+
+	  void factor() {
+		  if (type == T_NOT) {
+			  nest();
+			  next();
+			  factor();
+			  emit(OP_NOT);
+			  nesting--;
+		  } else if (type == T_LPAREN) {
+			  nest();
+			  next();
+			  expr();
+			  if (type != T_RPAREN) fail("')' expected");
+			  next();
+			  nesting--;
+		  } else if ((type == T_WORD) || (type == T_STRING)) {
+			  uint16_t header = f.header_index(text);
+			  if (f.m_headers.size() > MAX_HEADERS) fail("too many header names");
+			  next();
+			  if (type != T_OP) {
+				  emit(OP_EXISTS, header);
+				  return;
+			  }
+			  OpCode test = op;
+			  next();
+			  if ((type != T_WORD) && (type != T_STRING)) fail("value expected");
+			  double number = 0;
+			  if ((test >= OP_LT) && !to_number(text, number)) fail("number expected");
+			  emit(test, header, text, number);
+			  next();
+		  } else {
+			  fail("header name expected");
+		  }
+	  }
+  };
+
+  // ------------------------------------------
+  HeaderFilter::HeaderFilter(const std::string& expression, FilterAction action):
+  // ------------------------------------------
+	  m_expression(expression),
+	  m_action(action),
+	  m_checked(0),
+	  m_rejected(0)
+  {
+	  Parser parser(*this, m_expression);
+	  parser.next();
+	  if (parser.type == Parser::T_END) parser.fail("expression expected");
+	  parser.expr();
+	  if (parser.type != Parser::T_END) parser.fail("unexpected token");
+  }
+
+  // ------------------------------------------
+  uint16_t HeaderFilter::header_index(const std::string& name)
+  // ------------------------------------------
+  {
+	  for (size_t i = 0; i < m_headers.size(); i++)
+		  if (m_headers[i] == name) return(i);
+	  m_headers.push_back(name);
+	  return(m_headers.size() - 1);
+  }
+
+  // ------------------------------------------
+  bool HeaderFilter::matches(const Frame& frame) const
+  // ------------------------------------------
+  {
+	  // each header is looked up once, on first use
+	  boost::string_view values[MAX_HEADERS];
+	  signed char found[MAX_HEADERS] = { 0 }; // 0: not looked up yet, 1: present, -1: missing
+	  bool stack[MAX_DEPTH];
+	  size_t sp = 0;
+	  for (std::vector<Instr>::const_iterator in = m_program.begin(); in != m_program.end(); ++in) {
+		  switch (in->op) {
+		  case OP_AND: 	sp--; stack[sp - 1] = stack[sp - 1] && stack[sp]; continue;
+		  case OP_OR: 	sp--; stack[sp - 1] = stack[sp - 1] || stack[sp]; continue;
+		  case OP_NOT: 	stack[sp - 1] = !stack[sp - 1]; continue;
+		  default: 		break;
+		  }
+		  uint16_t h = in->header;
+		  if (found[h] == 0) found[h] = frame.find_header(m_headers[h], values[h]) ? 1 : -1;
+		  bool present = (found[h] > 0);
+		  const boost::string_view& v = values[h];
+		  double x;
+		  bool result;
+		  switch (in->op) {
+		  case OP_EXISTS: 	result = present; break;
+		  case OP_EQ: 		result = present && (v == in->text); break;
+		  case OP_NE: 		result = !present || (v != in->text); break;
+		  case OP_PREFIX: 	result = present && v.starts_with(in->text); break;
+		  default:
+			  result = present && to_number(v, x);
+			  if (result) {
+				  switch (in->op) {
+				  case OP_LT: 	result = (x < in->number); break;
+				  case OP_LE: 	result = (x <= in->number); break;
+				  case OP_GT: 	result = (x > in->number); break;
+				  default: 		result = (x >= in->number); break;
+				  }
+			  }
+		  }
+		  stack[sp++] = result;
+	  }
+	  return(stack[0]);
+  }
+
+  // ------------------------------------------
+  bool HeaderFilter::accept(const Frame& frame)
+  // ------------------------------------------
+  {
+	  m_checked++;
+	  bool ok = matches(frame);
+	  if (!ok) m_rejected++;
+	  return(ok);
+  }
+
+} // namespace STOMP
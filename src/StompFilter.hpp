@@ -0,0 +1,118 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompFilter.hpp
+//
+// Header filters for received MESSAGE frames. An expression like
+//
+//     type == 'order' && (priority >= 5 || region ^= "eu-")
+//
+// is compiled once into a flat postfix program. The client runs it on the
+// raw header block of every MESSAGE for the subscription, as soon as the
+// headers are read: a rejected frame is skipped without decoding its other
+// headers or copying its body, and never reaches the callback or the pull
+// queue.
+//
+//   expr   := term { ('||' | 'or') term }
+//   term   := factor { ('&&' | 'and') factor }
+//   factor := ('!' | 'not') factor | '(' expr ')' | test
+//   test   := name [ op value ]        (a bare name: the header is present)
+//   op     := '==' | '!=' | '^=' (starts with) | '<' | '<=' | '>' | '>='
+//   value  := 'text' | "text" | word
+//
+// ==, != and ^= compare text. <, <=, >, >= compare numbers: the value must
+// be one, and a header that is missing or not a number fails them.
+//
+
+#ifndef __StompFilter_H_
+#define __StompFilter_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace STOMP {
+
+  class Frame;
+
+  // what becomes of rejected frames in client ack modes
+  typedef enum {
+	  FILTER_ACK = 0, 	// acknowledged, the broker forgets them
+	  FILTER_NACK, 		// NACKed (STOMP 1.1+), eg. for a dead letter queue
+	  FILTER_DROP 		// neither: a later cumulative ACK or the broker's own rules decide
+  } FilterAction;
+
+  // ----------------------------------------
+  // A compiled filter expression. matches() is const and can be run from
+  // any thread; the counters are updated by accept(), on the IO thread.
+  // ----------------------------------------
+  class HeaderFilter {
+  public:
+	  typedef enum {
+		  OP_EXISTS, OP_EQ, OP_NE, OP_PREFIX, OP_LT, OP_LE, OP_GT, OP_GE, 	// tests
+		  OP_AND, OP_OR, OP_NOT 											// logic
+	  } OpCode;
+
+	  struct Instr {
+		  OpCode 		op;
+		  uint16_t 		header; 	// tests: index into the header names
+		  std::string 	text; 		// ==, != and ^= operand
+		  double 		number; 	// <, <=, >, >= operand
+	  };
+
+	  static const size_t MAX_HEADERS = 16; 	// distinct header names per filter
+	  static const size_t MAX_DEPTH = 32; 		// evaluation stack, and nesting of '!' and '('
+
+	  // throws std::invalid_argument, naming the offending position
+	  HeaderFilter(const std::string& expression, FilterAction action = FILTER_ACK);
+
+	  // run the program on a frame's headers
+	  bool 		matches(const Frame& frame) const;
+	  // the same, counting checked and rejected frames
+	  bool 		accept(const Frame& frame);
+
+	  const std::string& 	expression() const 	{ return m_expression; };
+	  FilterAction 			action() const 		{ return m_action; };
+	  const std::vector<Instr>& program() const { return m_program; };
+	  uint64_t 	checked() const 	{ return m_checked; };
+	  uint64_t 	rejected() const 	{ return m_rejected; };
+
+  private:
+	  std::string 				m_expression;
+	  FilterAction 				m_action;
+	  std::vector<std::string> 	m_headers; 	// names the program looks up
+	  std::vector<Instr> 		m_program; 	// postfix
+	  boost::atomic<uint64_t> 	m_checked, m_rejected;
+
+	  // recursive descent parser, emits into m_program
+	  struct Parser;
+	  uint16_t 	header_index(const std::string& name);
+  };
+
+} // namespace STOMP
+
+#endif
@@ -25,6 +25,7 @@ http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
 #include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
 #include "BoostStomp.hpp"
+#include "StompCodec.hpp"
 #include "helpers.h"
 
 namespace STOMP {
@@ -32,129 +33,135 @@ namespace STOMP {
 	using namespace boost;
 	using namespace boost::asio;
 
-  /*
-   * Escaping is needed to allow header keys and values to contain those frame header
-   * delimiting octets as values. The CONNECT and CONNECTED frames do not escape the
-   * colon or newline octets in order to remain backward compatible with STOMP 1.0.
-   * C style string literal escapes are used to encode any colons and newlines that
-   * are found within the UTF-8 encoded headers. When decoding frame headers, the
-   * following transformations MUST be applied:
-   *
-   * \n (octet 92 and 110) translates to newline (octet 10)
-   * \c (octet 92 and 99) translates to : (octet 58)
-   * \\ (octet 92 and 92) translates to \ (octet 92)
-   */
+  // indexed by stomp_command
+  const string stomp_command_names[CMD_COUNT] = {
+	  "",
+	  "CONNECT", "STOMP", "SEND", "SUBSCRIBE", "UNSUBSCRIBE", "ACK", "NACK",
+	  "BEGIN", "COMMIT", "ABORT", "DISCONNECT",
+	  "CONNECTED", "MESSAGE", "RECEIPT", "ERROR"
+  };
+
+  const string stomp_command_lines[CMD_COUNT] = {
+	  "",
+	  "CONNECT\n", "STOMP\n", "SEND\n", "SUBSCRIBE\n", "UNSUBSCRIBE\n", "ACK\n", "NACK\n",
+	  "BEGIN\n", "COMMIT\n", "ABORT\n", "DISCONNECT\n",
+	  "CONNECTED\n", "MESSAGE\n", "RECEIPT\n", "ERROR\n"
+  };
+
+  // indexed by header_atom
+  const string header_atom_names[HDR_COUNT] = {
+	  "destination", "message-id", "subscription", "content-length", "content-type",
+	  "ack", "id", "receipt", "receipt-id", "transaction", "version", "heart-beat",
+	  "message"
+  };
+
+  class frame_error_category: public boost::system::error_category {
+  public:
+	  const char* name() const BOOST_NOEXCEPT { return "stomp.frame"; }
+	  std::string message(int ev) const {
+		  switch (ev) {
+		  case FRAME_HEADERS_TOO_LARGE: 	return "frame header block too large";
+		  case FRAME_TOO_LARGE: 			return "frame too large";
+		  case FRAME_BUDGET_EXCEEDED: 		return "receive buffer budget exceeded";
+		  case FRAME_MALFORMED: 			return "malformed frame";
+		  case TRANSACTION_ABORTED: 		return "transaction aborted by a reconnect";
+		  default: 							return "unknown frame error";
+		  }
+	  }
+  };
+
+  const boost::system::error_category& frame_category() {
+	  static const frame_error_category category;
+	  return category;
+  }
+
+  // legacy helpers, STOMP 1.1 escaping rules (see StompCodec.hpp)
   string& encode_header_token(string& str) {
-	  boost::algorithm::replace_all(str, "\n", "\\n");
-	  boost::algorithm::replace_all(str, ":", "\\c");
-	  boost::algorithm::replace_all(str, "\\", "\\\\");
+	  boost::asio::streambuf sb;
+	  Stomp11Codec::encode_token(sb, str.data(), str.size());
+	  str.assign(boost::asio::buffer_cast<const char*>(sb.data()), sb.size());
 	  return(str);
   };
 
   string& decode_header_token(string& str) {
-	  boost::algorithm::replace_all(str, "\\n", "\n");
-	  boost::algorithm::replace_all(str, "\\c", ":");
-	  boost::algorithm::replace_all(str, "\\\\", "\\");
+	  str = Stomp11Codec::decode_token(str.data(), str.size());
 	  return(str);
   };
 
-  boost::asio::streambuf& Frame::encode(boost::asio::streambuf& _request)
+  boost::asio::streambuf& Frame::encode(boost::asio::streambuf& _request, const FrameCodec& codec)
   // -------------------------------------
   {
-	// prepare an output stream
-	ostream os(&_request);
-	// step 1. write the command
-	if (m_command.length() > 0) {
-	  os << m_command << "\n";
-	} else {
-	  throw("stomp_write: command not set!!");
-	}
-	// step 2. Write the headers (key-value pairs)
-	if( m_headers.size() > 0 ) {
-	  for ( hdrmap::iterator it = m_headers.begin() ; it != m_headers.end(); it++ ) {
-		  string key = (*it).first;
-		  string val = (*it).second;
-		os << encode_header_token(key)
-			<< ":"
-			<< encode_header_token(val)
-			<< "\n";
-	  }
-	}
-	// special header: content-length
-	if( m_body.v.size() > 0 ) {
-	  os << "content-length:" << m_body.v.size() << "\n";
-	}
-	// write newline signifying end of headers
-	os << "\n";
-	// step 3. Write the body
-	if( m_body.v.size() > 0 ) {
-		_request.sputn(m_body.v.data(), m_body.v.size());
-		//_request.commit(m_body.v.size());
-	}
-	// write terminating NULL char
-	_request.sputc('\0');
-	//_request.commit(1);
+	codec.encode(*this, _request);
 	return(_request);
   };
 
-  // my own version of getline for an asio streambuf
-inline void mygetline (boost::asio::streambuf& sb, string& _str, char delim = '\n') {
-	const char* line = boost::asio::buffer_cast<const char*>(sb.data());
-	char _c;
-	size_t i;
-	_str.clear();
-	for( i = 0;
-		((i < sb.size()) && ((_c = line[i]) != delim));
-		i++
-	) _str += _c;
-	//debug_print( boost::format("mygetline: i=%1%, sb.size()==%2%") % i % sb.size() );
-	//hexdump(_str.c_str(), _str.size());
-}
-
   // construct STOMP frame (command & header) from a streambuf
   // --------------------------------------------------
-  Frame::Frame(boost::asio::streambuf& stomp_response, const stomp_server_command_map_t& cmd_map)
+  Frame::Frame(boost::asio::streambuf& stomp_response, const stomp_server_command_map_t& cmd_map, const FrameCodec& codec):
   // --------------------------------------------------
+	m_cmd(CMD_UNKNOWN),
+	m_raw_codec(NULL),
+	m_body_attached(false)
   {
-		string _str;
+	  parse_head(stomp_response, cmd_map, codec);
+  };
 
+  // --------------------------------------------------
+  void Frame::parse_head(boost::asio::streambuf& stomp_response, const stomp_server_command_map_t& cmd_map, const FrameCodec& codec)
+  // --------------------------------------------------
+  {
+		// a recycled frame keeps its string and vector capacity
+		m_cmd = CMD_UNKNOWN;
+		m_command.clear();
+		m_headers.clear();
+		m_raw_headers.clear();
+		m_raw_codec = NULL;
+		m_index.clear();
+		m_body.v.clear();
+		m_body_attached = false;
 		try {
 			// STEP 1: find the next STOMP command line in stomp_response.
 			// Chomp unknown lines till the buffer is empty, in which case an exception is raised
-			//debug_print(boost::format("Frame parser phase 1, stomp_response.size()==%1%") % stomp_response.size());
 			//hexdump(boost::asio::buffer_cast<const char*>(stomp_response.data()), stomp_response.size());
 			while (stomp_response.size() > 0) {
-				mygetline(stomp_response, _str);
-				//hexdump(_str.c_str(), _str.length());
-				stomp_response.consume(_str.size() + 1); // plus one for the newline
-				if (cmd_map.find(_str) != cmd_map.end()) {
-					//debug_print(boost::format("phase 1: COMMAND==%1%, sb.size==%2%") % _str % stomp_response.size());
-					m_command = _str;
-					break;
+				const char* line = boost::asio::buffer_cast<const char*>(stomp_response.data());
+				const char* eol = (const char*) memchr(line, '\n', stomp_response.size());
+				size_t len = (eol != NULL) ? (eol - line) : stomp_response.size();
+				size_t consumed = len + 1; // plus one for the newline
+				if (len > 0 && line[len - 1] == '\r') len--; // STOMP 1.2 line ending
+				stomp_command cmd = lookup_command(line, len);
+				if (is_server_command(cmd)) {
+					m_cmd = cmd;
+				} else if (cmd == CMD_UNKNOWN && !cmd_map.empty()) {
+					// custom commands registered by the application
+					string custom(line, len);
+					if (cmd_map.find(custom) != cmd_map.end()) m_command = custom;
 				}
+				stomp_response.consume(consumed);
+				if (m_cmd != CMD_UNKNOWN || !m_command.empty()) break;
 			}
-			// if after all this trouble m_command is not set, and there's no more data in stomp_response
+			// if after all this trouble the command is not set, and there's no more data in stomp_response
 			// (which shouldn't happen since we do async_read_until the double newline), then throw an exception
-			if (m_command == "") throw(NoMoreFrames());
+			if (m_cmd == CMD_UNKNOWN && m_command.empty()) throw(NoMoreFrames());
 
-			// STEP 2: parse all headers
-			//debug_print("Frame parser phase 2");
-			vector< string > header_parts;
-			while (stomp_response.size() > 0) {
-				mygetline(stomp_response, _str);
-				stomp_response.consume(_str.size()+1);
-				boost::algorithm::split(header_parts, _str, is_any_of(":"));
-				if (header_parts.size() > 1) {
-					string& key = decode_header_token(header_parts[0]);
-					string& val = decode_header_token(header_parts[1]);
-					//debug_print(boost::format("phase 2: HEADER[%1%]==%2%") % key % val);
-					m_headers[key] = val;
-					//
-				} else {
-					// no valid header line detected, on to the body scanner
+			// STEP 2: keep the header lines, up to the first one that is not a
+			// header (the blank line), as they are
+			const char* block = boost::asio::buffer_cast<const char*>(stomp_response.data());
+			size_t size = stomp_response.size(), len = 0, consumed = size;
+			while (len < size) {
+				const char* eol = (const char*) memchr(block + len, '\n', size - len);
+				size_t end = (eol != NULL) ? (eol - block) : size;
+				if (memchr(block + len, ':', end - len) == NULL) {
+					consumed = end + 1;
 					break;
 				}
+				len = end + 1;
 			}
+			m_raw_headers.assign(block, std::min(len, size));
+			m_raw_codec = &codec;
+			// CONNECTED is never escaped
+			codec.index_headers(m_raw_headers.data(), m_raw_headers.size(), m_cmd == CMD_CONNECTED, m_index);
+			stomp_response.consume(consumed);
 			//
 		} catch(NoMoreFrames& e) {
 			//debug_print("-- Frame parser ended (no more frames)");
@@ -162,33 +169,220 @@ inline void mygetline (boost::asio::streambuf& sb, string& _str, char delim = '\
 		}
   };
 
+  // --------------------------------------------------
+  void Frame::decode_headers() const
+  // --------------------------------------------------
+  {
+	  if (m_raw_codec == NULL) return;
+	  // CONNECTED is never escaped
+	  m_raw_codec->decode_headers(m_raw_headers.data(), m_raw_headers.size(), m_cmd == CMD_CONNECTED, m_headers);
+	  m_raw_codec = NULL;
+	  m_raw_headers.clear();
+  }
+
+  // the key of a map lookup lives on, so that looking up a header does not
+  // allocate a string every time
+  static const string& lookup_key(boost::string_view key)
+  {
+	  static thread_local string s_key;
+	  s_key.assign(key.data(), key.size());
+	  return(s_key);
+  }
+
+  // --------------------------------------------------
+  bool Frame::find_header(boost::string_view key, boost::string_view& value) const
+  // --------------------------------------------------
+  {
+	  header_atom atom = lookup_header(key.data(), key.size());
+	  if (atom != HDR_UNKNOWN) return(find_header(atom, value));
+	  if (m_raw_codec != NULL) {
+		  bool escaped = false;
+		  if (!m_raw_codec->find_header(m_raw_headers.data(), m_raw_headers.size(), m_cmd == CMD_CONNECTED, key, value, escaped))
+			  return(false);
+		  if (!escaped) return(true);
+		  // the value has to be unescaped: decode them all
+		  decode_headers();
+	  }
+	  hdrmap::const_iterator it = m_headers.find(lookup_key(key));
+	  if (it == m_headers.end()) return(false);
+	  value = it->second;
+	  return(true);
+  }
+
+  // --------------------------------------------------
+  bool Frame::find_header(header_atom atom, boost::string_view& value) const
+  // --------------------------------------------------
+  {
+	  if (m_raw_codec != NULL) {
+		  if (!m_index.has(atom)) return(false);
+		  value = boost::string_view(m_raw_headers.data() + m_index.offset[atom], m_index.length[atom]);
+		  if (!((m_index.escaped >> atom) & 1)) return(true);
+		  decode_headers();
+	  }
+	  hdrmap::const_iterator it = m_headers.find(header_atom_names[atom]);
+	  if (it == m_headers.end()) return(false);
+	  value = it->second;
+	  return(true);
+  }
+
+  // --------------------------------------------------
+  size_t Frame::body_length(const boost::asio::streambuf& _response) const
+  // --------------------------------------------------
+  {
+	boost::string_view content_length;
+	if (find_header(HDR_CONTENT_LENGTH, content_length)) {
+		return(lexical_cast<size_t>(content_length.data(), content_length.size()));
+	}
+	// all bytes until the first NULL
+	const char* rawdata = boost::asio::buffer_cast<const char*>(_response.data());
+	const char* nul = (const char*) memchr(rawdata, '\0', _response.size());
+	return (nul != NULL) ? (nul - rawdata) : _response.size();
+  }
+
   // STEP 3: parse the body
   size_t Frame::parse_body(boost::asio::streambuf& _response)
   {
-	  std::size_t _content_length = 0, bytecount = 0;
-	  string _str;
-	//debug_print("Frame parser phase 3");
-	// special case: content-length
-	if (m_headers.find("content-length") != m_headers.end()) {
-		string& val = m_headers["content-length"];
-		//debug_print(boost::format("phase 3: body content-length==%1%") % val);
-		_content_length = lexical_cast<size_t>(val);
-	}
-	if (_content_length > 0) {
-		bytecount += _content_length;
-		// read back the body byte by byte
-		const char* rawdata = boost::asio::buffer_cast<const char*>(_response.data());
-		for (size_t i = 0; i < _content_length; i++ ) {
-			m_body << rawdata[i];
-		}
-	} else {
-		// read all bytes until the first NULL
-		mygetline(_response, _str, '\0');
-		bytecount += _str.size();
-		m_body << _str;
-	}
-	bytecount += 1; // for the final frame-terminating NULL
-	//debug_print(boost::format("phase 3: consumed %1% bytes, BODY(%2% bytes)==%3%") % bytecount % _str.size() % _str);
+	size_t bytecount = attach_body(_response);
+	detach();
+	_response.consume(bytecount);
+	return(bytecount);
+  }
+
+  // STEP 3, leaving the body in the streambuf
+  size_t Frame::attach_body(boost::asio::streambuf& _response)
+  {
+	size_t len = std::min(body_length(_response), _response.size());
+	m_body.v.clear();
+	m_body_view = boost::string_view(boost::asio::buffer_cast<const char*>(_response.data()), len);
+	m_body_attached = true;
+	return(std::min(len + 1, _response.size())); // plus the final NULL
+  }
+
+  // --------------------------------------------------
+  void Frame::detach()
+  // --------------------------------------------------
+  {
+	  if (!m_body_attached) return;
+	  m_body.v.assign(m_body_view.begin(), m_body_view.end());
+	  m_body_view = boost::string_view();
+	  m_body_attached = false;
+  }
+
+  // set a header in place: an existing entry keeps its node and value capacity
+  static void set_header(hdrmap& headers, boost::string_view key, boost::string_view value)
+  {
+	  const string& k = lookup_key(key);
+	  hdrmap::iterator it = headers.lower_bound(k);
+	  if ((it == headers.end()) || (it->first != k))
+		  it = headers.insert(it, hdrmap::value_type(k, string()));
+	  it->second.assign(value.data(), value.size());
+  }
+
+  static void rebuild_headers(hdrmap& current, boost::string_view destination, const header_view* headers, size_t n)
+  {
+	  // drop what is not set again, then (re)set the rest
+	  for (hdrmap::iterator it = current.begin(); it != current.end(); ) {
+		  boost::string_view key(it->first);
+		  bool keep = (key == "destination");
+		  for (size_t i = 0; (i < n) && !keep; i++) keep = (headers[i].first == key);
+		  if (keep) ++it;
+		  else current.erase(it++);
+	  }
+	  set_header(current, "destination", destination);
+	  for (size_t i = 0; i < n; i++) set_header(current, headers[i].first, headers[i].second);
+  }
+
+  // --------------------------------------------------
+  void Frame::rebuild(stomp_command cmd, boost::string_view destination,
+		  const header_view* headers, size_t n, boost::string_view body)
+  // --------------------------------------------------
+  {
+	  m_cmd = cmd;
+	  m_command.clear();
+	  rebuild_headers(m_headers, destination, headers, n);
+	  m_body.v.assign(body.begin(), body.end());
+  }
+
+  // --------------------------------------------------
+  void Frame::rebuild(stomp_command cmd, boost::string_view destination,
+		  const header_view* headers, size_t n, binbody&& body)
+  // --------------------------------------------------
+  {
+	  m_cmd = cmd;
+	  m_command.clear();
+	  rebuild_headers(m_headers, destination, headers, n);
+	  m_body = std::move(body);
+  }
+
+  // --------------------------------------------------
+  void Frame::rebuild(stomp_command cmd, boost::string_view destination,
+		  const header_view* headers, size_t n)
+  // --------------------------------------------------
+  {
+	  m_cmd = cmd;
+	  m_command.clear();
+	  rebuild_headers(m_headers, destination, headers, n);
+  }
+
+  const size_t FramePool::DEFAULT_CAPACITY;
+  const size_t FramePool::MAX_BODY;
+
+  // --------------------------------------------------
+  FramePool::FramePool(size_t capacity):
+  // --------------------------------------------------
+	  m_capacity(capacity)
+  {
+	  m_free.reserve(capacity);
+  }
+
+  // --------------------------------------------------
+  FramePool::~FramePool()
+  // --------------------------------------------------
+  {
+	  for (size_t i = 0; i < m_free.size(); i++) delete m_free[i];
+  }
+
+  // --------------------------------------------------
+  Frame* FramePool::acquire()
+  // --------------------------------------------------
+  {
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  if (!m_free.empty()) {
+			  Frame* frame = m_free.back();
+			  m_free.pop_back();
+			  return(frame);
+		  }
+	  }
+	  return(new Frame(CMD_SEND));
+  }
+
+  // --------------------------------------------------
+  void FramePool::release(Frame* frame)
+  // --------------------------------------------------
+  {
+	  if ((frame->command_id() == CMD_SEND) && (frame->body().v.capacity() <= MAX_BODY)) {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  if (m_free.size() < m_capacity) {
+			  m_free.push_back(frame);
+			  return;
+		  }
+	  }
+	  delete frame;
+  }
+
+  // --------------------------------------------------
+  size_t FramePool::size()
+  // --------------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return(m_free.size());
+  }
+
+  // STEP 3, for frames whose body is not wanted
+  size_t Frame::skip_body(boost::asio::streambuf& _response)
+  {
+	size_t bytecount = std::min(body_length(_response) + 1, _response.size()); // plus the final NULL
 	_response.consume(bytecount);
 	return(bytecount);
   }
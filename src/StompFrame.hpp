@@ -2,10 +2,16 @@
 #define BOOST_FRAME_HPP
 
 #include <string>
+#include <cstring>
 #include <map>
+#include <vector>
+#include <utility>
+#include <stdint.h>
 #include <iostream>
 #include <sstream>
 #include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -21,12 +27,173 @@ namespace STOMP {
 
   /* STOMP Frame header map */
   typedef map<string, string> hdrmap;
+  // a header given by reference, eg. to BoostStomp::emplace_send()
+  typedef std::pair<boost::string_view, boost::string_view> header_view;
 
   class BoostStomp;
   class Frame;
+  class FrameCodec;
+  template <class Policy> class BasicFrameCodec;
+
+  // codec used when none is given explicitly (STOMP 1.1 rules)
+  const FrameCodec& default_codec();
+
+  // STOMP commands known to the client
+  typedef enum {
+	  CMD_UNKNOWN = 0, // custom command, see BoostStomp::cmd_map
+	  // client commands
+	  CMD_CONNECT,
+	  CMD_STOMP,
+	  CMD_SEND,
+	  CMD_SUBSCRIBE,
+	  CMD_UNSUBSCRIBE,
+	  CMD_ACK,
+	  CMD_NACK,
+	  CMD_BEGIN,
+	  CMD_COMMIT,
+	  CMD_ABORT,
+	  CMD_DISCONNECT,
+	  // server commands
+	  CMD_CONNECTED,
+	  CMD_MESSAGE,
+	  CMD_RECEIPT,
+	  CMD_ERROR,
+	  CMD_COUNT
+  } stomp_command;
+
+  // command names, and the pre-serialized command lines used by the encoder
+  extern const string 	stomp_command_names[CMD_COUNT];
+  extern const string 	stomp_command_lines[CMD_COUNT];
+
+  // recognize a STOMP command without allocating: switch on the length,
+  // then compare against the only candidate(s) of that length
+  inline stomp_command lookup_command(const char* s, size_t len) {
+#define STOMP_CMD_IS(name) (memcmp(s, name, len) == 0)
+	  switch (len) {
+	  case 3:
+		  if (STOMP_CMD_IS("ACK")) return CMD_ACK;
+		  break;
+	  case 4:
+		  if (STOMP_CMD_IS("SEND")) return CMD_SEND;
+		  if (STOMP_CMD_IS("NACK")) return CMD_NACK;
+		  break;
+	  case 5:
+		  if (STOMP_CMD_IS("STOMP")) return CMD_STOMP;
+		  if (STOMP_CMD_IS("BEGIN")) return CMD_BEGIN;
+		  if (STOMP_CMD_IS("ABORT")) return CMD_ABORT;
+		  if (STOMP_CMD_IS("ERROR")) return CMD_ERROR;
+		  break;
+	  case 6:
+		  if (STOMP_CMD_IS("COMMIT")) return CMD_COMMIT;
+		  break;
+	  case 7:
+		  if (STOMP_CMD_IS("CONNECT")) return CMD_CONNECT;
+		  if (STOMP_CMD_IS("MESSAGE")) return CMD_MESSAGE;
+		  if (STOMP_CMD_IS("RECEIPT")) return CMD_RECEIPT;
+		  break;
+	  case 9:
+		  if (STOMP_CMD_IS("SUBSCRIBE")) return CMD_SUBSCRIBE;
+		  if (STOMP_CMD_IS("CONNECTED")) return CMD_CONNECTED;
+		  break;
+	  case 10:
+		  if (STOMP_CMD_IS("DISCONNECT")) return CMD_DISCONNECT;
+		  break;
+	  case 11:
+		  if (STOMP_CMD_IS("UNSUBSCRIBE")) return CMD_UNSUBSCRIBE;
+		  break;
+	  }
+#undef STOMP_CMD_IS
+	  return CMD_UNKNOWN;
+  }
+
+  inline stomp_command lookup_command(const string& s) {
+	  return lookup_command(s.data(), s.size());
+  }
+
+  // commands a server may send us
+  inline bool is_server_command(stomp_command c) {
+	  return (c >= CMD_CONNECTED) && (c < CMD_COUNT);
+  }
+
+  // well-known header names, interned: a received frame indexes them as
+  // its header block is parsed, and finding one is then O(1)
+  typedef enum {
+	  HDR_DESTINATION = 0,
+	  HDR_MESSAGE_ID,
+	  HDR_SUBSCRIPTION,
+	  HDR_CONTENT_LENGTH,
+	  HDR_CONTENT_TYPE,
+	  HDR_ACK,
+	  HDR_ID,
+	  HDR_RECEIPT,
+	  HDR_RECEIPT_ID,
+	  HDR_TRANSACTION,
+	  HDR_VERSION,
+	  HDR_HEART_BEAT,
+	  HDR_MESSAGE, 	// of an ERROR frame
+	  HDR_COUNT,
+	  HDR_UNKNOWN = HDR_COUNT // any other (custom) header
+  } header_atom;
+
+  extern const string 	header_atom_names[HDR_COUNT];
+
+  // intern a header name without allocating, like lookup_command()
+  inline header_atom lookup_header(const char* s, size_t len) {
+#define STOMP_HDR_IS(name) (memcmp(s, name, len) == 0)
+	  switch (len) {
+	  case 2:
+		  if (STOMP_HDR_IS("id")) return HDR_ID;
+		  break;
+	  case 3:
+		  if (STOMP_HDR_IS("ack")) return HDR_ACK;
+		  break;
+	  case 7:
+		  if (STOMP_HDR_IS("receipt")) return HDR_RECEIPT;
+		  if (STOMP_HDR_IS("version")) return HDR_VERSION;
+		  if (STOMP_HDR_IS("message")) return HDR_MESSAGE;
+		  break;
+	  case 10:
+		  if (STOMP_HDR_IS("message-id")) return HDR_MESSAGE_ID;
+		  if (STOMP_HDR_IS("receipt-id")) return HDR_RECEIPT_ID;
+		  if (STOMP_HDR_IS("heart-beat")) return HDR_HEART_BEAT;
+		  break;
+	  case 11:
+		  if (STOMP_HDR_IS("destination")) return HDR_DESTINATION;
+		  if (STOMP_HDR_IS("transaction")) return HDR_TRANSACTION;
+		  break;
+	  case 12:
+		  if (STOMP_HDR_IS("subscription")) return HDR_SUBSCRIPTION;
+		  if (STOMP_HDR_IS("content-type")) return HDR_CONTENT_TYPE;
+		  break;
+	  case 14:
+		  if (STOMP_HDR_IS("content-length")) return HDR_CONTENT_LENGTH;
+		  break;
+	  }
+#undef STOMP_HDR_IS
+	  return HDR_UNKNOWN;
+  }
+
+  // where the well-known headers are in a received header block: the raw
+  // value of each (the first occurrence), and whether it needs unescaping
+  struct HeaderIndex {
+	  uint32_t 	offset[HDR_COUNT];
+	  uint32_t 	length[HDR_COUNT];
+	  uint32_t 	present, escaped; 	// a bit per header_atom
+	  HeaderIndex(): present(0), escaped(0) {};
+	  void clear() { present = escaped = 0; };
+	  bool has(header_atom a) const { return (present >> a) & 1; };
+	  void set(header_atom a, uint32_t off, uint32_t len, bool esc) {
+		  if (has(a)) return; 	// repeated headers: only the first occurrence counts
+		  offset[a] = off;
+		  length[a] = len;
+		  present |= (1u << a);
+		  if (esc) escaped |= (1u << a);
+	  };
+  };
 
   // STOMP server command handler methods
   typedef void (BoostStomp::*pfnStompCommandHandler_t) ( );
+  // handlers for custom (non-standard) server commands
   typedef std::map<string, pfnStompCommandHandler_t> 	stomp_server_command_map_t;
 
   // an std::vector encapsulation in order to store binary strings
@@ -38,15 +205,19 @@ namespace STOMP {
 	  vector<char> v;
 	  // constructors:
 	  binbody() {};
-	  binbody(binbody &other) {
-		  v = other.v;
-	  }
+	  binbody(const binbody &other): v(other.v) {};
+	  binbody(binbody&& other): v(std::move(other.v)) {};
+	  // take over a vector's storage
+	  binbody(vector<char>&& data): v(std::move(data)) {};
 	  binbody(string b) {
 		  v.assign(b.begin(), b.end());
 	  }
 	  binbody(string::iterator begin, string::iterator end) {
 		  v.assign(begin, end);
 	  };
+	  binbody(const char* data, size_t len): v(data, data + len) {};
+	  binbody& operator = (const binbody& other) { v = other.v; return(*this); };
+	  binbody& operator = (binbody&& other) { v = std::move(other.v); return(*this); };
 	  // append a string at the end of the body vector
 	  binbody& operator << (std::string s) {
 		  v.insert(v.end(), s.begin(), s.end());
@@ -68,61 +239,247 @@ namespace STOMP {
   //
   class NoMoreFrames: public boost::exception {};
 
+  // why the client gave up on what it was receiving (see BoostStomp::ReceiveLimits),
+  // or on a transaction it was sending
+  typedef enum {
+	  FRAME_HEADERS_TOO_LARGE = 1, 	// the header block is over max_header_bytes
+	  FRAME_TOO_LARGE, 				// content-length or body over max_frame_bytes
+	  FRAME_BUDGET_EXCEEDED, 		// the read buffer reached max_buffered_bytes
+	  FRAME_MALFORMED, 				// cannot be parsed, eg. a bad content-length
+	  TRANSACTION_ABORTED 			// begun on a connection that was lost
+  } FrameError;
+
+  const boost::system::error_category& frame_category();
+  inline boost::system::error_code make_error_code(FrameError e) {
+	  return boost::system::error_code(int(e), frame_category());
+  }
+
   //
   class Frame {
 	friend class BoostStomp;
+	template <class Policy> friend class BasicFrameCodec;
 
     protected:
-      string    m_command;
-      hdrmap    m_headers;
+      stomp_command m_cmd;
+      string    m_command; // only set for custom commands (m_cmd == CMD_UNKNOWN)
+      mutable hdrmap m_headers; // received frames: filled in on first use
       binbody 	m_body;
+      // received frames start out undecoded: the header block as it came in
+      // (with the codec to decode it, NULL once decoded), and the body as a
+      // slice of the receive buffer until it is copied into m_body
+      mutable string 	m_raw_headers;
+      mutable const FrameCodec* m_raw_codec;
+      HeaderIndex 		m_index; 	// of m_raw_headers, while it is undecoded
+      boost::string_view m_body_view;
+      bool 		m_body_attached;
+
+      // the body size given by content-length, or up to the next NULL
+      size_t body_length(const boost::asio::streambuf&) const;
+
+      void set_command(const string& cmd) {
+    	  m_cmd = lookup_command(cmd);
+    	  if (m_cmd == CMD_UNKNOWN) m_command = cmd;
+      }
 
     public:
 
       // constructors
-      Frame(string cmd):
-    	  m_command(cmd)
+      Frame(stomp_command cmd):
+    	  m_cmd(cmd),
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
       {};
 
-      Frame(string cmd, hdrmap h):
-    	  m_command(cmd),
-    	  m_headers(h)
+      // the headers and body are taken by value: pass them with std::move()
+      // when the caller has no more use for them, and nothing gets copied
+      Frame(stomp_command cmd, hdrmap h):
+    	  m_cmd(cmd),
+    	  m_headers(std::move(h)),
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
       {};
 
       template <typename BodyType>
-      Frame(string cmd, hdrmap h, BodyType b):
-    	  m_command(cmd),
-    	  m_headers(h),
-    	  m_body(b)
+      Frame(stomp_command cmd, hdrmap h, BodyType b):
+    	  m_cmd(cmd),
+    	  m_headers(std::move(h)),
+    	  m_body(std::move(b)),
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
       {};
 
-      // copy constructor
-      Frame(const Frame& other)  {
+      // constructors taking the command by name
+      Frame(string cmd):
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
+      {
+    	  set_command(cmd);
+      };
+
+      Frame(string cmd, hdrmap h):
+    	  m_headers(std::move(h)),
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
+      {
+    	  set_command(cmd);
+      };
+
+      template <typename BodyType>
+      Frame(string cmd, hdrmap h, BodyType b):
+    	  m_headers(std::move(h)),
+    	  m_body(std::move(b)),
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
+      {
+    	  set_command(cmd);
+      };
+
+      // copy constructor (the copy owns its body)
+      Frame(const Frame& other):
+    	  m_raw_codec(NULL),
+    	  m_body_attached(false)
+      {
     	  //cout<<"Frame copy constructor called" <<endl;
+          m_cmd = other.m_cmd;
           m_command = other.m_command;
           m_headers = other.m_headers;
-          m_body = other.m_body;
+          m_raw_headers = other.m_raw_headers;
+          m_raw_codec = other.m_raw_codec;
+          m_index = other.m_index;
+          boost::string_view b = other.body_view();
+          m_body.v.assign(b.begin(), b.end());
       };
 
-      // constructor from a raw streambuf and a STOMP command map
-      Frame(boost::asio::streambuf&, const stomp_server_command_map_t&);
+      // constructor from a raw streambuf and a STOMP command map, see parse_head()
+      Frame(boost::asio::streambuf&, const stomp_server_command_map_t&, const FrameCodec& codec = default_codec());
+      // (re)parse this frame's command and header block from the streambuf,
+      // consuming them. The header lines are only decoded, according to the
+      // given protocol codec, when they are looked at.
+      void parse_head(boost::asio::streambuf&, const stomp_server_command_map_t&, const FrameCodec& codec = default_codec());
       // parse the body from the streambuf, given its size (when==0, parse up to the next NULL)
       size_t parse_body(boost::asio::streambuf&);
+      // the same without copying: the body stays a slice of the streambuf,
+      // which must not be consumed or written to before detach() (or until
+      // the frame is gone). Returns the bytes to consume after that.
+      size_t attach_body(boost::asio::streambuf&);
+      // copy an attached body into the frame, which then owns all of its data
+      void detach();
+      // consume the body from the streambuf without copying it (eg. a duplicate)
+      size_t skip_body(boost::asio::streambuf&);
       //
-      string& 	command()  	{ return m_command; };
-      hdrmap& 	headers()  	{ return m_headers; };
-      binbody& 	body()	 	{ return m_body; };
+      const string& command() const {
+    	  return (m_cmd == CMD_UNKNOWN) ? m_command : stomp_command_names[m_cmd];
+      };
+      stomp_command command_id() const { return m_cmd; };
+      // all the headers (decodes a received frame's header block)
+      hdrmap& 	headers()  	{ decode_headers(); return m_headers; };
+      // look up a single header. Plain values of a received frame are not
+      // decoded nor copied: the view points into the frame's header block.
+      bool 		find_header(boost::string_view key, boost::string_view& value) const;
+      // the same for a well-known header, without comparing names
+      bool 		find_header(header_atom atom, boost::string_view& value) const;
+      // the same, an empty view when the header is missing
+      boost::string_view header(boost::string_view key) const {
+    	  boost::string_view value;
+    	  find_header(key, value);
+    	  return(value);
+      };
+      boost::string_view header(header_atom atom) const {
+    	  boost::string_view value;
+    	  find_header(atom, value);
+    	  return(value);
+      };
+      void 		decode_headers() const;
+      // the body, copied into the frame first if it is still attached
+      binbody& 	body()	 	{ detach(); return m_body; };
+      // the body without copying it
+      boost::string_view body_view() const {
+    	  return m_body_attached ? m_body_view : boost::string_view(m_body.v.data(), m_body.v.size());
+      };
       //
-      string& 	operator[](const char* key) { return m_headers[key]; };
+      string& 	operator[](const char* key) { return headers()[key]; };
       //
       // encode a STOMP Frame into m_request and return it
-      boost::asio::streambuf& encode(boost::asio::streambuf& _request);
+      boost::asio::streambuf& encode(boost::asio::streambuf& _request, const FrameCodec& codec = default_codec());
+      //
+      // turn this frame into a new one, in place: header entries whose key
+      // is set again keep their nodes and string capacity, the body keeps
+      // its capacity. A recycled frame (see FramePool) is rebuilt without
+      // allocating when it carries the same kind of headers.
+      void rebuild(stomp_command cmd, boost::string_view destination,
+    		  const header_view* headers, size_t n, boost::string_view body);
+      // the same, taking the body over
+      void rebuild(stomp_command cmd, boost::string_view destination,
+    		  const header_view* headers, size_t n, binbody&& body);
+      // the same, leaving the body to a BodyWriter
+      void rebuild(stomp_command cmd, boost::string_view destination,
+    		  const header_view* headers, size_t n);
 
   }; // class Frame
 
+  // ----------------------------------------
+  // Writes a frame body in place, eg. a serializer's output, see
+  // BoostStomp::send_with_writer(). The body's memory is reused as it is:
+  // only what grows past its previous size is zero-filled first. The body
+  // gets its final size when the writer goes away.
+  // ----------------------------------------
+  class BodyWriter {
+	  vector<char>& 	m_v;
+	  size_t 			m_size;
+	  BodyWriter(const BodyWriter&);
+	  BodyWriter& operator=(const BodyWriter&);
+  public:
+	  BodyWriter(binbody& body): m_v(body.v), m_size(0) {};
+	  ~BodyWriter() { m_v.resize(m_size); };
+
+	  // room for at least n more bytes, valid until the next prepare():
+	  // write there, then commit() what was written
+	  char* prepare(size_t n) {
+		  if (m_v.size() < m_size + n) m_v.resize(m_size + n);
+		  return(m_v.data() + m_size);
+	  }
+	  void commit(size_t n) { m_size += n; };
+	  void write(const void* data, size_t n) {
+		  if (n > 0) memcpy(prepare(n), data, n);
+		  m_size += n;
+	  }
+	  BodyWriter& operator << (boost::string_view s) { write(s.data(), s.size()); return(*this); };
+	  BodyWriter& operator << (char c) { write(&c, 1); return(*this); };
+	  size_t size() const { return(m_size); };
+  };
+
+  // ----------------------------------------
+  // Frames handed back after they were sent, for rebuilding into new ones
+  // (BoostStomp::emplace_send). Keeps up to capacity SEND frames with bodies
+  // of at most MAX_BODY bytes, anything else is deleted. Thread-safe.
+  // ----------------------------------------
+  class FramePool {
+	  boost::mutex 			m_mutex;
+	  std::vector<Frame*> 	m_free;
+	  size_t 				m_capacity;
+	  FramePool(const FramePool&);
+	  FramePool& operator=(const FramePool&);
+  public:
+	  static const size_t DEFAULT_CAPACITY = 256;
+	  static const size_t MAX_BODY = 64 * 1024;
+
+	  FramePool(size_t capacity = DEFAULT_CAPACITY);
+	  ~FramePool();
+
+	  // a recycled frame, or a new empty SEND frame
+	  Frame* 	acquire();
+	  // takes ownership: keeps the frame for later or deletes it
+	  void 		release(Frame* frame);
+	  size_t 	size();
+  };
+
   string& encode_header_token(string& str);
   string& decode_header_token(string& str);
 
 } // namespace STOMP
 
+namespace boost { namespace system {
+  template <> struct is_error_code_enum<STOMP::FrameError> { static const bool value = true; };
+} }
+
 #endif // BOOST_FRAME_HPP
@@ -0,0 +1,253 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdio>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "StompLog.hpp"
+#include "StompThreads.hpp"
+
+namespace STOMP {
+namespace log {
+
+  // -------------------------------
+  // single producer / single consumer ring, one per logging thread
+  // -------------------------------
+  struct Ring {
+	  static const size_t SLOTS = 256;
+	  Record 				slots[SLOTS];
+	  boost::atomic<size_t> head; 		// next slot to publish (owner thread)
+	  boost::atomic<size_t> tail; 		// next slot to format (formatter thread)
+	  boost::atomic<size_t> dropped; 	// records lost to a full ring
+	  boost::atomic<bool> 	orphaned; 	// owner thread has exited
+	  std::string 			thread_id;
+
+	  Ring(): head(0), tail(0), dropped(0), orphaned(false) {
+		  std::ostringstream os;
+		  os << boost::this_thread::get_id();
+		  thread_id = os.str();
+	  };
+  };
+
+  // thread exit: leave the ring to the formatter, which frees it once drained
+  static void orphan_ring(Ring* r) {
+	  r->orphaned.store(true, boost::memory_order_release);
+  }
+
+  // -------------------------------
+  // the logger: ring registry + background formatter thread
+  // -------------------------------
+  class Logger {
+	  boost::mutex 				m_mutex; 	// guards m_rings (ring creation only)
+	  std::vector<Ring*> 		m_rings;
+	  boost::thread* 			m_formatter;
+	  boost::atomic<bool> 		m_running;
+	  boost::thread_specific_ptr<Ring> m_local;
+	  std::vector<int> 			m_cpus; 	// formatter placement, guarded by m_mutex
+	  boost::atomic<bool> 		m_cpus_changed;
+
+	  static const char* level_name(int l) {
+		  static const char* names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+		  return ((l >= 0) && (l < LOG_NONE)) ? names[l] : "?";
+	  }
+
+	  void format(const Record& r, const Ring& ring) {
+		  time_t secs = r.timestamp_ns / 1000000000ULL;
+		  struct tm tm;
+		  gmtime_r(&secs, &tm);
+		  char ts[32];
+		  snprintf(ts, sizeof(ts), "%02d:%02d:%02d.%06u", tm.tm_hour, tm.tm_min, tm.tm_sec,
+				  unsigned((r.timestamp_ns % 1000000000ULL) / 1000));
+		  boost::format fmt(r.fmt);
+		  fmt.exceptions(boost::io::no_error_bits);
+		  for (int i = 0; i < r.nargs; i++) {
+			  const Arg& a = r.args[i];
+			  switch (a.type) {
+			  case Arg::INT: 	fmt % a.v.i; break;
+			  case Arg::UINT: 	fmt % a.v.u; break;
+			  case Arg::DOUBLE: fmt % a.v.d; break;
+			  case Arg::STR: 	fmt % a.v.s; break;
+			  default: break;
+			  }
+		  }
+		  std::ostream& os = (r.level >= LOG_WARN) ? std::cerr : std::cout;
+		  os << "[" << ts << ": " << ring.thread_id << "] " << level_name(r.level) << " BoostStomp";
+		  if (r.source) os << "(" << r.source << ")";
+		  os << ": " << fmt.str() << "\n";
+	  }
+
+	  // format everything currently published, returns the number of records written
+	  size_t drain() {
+		  size_t count = 0;
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  for (size_t i = 0; i < m_rings.size(); ) {
+			  Ring* ring = m_rings[i];
+			  bool orphaned = ring->orphaned.load(boost::memory_order_acquire);
+			  size_t tail = ring->tail.load(boost::memory_order_relaxed);
+			  size_t head = ring->head.load(boost::memory_order_acquire);
+			  for (; tail != head; tail++, count++)
+				  format(ring->slots[tail % Ring::SLOTS], *ring);
+			  ring->tail.store(tail, boost::memory_order_release);
+			  if (size_t lost = ring->dropped.exchange(0))
+				  std::cerr << "BoostStomp: " << lost << " log records dropped (thread " << ring->thread_id << ")\n";
+			  if (orphaned) {
+				  delete ring;
+				  m_rings.erase(m_rings.begin() + i);
+			  } else {
+				  i++;
+			  }
+		  }
+		  return count;
+	  }
+
+	  void run() {
+		  unsigned idle_us = 50;
+		  while (m_running.load(boost::memory_order_acquire)) {
+			  if (m_cpus_changed.exchange(false)) {
+				  std::vector<int> cpus;
+				  {
+					  boost::mutex::scoped_lock lock(m_mutex);
+					  cpus = m_cpus;
+				  }
+				  if (boost::system::error_code ec = pin_current_thread(cpus))
+					  std::cerr << "BoostStomp: cannot pin the log formatter thread: " << ec.message() << "\n";
+			  }
+			  if (drain() > 0) {
+				  idle_us = 50;
+			  } else {
+				  std::cout.flush();
+				  // back off while idle, up to 10ms
+				  boost::this_thread::sleep(boost::posix_time::microseconds(idle_us));
+				  if (idle_us < 10000) idle_us *= 2;
+			  }
+		  }
+		  drain();
+		  std::cout.flush();
+	  }
+
+  public:
+	  boost::atomic<int> level;
+
+	  Logger(): m_formatter(NULL), m_running(false), m_local(&orphan_ring), m_cpus_changed(false), level(LOG_TRACE) {};
+
+	  ~Logger() {
+		  if (m_formatter) {
+			  m_running = false;
+			  m_formatter->join();
+			  delete m_formatter;
+		  }
+	  }
+
+	  Ring* local_ring() {
+		  Ring* ring = m_local.get();
+		  if (ring == NULL) {
+			  ring = new Ring();
+			  m_local.reset(ring);
+			  boost::mutex::scoped_lock lock(m_mutex);
+			  m_rings.push_back(ring);
+			  if (m_formatter == NULL) {
+				  m_running = true;
+				  m_formatter = new boost::thread(boost::bind(&Logger::run, this));
+			  }
+		  }
+		  return ring;
+	  }
+
+	  // applied by the formatter thread itself, now or when it starts
+	  void set_cpus(const std::vector<int>& cpus) {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  m_cpus = cpus;
+		  m_cpus_changed = true;
+	  }
+
+	  void flush() {
+		  for (int spins = 0; spins < 1000; spins++) {
+			  bool pending = false;
+			  {
+				  boost::mutex::scoped_lock lock(m_mutex);
+				  for (size_t i = 0; i < m_rings.size(); i++)
+					  pending |= (m_rings[i]->tail.load() != m_rings[i]->head.load());
+			  }
+			  if (!pending) break;
+			  boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		  }
+		  std::cout.flush();
+	  }
+  };
+
+  static Logger& logger() {
+	  static Logger the_logger;
+	  return the_logger;
+  }
+
+  // -------------------------------
+  // public interface
+  // -------------------------------
+  void set_level(Level l) {
+	  logger().level.store(l, boost::memory_order_relaxed);
+  }
+
+  bool enabled(Level l) {
+	  return (l >= logger().level.load(boost::memory_order_relaxed));
+  }
+
+  Record* acquire() {
+	  Ring* ring = logger().local_ring();
+	  size_t head = ring->head.load(boost::memory_order_relaxed);
+	  if (head - ring->tail.load(boost::memory_order_acquire) >= Ring::SLOTS) {
+		  ring->dropped.fetch_add(1, boost::memory_order_relaxed);
+		  return NULL;
+	  }
+	  Record* r = &ring->slots[head % Ring::SLOTS];
+	  struct timespec ts;
+	  clock_gettime(CLOCK_REALTIME, &ts);
+	  r->timestamp_ns = uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+	  return r;
+  }
+
+  void publish(Record*) {
+	  // records are published in the order they were acquired, by their owner thread only
+	  Ring* ring = logger().local_ring();
+	  ring->head.fetch_add(1, boost::memory_order_release);
+  }
+
+  void flush() {
+	  logger().flush();
+  }
+
+  void set_formatter_cpus(const std::vector<int>& cpus) {
+	  logger().set_cpus(cpus);
+  }
+
+} // namespace log
+} // namespace STOMP
@@ -0,0 +1,177 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompLog.hpp
+//
+// Low-overhead asynchronous logging.
+//
+// Call sites capture a binary record (timestamp, format string pointer and
+// up to STOMP_LOG_MAX_ARGS raw arguments) into a lock-free ring buffer owned
+// by the calling thread. A single background thread drains all rings,
+// formats the records with boost::format and writes them out, so the IO
+// thread never formats, locks or blocks on stdout.
+//
+// Levels below STOMP_LOG_LEVEL are removed at compile time, arguments
+// included. Builds with DEBUG_STOMP keep TRACE records (one per frame),
+// other builds start at DEBUG. Build with eg. -DSTOMP_LOG_LEVEL=3 to drop
+// everything below WARN.
+//
+
+#ifndef __StompLog_H_
+#define __StompLog_H_
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+
+#include <boost/utility/string_view.hpp>
+
+namespace STOMP {
+namespace log {
+
+	typedef enum {
+		LOG_TRACE = 0,	// per-frame chatter
+		LOG_DEBUG,		// connection lifecycle
+		LOG_INFO,
+		LOG_WARN,
+		LOG_ERROR,
+		LOG_NONE
+	} Level;
+
+#ifndef STOMP_LOG_LEVEL
+# ifdef DEBUG_STOMP
+#  define STOMP_LOG_LEVEL 0
+# else
+#  define STOMP_LOG_LEVEL 1
+# endif
+#endif
+
+#define STOMP_LOG_MAX_ARGS 	4
+#define STOMP_LOG_STR_MAX 	48
+
+	// one captured argument: numbers are stored raw, everything else as a
+	// (possibly truncated) inline string
+	struct Arg {
+		enum { NONE = 0, INT, UINT, DOUBLE, STR } type;
+		union {
+			long long 			i;
+			unsigned long long 	u;
+			double 				d;
+			char 				s[STOMP_LOG_STR_MAX];
+		} v;
+	};
+
+	// one log record, fixed size so that it fits a ring slot
+	struct Record {
+		uint64_t 		timestamp_ns; 	// CLOCK_REALTIME
+		const char* 	fmt; 			// must be a string literal
+		const void* 	source; 		// client instance, or NULL
+		uint8_t 		level;
+		uint8_t 		nargs;
+		Arg 			args[STOMP_LOG_MAX_ARGS];
+	};
+
+	inline void set_arg(Arg& a, const char* s) {
+		a.type = Arg::STR;
+		strncpy(a.v.s, s ? s : "(null)", STOMP_LOG_STR_MAX - 1);
+		a.v.s[STOMP_LOG_STR_MAX - 1] = '\0';
+	}
+	template <size_t N>
+	inline void set_arg(Arg& a, const char (&s)[N]) 	{ set_arg(a, (const char*) s); }
+	inline void set_arg(Arg& a, const std::string& s) 	{ set_arg(a, s.c_str()); }
+	inline void set_arg(Arg& a, boost::string_view s) {
+		a.type = Arg::STR;
+		size_t n = std::min(s.size(), size_t(STOMP_LOG_STR_MAX - 1));
+		memcpy(a.v.s, s.data(), n);
+		a.v.s[n] = '\0';
+	}
+	inline void set_arg(Arg& a, int x) 					{ a.type = Arg::INT; a.v.i = x; }
+	inline void set_arg(Arg& a, long x) 				{ a.type = Arg::INT; a.v.i = x; }
+	inline void set_arg(Arg& a, long long x) 			{ a.type = Arg::INT; a.v.i = x; }
+	inline void set_arg(Arg& a, unsigned int x) 		{ a.type = Arg::UINT; a.v.u = x; }
+	inline void set_arg(Arg& a, unsigned long x) 		{ a.type = Arg::UINT; a.v.u = x; }
+	inline void set_arg(Arg& a, unsigned long long x) 	{ a.type = Arg::UINT; a.v.u = x; }
+	inline void set_arg(Arg& a, double x) 				{ a.type = Arg::DOUBLE; a.v.d = x; }
+	// anything else that can be streamed (endpoints, error codes, thread ids...)
+	template <typename T>
+	inline void set_arg(Arg& a, const T& x) {
+		std::ostringstream os;
+		os << x;
+		set_arg(a, os.str());
+	}
+
+	// runtime threshold (defaults to STOMP_LOG_LEVEL)
+	void 	set_level(Level l);
+	bool 	enabled(Level l);
+
+	// reserve / publish a record in the calling thread's ring.
+	// acquire() returns NULL when the ring is full (the record is dropped and counted)
+	Record* acquire();
+	void 	publish(Record* r);
+
+	// block until every record published so far has been written out
+	void 	flush();
+
+	// restrict the background formatter thread to these CPUs (empty: any),
+	// eg. away from the cores the IO threads are pinned to
+	void 	set_formatter_cpus(const std::vector<int>& cpus);
+
+	inline void fill(Record*, int) {}
+	template <typename T, typename... Rest>
+	inline void fill(Record* r, int i, const T& first, const Rest&... rest) {
+		if (i < STOMP_LOG_MAX_ARGS) {
+			set_arg(r->args[i], first);
+			r->nargs = i + 1;
+			fill(r, i + 1, rest...);
+		}
+	}
+
+	template <typename... Args>
+	void write(Level level, const void* source, const char* fmt, const Args&... args) {
+		if (Record* r = acquire()) {
+			r->fmt = fmt;
+			r->source = source;
+			r->level = level;
+			r->nargs = 0;
+			fill(r, 0, args...);
+			publish(r);
+		}
+	}
+
+} // namespace log
+} // namespace STOMP
+
+// Log a record when 'cond' holds. Compiles to nothing for levels below STOMP_LOG_LEVEL.
+#define STOMP_LOG_IF(cond, level, source, ...) \
+	do { \
+		if (((level) >= STOMP_LOG_LEVEL) && (cond) && ::STOMP::log::enabled(level)) \
+			::STOMP::log::write((level), (source), __VA_ARGS__); \
+	} while (0)
+
+#define STOMP_LOG(level, ...) 	STOMP_LOG_IF(true, (level), NULL, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+
+#include "StompReactor.hpp"
+#include "StompLog.hpp"
+
+namespace STOMP {
+
+  const int TimerWheel::SLOT_BITS;
+  const int TimerWheel::SLOTS;
+  const int TimerWheel::LEVELS;
+  const uint64_t TimerWheel::NEVER;
+  const unsigned StompReactor::DEFAULT_TICK_MS;
+
+  // ------------------------------------------
+  TimerWheel::TimerWheel(uint64_t now):
+  // ------------------------------------------
+	  m_now(now),
+	  m_wakeup(NEVER),
+	  m_next_id(1)
+  {
+	  for (int l = 0; l < LEVELS; l++)
+		  for (int s = 0; s < SLOTS; s++)
+			  m_slots[l][s] = NULL;
+  }
+
+  // ------------------------------------------
+  TimerWheel::~TimerWheel()
+  // ------------------------------------------
+  {
+	  for (boost::unordered_map<timer_id, Node*>::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
+		  delete it->second;
+  }
+
+  // ------------------------------------------
+  void TimerWheel::insert(Node* node)
+  // ------------------------------------------
+  {
+	  // the level whose turn covers the distance; farther than the top level
+	  // reaches, wait in its last slot and go round once more
+	  uint64_t delta = node->expiry - m_now;
+	  uint64_t target = node->expiry;
+	  int level = 0;
+	  while ((level < LEVELS - 1) && (delta >> (SLOT_BITS * (level + 1))) != 0) level++;
+	  if ((delta >> (SLOT_BITS * LEVELS)) != 0) target = m_now + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+	  Node** slot = &m_slots[level][(target >> (SLOT_BITS * level)) & (SLOTS - 1)];
+	  node->prev = NULL;
+	  node->next = *slot;
+	  if (*slot) (*slot)->prev = node;
+	  *slot = node;
+	  node->slot = slot;
+  }
+
+  // ------------------------------------------
+  void TimerWheel::unlink(Node* node)
+  // ------------------------------------------
+  {
+	  if (node->prev) node->prev->next = node->next;
+	  else *node->slot = node->next;
+	  if (node->next) node->next->prev = node->prev;
+  }
+
+  // ------------------------------------------
+  void TimerWheel::cascade(int level)
+  // ------------------------------------------
+  {
+	  // the wheel below came round: spread the slot of this turn over it
+	  Node** slot = &m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+	  Node* node = *slot;
+	  *slot = NULL;
+	  while (node) {
+		  Node* next = node->next;
+		  insert(node);
+		  node = next;
+	  }
+  }
+
+  // ------------------------------------------
+  TimerWheel::timer_id TimerWheel::schedule(uint64_t expiry, const handler_t& handler, bool& earlier)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  Node* node = new Node();
+	  node->id = m_next_id++;
+	  node->expiry = std::max(expiry, m_now + 1); 	// tick m_now has run
+	  node->handler = handler;
+	  insert(node);
+	  m_timers[node->id] = node;
+	  earlier = (node->expiry < m_wakeup);
+	  if (earlier) m_wakeup = node->expiry;
+	  return node->id;
+  }
+
+  // ------------------------------------------
+  bool TimerWheel::cancel(timer_id id, handler_t* handler)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  boost::unordered_map<timer_id, Node*>::iterator it = m_timers.find(id);
+	  if (it == m_timers.end()) return false;
+	  if (handler) handler->swap(it->second->handler);
+	  unlink(it->second);
+	  delete it->second;
+	  m_timers.erase(it);
+	  return true;
+  }
+
+  // ------------------------------------------
+  uint64_t TimerWheel::advance(uint64_t now)
+  // ------------------------------------------
+  {
+	  std::vector<handler_t> due;
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  if (m_timers.empty() && (now > m_now)) m_now = now;
+		  while (m_now < now) {
+			  m_now++;
+			  // top down, so that what comes down a level is cascaded on
+			  int top = 0;
+			  while ((top < LEVELS - 1) && ((m_now & ((uint64_t(1) << (SLOT_BITS * (top + 1))) - 1)) == 0)) top++;
+			  for (int level = top; level > 0; level--) cascade(level);
+			  Node** slot = &m_slots[0][m_now & (SLOTS - 1)];
+			  for (Node* node = *slot; node; ) {
+				  Node* next = node->next;
+				  due.push_back(node->handler);
+				  m_timers.erase(node->id);
+				  delete node;
+				  node = next;
+			  }
+			  *slot = NULL;
+		  }
+		  m_wakeup = next_wakeup();
+	  }
+	  for (size_t i = 0; i < due.size(); i++) due[i](boost::system::error_code());
+	  return m_wakeup;
+  }
+
+  // ------------------------------------------
+  uint64_t TimerWheel::next_wakeup() const
+  // ------------------------------------------
+  {
+	  // the next busy slot of the lowest wheel, or its next cascade: a wheel
+	  // holding only distant timers wakes up once per turn of the lowest one
+	  if (m_timers.empty()) return NEVER;
+	  for (uint64_t t = m_now + 1; ; t++)
+		  if (((t & (SLOTS - 1)) == 0) || m_slots[0][t & (SLOTS - 1)]) return t;
+  }
+
+  // ------------------------------------------
+  uint64_t TimerWheel::wakeup() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_wakeup;
+  }
+
+  // ------------------------------------------
+  uint64_t TimerWheel::now() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_now;
+  }
+
+  // ------------------------------------------
+  size_t TimerWheel::size() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_timers.size();
+  }
+
+  // ------------------------------------------
+  StompReactor::StompReactor(size_t threads, const ThreadOptions& options, unsigned tick_ms):
+  // ------------------------------------------
+	  m_options(options),
+	  m_tick(std::max(tick_ms, 1u)),
+	  m_epoch(std::chrono::steady_clock::now())
+  {
+	  if (threads == 0) threads = std::max(boost::thread::hardware_concurrency(), 1u);
+	  for (size_t i = 0; i < threads; i++) {
+		  Thread* t = new Thread();
+		  t->io.reset(new boost::asio::io_service());
+		  t->work.reset(new boost::asio::io_service::work(*t->io));
+		  t->driver.reset(new boost::asio::steady_timer(*t->io));
+		  t->options = options;
+		  if (!options.io_cpus.empty())
+			  t->options.io_cpus = CpuSet(1, options.io_cpus[i % options.io_cpus.size()]);
+		  t->thread.reset(new boost::thread(boost::bind(&StompReactor::run, this, t)));
+		  t->id = t->thread->get_id();
+		  m_threads.push_back(t);
+	  }
+  }
+
+  // ------------------------------------------
+  StompReactor::~StompReactor()
+  // ------------------------------------------
+  {
+	  for (size_t i = 0; i < m_threads.size(); i++)
+		  m_threads[i]->io->stop();
+	  for (size_t i = 0; i < m_threads.size(); i++) {
+		  m_threads[i]->thread->join();
+		  delete m_threads[i];
+	  }
+  }
+
+  // ------------------------------------------
+  void StompReactor::run(Thread* t)
+  // ------------------------------------------
+  {
+	  if (!t->options.io_cpus.empty()) {
+		  boost::system::error_code ec = pin_current_thread(t->options.io_cpus);
+		  STOMP_LOG_IF(ec, ::STOMP::log::LOG_WARN, NULL, "reactor: cannot pin an IO thread to CPU %1%: %2%",
+				  format_cpu_set(t->options.io_cpus), ec.message());
+	  }
+	  run_io_service(*t->io, t->options, t->sleeps);
+  }
+
+  // ------------------------------------------
+  size_t StompReactor::attach()
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_attach_mutex);
+	  size_t best = 0;
+	  for (size_t i = 1; i < m_threads.size(); i++)
+		  if (m_threads[i]->clients < m_threads[best]->clients) best = i;
+	  m_threads[best]->clients++;
+	  return best;
+  }
+
+  // ------------------------------------------
+  void StompReactor::detach(size_t thread)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_attach_mutex);
+	  m_threads[thread]->clients--;
+  }
+
+  // ------------------------------------------
+  size_t StompReactor::clients(size_t thread) const
+  // ------------------------------------------
+  {
+	  return m_threads[thread]->clients;
+  }
+
+  // ------------------------------------------
+  boost::shared_ptr<boost::asio::io_service> StompReactor::io_service(size_t thread) const
+  // ------------------------------------------
+  {
+	  return m_threads[thread]->io;
+  }
+
+  // ------------------------------------------
+  bool StompReactor::on_thread(size_t thread) const
+  // ------------------------------------------
+  {
+	  return (boost::this_thread::get_id() == m_threads[thread]->id);
+  }
+
+  // ------------------------------------------
+  uint64_t StompReactor::now_tick() const
+  // ------------------------------------------
+  {
+	  return (std::chrono::steady_clock::now() - m_epoch) / m_tick;
+  }
+
+  // ------------------------------------------
+  TimerWheel::timer_id StompReactor::schedule(size_t thread, const boost::posix_time::time_duration& delay,
+		  const TimerWheel::handler_t& handler)
+  // ------------------------------------------
+  {
+	  // never early: round up to the next tick
+	  Thread* t = m_threads[thread];
+	  std::chrono::microseconds due = std::chrono::duration_cast<std::chrono::microseconds>(
+			  std::chrono::steady_clock::now() - m_epoch) + std::chrono::microseconds(delay.total_microseconds());
+	  std::chrono::microseconds tick(m_tick);
+	  uint64_t expiry = (due.count() + tick.count() - 1) / tick.count();
+	  bool earlier;
+	  TimerWheel::timer_id id = t->wheel.schedule(expiry, handler, earlier);
+	  if (earlier) t->io->post(boost::bind(&StompReactor::rearm, this, t));
+	  return id;
+  }
+
+  // ------------------------------------------
+  bool StompReactor::cancel(size_t thread, TimerWheel::timer_id id)
+  // ------------------------------------------
+  {
+	  // the wakeup stays armed, it finds nothing to do. The handler runs
+	  // later on the thread, as a cancelled deadline_timer's would.
+	  Thread* t = m_threads[thread];
+	  TimerWheel::handler_t handler;
+	  if (!t->wheel.cancel(id, &handler)) return false;
+	  t->io->post(boost::bind(handler, boost::system::error_code(boost::asio::error::operation_aborted)));
+	  return true;
+  }
+
+  // ------------------------------------------
+  size_t StompReactor::timers(size_t thread) const
+  // ------------------------------------------
+  {
+	  return m_threads[thread]->wheel.size();
+  }
+
+  // ------------------------------------------
+  uint64_t StompReactor::io_sleeps() const
+  // ------------------------------------------
+  {
+	  uint64_t n = 0;
+	  for (size_t i = 0; i < m_threads.size(); i++) n += m_threads[i]->sleeps;
+	  return n;
+  }
+
+  // ------------------------------------------
+  void StompReactor::rearm(Thread* t)
+  // ------------------------------------------
+  {
+	  // IO thread only. A wait in progress is cancelled. Arms to the wheel's
+	  // wakeup as it is now, not as it was when the rearm was posted: a tick
+	  // may have run in between and planned an earlier one.
+	  uint64_t wakeup = t->wheel.wakeup();
+	  if (wakeup == TimerWheel::NEVER) return;
+	  t->driver->expires_at(m_epoch + wakeup * m_tick);
+	  t->driver->async_wait(boost::bind(&StompReactor::handle_tick, this, t, boost::asio::placeholders::error));
+  }
+
+  // ------------------------------------------
+  void StompReactor::handle_tick(Thread* t, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  if (ec == boost::asio::error::operation_aborted) return;
+	  t->wheel.advance(now_tick());
+	  rearm(t);
+  }
+
+  // ------------------------------------------
+  SessionTimer::SessionTimer(boost::asio::io_service& io, StompReactor* reactor, size_t thread):
+  // ------------------------------------------
+	  m_reactor(reactor),
+	  m_thread(thread),
+	  m_timer(reactor ? NULL : new boost::asio::deadline_timer(io)),
+	  m_id(0),
+	  m_alive(new bool(true))
+  {
+  }
+
+  // ------------------------------------------
+  void SessionTimer::complete(const boost::weak_ptr<bool>& alive, const handler_t& handler,
+		  const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  // an aborted wait may only run after its owner tore the timer down
+	  if (alive.lock()) handler(ec);
+  }
+
+  // ------------------------------------------
+  void SessionTimer::async_wait(const boost::posix_time::time_duration& delay, const handler_t& handler)
+  // ------------------------------------------
+  {
+	  if (m_timer) {
+		  m_timer->expires_from_now(delay);
+		  m_timer->async_wait(handler);
+		  return;
+	  }
+	  cancel();
+	  m_id = m_reactor->schedule(m_thread, delay, boost::bind(&SessionTimer::complete,
+			  boost::weak_ptr<bool>(m_alive), handler, boost::asio::placeholders::error));
+  }
+
+  // ------------------------------------------
+  void SessionTimer::cancel()
+  // ------------------------------------------
+  {
+	  if (m_timer) {
+		  m_timer->cancel();
+		  return;
+	  }
+	  TimerWheel::timer_id id = m_id.exchange(0);
+	  if (id) m_reactor->cancel(m_thread, id);
+  }
+
+} // namespace STOMP
@@ -0,0 +1,208 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//	StompReactor.hpp
+//
+// Many clients, few threads. A StompReactor runs a fixed pool of IO threads,
+// each with an io_service of its own. A client created on a reactor is bound
+// to one of them for its whole life (the least loaded one when it is
+// created), so its socket, buffers and strand stay with one thread and its
+// caches. The thread runs any number of clients.
+//
+// The one-shot timers of the hosted clients (heartbeats, reconnect backoff,
+// failback checks) are entries in a hierarchical timer wheel per thread,
+// driven by a single timer, instead of a deadline_timer each.
+//
+
+#ifndef __StompReactor_H_
+#define __StompReactor_H_
+
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "StompThreads.hpp"
+
+namespace STOMP {
+
+  // ----------------------------------------
+  // Hierarchical timer wheel: LEVELS wheels of SLOTS slots, each slot of a
+  // level spanning a whole turn of the level below. Timers go to the level
+  // of their distance from now, and move down a level (cascade) when the
+  // wheel below comes round to them. Scheduling and cancelling are O(1),
+  // whatever the number of timers. Time is in ticks, it is up to the owner
+  // to say what a tick is and to call advance() on time. Thread-safe;
+  // handlers run in the thread calling advance(), without the lock held,
+  // with a success error_code. cancel() hands the handler back instead.
+  // ----------------------------------------
+  class TimerWheel : boost::noncopyable {
+  public:
+	  typedef uint64_t 					timer_id; 	// never reused, 0 is no timer
+	  typedef boost::function<void(const boost::system::error_code&)> handler_t;
+	  static const int 		SLOT_BITS = 6;
+	  static const int 		SLOTS = 1 << SLOT_BITS;
+	  static const int 		LEVELS = 4; 	// 2^24 ticks ahead, later timers wait at the top
+	  static const uint64_t NEVER = ~uint64_t(0);
+
+	  TimerWheel(uint64_t now = 0);
+	  ~TimerWheel();
+
+	  // run handler at tick expiry (the next tick at the earliest). Sets
+	  // earlier when the timer is due before the wakeup advance() asked for.
+	  timer_id 	schedule(uint64_t expiry, const handler_t& handler, bool& earlier);
+	  // false when the timer ran already (or is running). Otherwise its
+	  // handler goes to *handler, if given, for the caller to complete
+	  bool 		cancel(timer_id id, handler_t* handler = NULL);
+	  // run the timers due up to tick now, returns the tick of the next call
+	  uint64_t 	advance(uint64_t now);
+	  // the tick the owner must wake up at (NEVER when idle)
+	  uint64_t 	wakeup() const;
+
+	  uint64_t 	now() const;
+	  size_t 	size() const;
+
+  private:
+	  struct Node {
+		  timer_id 	id;
+		  uint64_t 	expiry;
+		  handler_t handler;
+		  Node 		*prev, *next;
+		  Node** 	slot; 	// the head of its list
+	  };
+	  mutable boost::mutex 	m_mutex;
+	  uint64_t 				m_now; 		// ticks up to here have run
+	  uint64_t 				m_wakeup; 	// the next advance() the owner plans
+	  timer_id 				m_next_id;
+	  Node* 				m_slots[LEVELS][SLOTS];
+	  boost::unordered_map<timer_id, Node*> m_timers;
+
+	  void 		insert(Node* node);
+	  void 		unlink(Node* node);
+	  void 		cascade(int level);
+	  uint64_t 	next_wakeup() const;
+  };
+
+  // ----------------------------------------
+  // The IO thread pool. Destroy the clients before their reactor.
+  // ----------------------------------------
+  class StompReactor : boost::noncopyable {
+  public:
+	  static const unsigned DEFAULT_TICK_MS = 10;
+
+	  // threads: 0 for one per CPU. options apply to every thread, except
+	  // that with io_cpus the threads are spread over the set one CPU each.
+	  StompReactor(size_t threads = 0, const ThreadOptions& options = ThreadOptions(),
+			  unsigned tick_ms = DEFAULT_TICK_MS);
+	  // stops the threads and waits for them
+	  ~StompReactor();
+
+	  size_t 	threads() const { return m_threads.size(); };
+	  const ThreadOptions& options() const { return m_options; };
+
+	  // a thread for a new client, the one with the fewest; and back
+	  size_t 	attach();
+	  void 		detach(size_t thread);
+	  size_t 	clients(size_t thread) const;
+
+	  boost::shared_ptr<boost::asio::io_service> io_service(size_t thread) const;
+	  // is the caller the IO thread thread?
+	  bool 		on_thread(size_t thread) const;
+
+	  // one-shot timers on the wheel of a thread: handler runs in that thread,
+	  // like a deadline_timer's, with operation_aborted if cancelled
+	  TimerWheel::timer_id schedule(size_t thread, const boost::posix_time::time_duration& delay,
+			  const TimerWheel::handler_t& handler);
+	  bool 		cancel(size_t thread, TimerWheel::timer_id id);
+	  size_t 	timers(size_t thread) const;
+	  // times a spinning thread went to sleep, all threads
+	  uint64_t 	io_sleeps() const;
+
+  private:
+	  struct Thread {
+		  boost::shared_ptr<boost::asio::io_service> 	io;
+		  boost::scoped_ptr<boost::asio::io_service::work> work;
+		  boost::scoped_ptr<boost::asio::steady_timer> 	driver; 	// advances the wheel
+		  TimerWheel 				wheel;
+		  ThreadOptions 			options;
+		  boost::atomic<uint64_t> 	sleeps;
+		  boost::atomic<size_t> 	clients;
+		  boost::thread::id 		id;
+		  boost::scoped_ptr<boost::thread> thread;
+		  Thread(): sleeps(0), clients(0) {};
+	  };
+	  ThreadOptions 			m_options;
+	  std::chrono::milliseconds m_tick;
+	  std::chrono::steady_clock::time_point m_epoch; 	// tick 0
+	  std::vector<Thread*> 		m_threads;
+	  boost::mutex 				m_attach_mutex;
+
+	  uint64_t 	now_tick() const;
+	  void 		run(Thread* t);
+	  void 		rearm(Thread* t);
+	  void 		handle_tick(Thread* t, const boost::system::error_code& ec);
+  };
+
+  // ----------------------------------------
+  // A one-shot timer of a client: a deadline_timer on its own io_service,
+  // or an entry in the timer wheel of the reactor hosting it. Either way a
+  // cancelled wait completes with operation_aborted, unless the timer is
+  // gone by the time it would run.
+  // ----------------------------------------
+  class SessionTimer : boost::noncopyable {
+	  StompReactor* 		m_reactor;
+	  size_t 				m_thread;
+	  boost::scoped_ptr<boost::asio::deadline_timer> m_timer; 	// not on a reactor
+	  boost::atomic<TimerWheel::timer_id> m_id;
+	  boost::shared_ptr<bool> m_alive; 	// expires with the timer
+  public:
+	  typedef boost::function<void(const boost::system::error_code&)> handler_t;
+
+	  SessionTimer(boost::asio::io_service& io, StompReactor* reactor, size_t thread);
+
+	  // cancels the previous wait
+	  void 		async_wait(const boost::posix_time::time_duration& delay, const handler_t& handler);
+	  void 		cancel();
+
+  private:
+	  static void complete(const boost::weak_ptr<bool>& alive, const handler_t& handler,
+			  const boost::system::error_code& ec);
+  };
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//
+// StompReplay.cpp: plays a wire capture back through a BoostStomp client
+//
+// The bytes the client once read from its broker are written into one end
+// of a PairTransport, so they go through the real read actor, Frame parser
+// and dispatch path; what the client writes back is read and dropped. The
+// client subscribes to every destination found in the capture, so MESSAGE
+// frames reach a callback. Runs at full speed (a deterministic benchmark)
+// or with the captured pacing, and prints the result as a JSON object.
+//
+
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "BoostStomp.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec);
+}
+
+// -------------------------------
+// replay configuration
+// -------------------------------
+struct ReplayConfig {
+	string 		file;
+	bool 		paced; 		// keep the captured gaps between reads
+	double 		speed; 		// ... divided by this
+	int 		loops;
+	AckMode 	ackmode;
+	string 		ackmode_name;
+	string 		version; 	// of the CONNECTED made up for a capture without one
+	bool 		dump; 		// list the records instead
+	bool 		hex; 		// ... with their payload
+	int 		timeout;
+};
+
+// a piece of inbound traffic, as one read returned it
+struct Chunk {
+	uint64_t 	timestamp_ns;
+	size_t 		end; 	// offset just past it in the inbound stream
+};
+
+static ReplayConfig 				cfg;
+static boost::atomic<uint64_t> 		rcvd_msgs(0), rcvd_bytes(0);
+
+// -------------------------------------------------------
+// MESSAGE callback
+// -------------------------------------------------------
+bool replay_callback(Frame* _frame) {
+	rcvd_bytes += _frame->body().v.size();
+	rcvd_msgs++;
+	return(true);
+}
+
+static const char* record_type_name(CaptureRecordType t) {
+	static const char* names[] = { "IN", "OUT", "OPEN", "PAD" };
+	return names[t];
+}
+
+// -------------------------------------------------------
+// --dump: one line per record, the payload's first line (or all of it in hex)
+// -------------------------------------------------------
+static void dump(CaptureReader& reader) {
+	const CaptureFileHeader& h = reader.header();
+	cout << "# " << cfg.file << ": " << h.records << " records written, ring of " << h.capacity << " bytes" << endl;
+	CaptureReader::Record r;
+	uint64_t first = 0;
+	cout.setf(ios::fixed);
+	cout.precision(6);
+	while (reader.next(r)) {
+		if (first == 0) first = r.timestamp_ns;
+		cout << "+" << (r.timestamp_ns - first) / 1e9 << " " << record_type_name(r.type) << " " << r.length;
+		size_t n = 0;
+		while ((n < r.length) && (n < 60) && (r.data[n] != '\n') && (r.data[n] != '\0')) n++;
+		if (n > 0) cout << " " << string(r.data, n);
+		cout << endl;
+		if (cfg.hex && (r.length > 0)) {
+			cout.flush();
+			hexdump(r.data, r.length);
+		}
+	}
+}
+
+// -------------------------------------------------------
+// collect what the client read, from the first connection captured on
+// -------------------------------------------------------
+static size_t load_inbound(CaptureReader& reader, string& inbound, vector<Chunk>& chunks) {
+	CaptureReader::Record r;
+	bool seen_open = false;
+	while (reader.next(r)) seen_open = seen_open || (r.type == CAPTURE_OPEN);
+	reader.rewind();
+	size_t sessions = 0;
+	bool recording = !seen_open;
+	while (reader.next(r)) {
+		if (r.type == CAPTURE_OPEN) {
+			recording = true;
+			sessions++;
+		} else if (recording && (r.type == CAPTURE_IN)) {
+			inbound.append(r.data, r.length);
+			Chunk c = { r.timestamp_ns, inbound.size() };
+			chunks.push_back(c);
+		}
+	}
+	if (!seen_open && !inbound.empty()) {
+		// the ring wrapped past the start of the connection: resume after the
+		// first frame end and make up the CONNECTED frame
+		size_t nul = inbound.find('\0');
+		size_t skip = (nul == string::npos) ? inbound.size() : nul + 1;
+		string connected = "CONNECTED\nversion:" + cfg.version + "\n\n";
+		connected += '\0';
+		inbound = connected + inbound.substr(skip);
+		for (size_t i = 0; i < chunks.size(); i++)
+			chunks[i].end = connected.size() + ((chunks[i].end > skip) ? (chunks[i].end - skip) : 0);
+		cerr << "stompreplay: no connection start in the capture, skipped " << skip << " bytes" << endl;
+	}
+	return sessions;
+}
+
+// is there a whole header block (up to a blank line) at offset?
+static bool has_headers(const string& s, size_t offset) {
+	for (size_t i = s.find('\n', offset); i != string::npos; i = s.find('\n', i + 1)) {
+		size_t j = i + 1;
+		if ((j < s.size()) && (s[j] == '\r')) j++;
+		if ((j < s.size()) && (s[j] == '\n')) return true;
+	}
+	return false;
+}
+
+// -------------------------------------------------------
+// walk the inbound stream with the Frame parser: count the complete frames,
+// note the MESSAGE destinations. Returns the length of the complete part.
+// -------------------------------------------------------
+static size_t scan_frames(const string& inbound, uint64_t& frames, set<string>& destinations) {
+	boost::asio::streambuf sb;
+	sb.sputn(inbound.data(), inbound.size());
+	stomp_server_command_map_t no_custom_commands;
+	// as the client, parse with the 1.2 rules until CONNECTED says otherwise
+	const FrameCodec* codec = &FrameCodec::for_version(STOMP_1_2);
+	size_t complete = 0;
+	frames = 0;
+	while (true) {
+		// heartbeats
+		while ((sb.size() > 0) && ((*boost::asio::buffer_cast<const char*>(sb.data()) == '\n') ||
+				(*boost::asio::buffer_cast<const char*>(sb.data()) == '\r'))) sb.consume(1);
+		complete = inbound.size() - sb.size();
+		if (!has_headers(inbound, complete)) break;
+		try {
+			Frame frame(sb, no_custom_commands, *codec);
+			hdrmap& headers = frame.headers();
+			hdrmap::iterator cl = headers.find("content-length");
+			const char* body = boost::asio::buffer_cast<const char*>(sb.data());
+			if (cl != headers.end()) {
+				if (sb.size() < lexical_cast<size_t>(cl->second) + 1) break;
+			} else if (memchr(body, '\0', sb.size()) == NULL) {
+				break;
+			}
+			frame.parse_body(sb);
+			frames++;
+			if (frame.command_id() == CMD_CONNECTED) codec = &FrameCodec::for_version(headers["version"]);
+			if ((frame.command_id() == CMD_MESSAGE) && (headers.find("destination") != headers.end()))
+				destinations.insert(headers["destination"]);
+		} catch (NoMoreFrames&) {
+			break;
+		}
+	}
+	return complete;
+}
+
+// -------------------------------------------------------
+// the broker end: read whatever the client sends, until it closes
+// -------------------------------------------------------
+static void drain_peer(Transport::socket_type* peer, boost::atomic<uint64_t>* bytes) {
+	char buf[65536];
+	boost::system::error_code ec;
+	while (!ec) *bytes += peer->read_some(boost::asio::buffer(buf), ec);
+}
+
+static void usage() {
+	cerr << "usage: stompreplay [options] CAPTURE" << endl
+		 << "  -p, --paced              keep the captured timing between reads" << endl
+		 << "  -S, --speed F            paced replay F times faster (1)" << endl
+		 << "  -l, --loops N            play the capture N times (1)" << endl
+		 << "  -a, --ack MODE           auto|client|client-individual (auto)" << endl
+		 << "  -V, --version V          STOMP version when the capture misses CONNECTED (1.2)" << endl
+		 << "  -t, --timeout S          seconds to wait for the client to catch up (30)" << endl
+		 << "  -d, --dump               list the records instead of replaying them" << endl
+		 << "  -x, --hex                with --dump, hexdump every payload" << endl;
+	exit(1);
+}
+
+static void parse_args(int argc, char *argv[]) {
+	cfg.paced = false;		cfg.speed = 1;		cfg.loops = 1;
+	cfg.ackmode = ACK_AUTO;	cfg.ackmode_name = "auto";
+	cfg.version = "1.2";	cfg.dump = false;	cfg.hex = false;	cfg.timeout = 30;
+	static struct option longopts[] = {
+		{"paced", no_argument, 0, 'p'}, 			{"speed", required_argument, 0, 'S'},
+		{"loops", required_argument, 0, 'l'}, 		{"ack", required_argument, 0, 'a'},
+		{"version", required_argument, 0, 'V'}, 	{"timeout", required_argument, 0, 't'},
+		{"dump", no_argument, 0, 'd'}, 				{"hex", no_argument, 0, 'x'},
+		{"help", no_argument, 0, 'h'},				{0, 0, 0, 0}
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "pS:l:a:V:t:dxh", longopts, NULL)) != -1) {
+		switch (c) {
+		case 'p': cfg.paced = true; break;
+		case 'S': cfg.speed = atof(optarg); cfg.paced = true; break;
+		case 'l': cfg.loops = atoi(optarg); break;
+		case 'a':
+			cfg.ackmode_name = optarg;
+			if 		(cfg.ackmode_name == "auto") 				cfg.ackmode = ACK_AUTO;
+			else if (cfg.ackmode_name == "client") 				cfg.ackmode = ACK_CLIENT;
+			else if (cfg.ackmode_name == "client-individual") 	cfg.ackmode = ACK_CLIENT_INDIVIDUAL;
+			else usage();
+			break;
+		case 'V': cfg.version = optarg; break;
+		case 't': cfg.timeout = atoi(optarg); break;
+		case 'd': cfg.dump = true; break;
+		case 'x': cfg.hex = true; break;
+		default: usage();
+		}
+	}
+	if ((optind != argc - 1) || (cfg.loops < 1) || (cfg.speed <= 0)) usage();
+	cfg.file = argv[optind];
+}
+
+// -----------------------------------------
+int main(int argc, char *argv[]) {
+// -----------------------------------------
+	parse_args(argc, argv);
+
+	string inbound;
+	vector<Chunk> chunks;
+	size_t sessions = 0;
+	try {
+		CaptureReader reader(cfg.file);
+		if (cfg.dump) {
+			dump(reader);
+			return 0;
+		}
+		sessions = load_inbound(reader, inbound, chunks);
+	} catch (std::exception& e) {
+		cerr << "stompreplay: " << e.what() << endl;
+		return 2;
+	}
+	uint64_t frames = 0;
+	set<string> destinations;
+	size_t complete = scan_frames(inbound, frames, destinations);
+	if (complete < inbound.size()) {
+		cerr << "stompreplay: dropping " << (inbound.size() - complete) << " bytes of an incomplete last frame" << endl;
+		inbound.resize(complete);
+	}
+
+	// the client end
+	boost::shared_ptr<PairTransport> pair(new PairTransport());
+	BoostStomp client(pair, cfg.ackmode);
+	for (set<string>::iterator it = destinations.begin(); it != destinations.end(); it++) {
+		string topic = *it;
+		client.subscribe(topic, &replay_callback);
+	}
+	// the broker end
+	boost::asio::io_service peer_io;
+	Transport::socket_type peer(peer_io);
+	pair->assign_peer(peer);
+	boost::atomic<uint64_t> written_back(0);
+	boost::thread drainer(boost::bind(&drain_peer, &peer, &written_back));
+
+	client.start();
+	uint64_t t_start = now_ns();
+	boost::system::error_code ec;
+	for (int loop = 0; (loop < cfg.loops) && !ec; loop++) {
+		if (!cfg.paced) {
+			boost::asio::write(peer, boost::asio::buffer(inbound), ec);
+			continue;
+		}
+		uint64_t t_loop = now_ns();
+		size_t begin = 0;
+		for (size_t i = 0; (i < chunks.size()) && (begin < inbound.size()) && !ec; i++) {
+			uint64_t due = t_loop + uint64_t((chunks[i].timestamp_ns - chunks[0].timestamp_ns) / cfg.speed), t = now_ns();
+			if (due > t) usleep((due - t) / 1000);
+			size_t end = std::min(chunks[i].end, inbound.size());
+			if (end > begin) boost::asio::write(peer, boost::asio::buffer(inbound.data() + begin, end - begin), ec);
+			begin = end;
+		}
+	}
+	if (ec) cerr << "stompreplay: client went away: " << ec.message() << endl;
+	uint64_t t_written = now_ns();
+
+	// every frame counts once it has been parsed and dispatched
+	uint64_t expected = frames * cfg.loops;
+	uint64_t deadline = t_written + uint64_t(cfg.timeout) * 1000000000ULL;
+	while ((client.stats().frames_received < expected) && (now_ns() < deadline)) usleep(100);
+	uint64_t t_end = now_ns();
+	uint64_t replayed = client.stats().frames_received;
+
+	double secs = (t_end - t_start) / 1e9;
+	uint64_t bytes = uint64_t(inbound.size()) * cfg.loops;
+	cout.setf(ios::fixed);
+	cout.precision(3);
+	cout << "{" << endl
+		 << "  \"config\": {\"capture\": \"" << cfg.file << "\", \"sessions\": " << sessions
+		 << ", \"destinations\": " << destinations.size() << ", \"loops\": " << cfg.loops
+		 << ", \"paced\": " << (cfg.paced ? "true" : "false") << ", \"speed\": " << cfg.speed
+		 << ", \"ack\": \"" << cfg.ackmode_name << "\"}," << endl
+		 << "  \"replay\": {\"frames\": " << replayed << ", \"expected\": " << expected
+		 << ", \"messages\": " << rcvd_msgs << ", \"body_bytes\": " << rcvd_bytes
+		 << ", \"wire_bytes\": " << bytes << ", \"written_back\": " << written_back
+		 << ", \"seconds\": " << secs
+		 << ", \"frames_per_s\": " << (secs > 0 ? replayed / secs : 0)
+		 << ", \"mb_per_s\": " << (secs > 0 ? bytes / secs / 1e6 : 0) << "}" << endl
+		 << "}" << endl;
+
+	client.stop();
+	peer.shutdown(Transport::socket_type::shutdown_both, ec);
+	drainer.join();
+	return (replayed < expected) ? 3 : 0;
+}
@@ -0,0 +1,508 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <algorithm>
+
+#include "StompScheduler.hpp"
+
+namespace STOMP {
+
+  using boost::posix_time::ptime;
+  using boost::posix_time::time_duration;
+  using boost::posix_time::microseconds;
+
+  // ------------------------------------------
+  TokenBucket::TokenBucket(const RateLimit& limit):
+  // ------------------------------------------
+	  m_limit(limit),
+	  m_last(boost::posix_time::microsec_clock::universal_time())
+  {
+	  m_msgs_cap = (limit.burst_msgs > 0) ? limit.burst_msgs : std::max(limit.msgs_per_sec / 10, 1.0);
+	  m_bytes_cap = (limit.burst_bytes > 0) ? limit.burst_bytes : std::max(limit.bytes_per_sec / 10, 1.0);
+	  // start with a full bucket, the burst is small enough
+	  m_msgs = m_msgs_cap;
+	  m_bytes = m_bytes_cap;
+  }
+
+  // ------------------------------------------
+  void TokenBucket::refill(const ptime& now)
+  // ------------------------------------------
+  {
+	  if (now <= m_last) return;
+	  double dt = (now - m_last).total_microseconds() / 1e6;
+	  m_last = now;
+	  if (m_limit.msgs_per_sec > 0) m_msgs = std::min(m_msgs_cap, m_msgs + dt * m_limit.msgs_per_sec);
+	  if (m_limit.bytes_per_sec > 0) m_bytes = std::min(m_bytes_cap, m_bytes + dt * m_limit.bytes_per_sec);
+  }
+
+  // ------------------------------------------
+  bool TokenBucket::admit(size_t bytes) const
+  // ------------------------------------------
+  {
+	  if ((m_limit.msgs_per_sec > 0) && (m_msgs < 1)) return false;
+	  if ((m_limit.bytes_per_sec > 0) && (m_bytes < std::min(double(bytes), m_bytes_cap))) return false;
+	  return true;
+  }
+
+  // ------------------------------------------
+  void TokenBucket::consume(size_t bytes)
+  // ------------------------------------------
+  {
+	  if (m_limit.msgs_per_sec > 0) m_msgs -= 1;
+	  if (m_limit.bytes_per_sec > 0) m_bytes -= bytes;
+  }
+
+  // ------------------------------------------
+  time_duration TokenBucket::wait(size_t bytes) const
+  // ------------------------------------------
+  {
+	  double s = 0;
+	  if ((m_limit.msgs_per_sec > 0) && (m_msgs < 1))
+		  s = std::max(s, (1 - m_msgs) / m_limit.msgs_per_sec);
+	  double need = std::min(double(bytes), m_bytes_cap);
+	  if ((m_limit.bytes_per_sec > 0) && (m_bytes < need))
+		  s = std::max(s, (need - m_bytes) / m_limit.bytes_per_sec);
+	  return microseconds(long(s * 1e6) + 1);
+  }
+
+  const int 	OutputScheduler::CONTROL_LANE;
+  const int 	OutputScheduler::DEFAULT_LANE;
+  const int 	OutputScheduler::AUTO_LANE;
+  const size_t 	OutputScheduler::QUANTUM;
+  const size_t 	OutputScheduler::BATCH_BYTES;
+  const long 	OutputScheduler::PACING_TICK_US;
+
+  // ------------------------------------------
+  OutputScheduler::OutputScheduler():
+  // ------------------------------------------
+	  m_next(0),
+	  m_credited(false),
+	  m_seq(0)
+  {
+	  m_lanes.push_back(Lane(0)); 	// CONTROL_LANE
+	  m_lanes.push_back(Lane(1)); 	// DEFAULT_LANE
+  }
+
+  // ------------------------------------------
+  OutputScheduler::~OutputScheduler()
+  // ------------------------------------------
+  {
+	  for (size_t l = 0; l < m_lanes.size(); l++)
+		  for (size_t i = 0; i < m_lanes[l].q.size(); i++) delete m_lanes[l].q[i].frame;
+	  for (size_t i = 0; i < m_fenced.size(); i++) delete m_fenced[i].frame;
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::is_control(stomp_command cmd)
+  // ------------------------------------------
+  {
+	  switch (cmd) {
+	  case CMD_ACK: case CMD_NACK:
+	  case CMD_SUBSCRIBE: case CMD_UNSUBSCRIBE:
+	  case CMD_BEGIN: case CMD_DISCONNECT:
+		  return true;
+	  default:
+		  return false;
+	  }
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::is_session_scoped(const Entry& e)
+  // ------------------------------------------
+  {
+	  if (e.lane != CONTROL_LANE) return false;
+	  if (e.frame == NULL) return true; 	// heartbeat
+	  switch (e.frame->command_id()) {
+	  case CMD_ACK: case CMD_NACK:
+	  case CMD_SUBSCRIBE: case CMD_UNSUBSCRIBE:
+		  return true;
+	  default:
+		  return false;
+	  }
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::is_fence(stomp_command cmd)
+  // ------------------------------------------
+  {
+	  // must not overtake the SENDs of their transaction
+	  return (cmd == CMD_COMMIT) || (cmd == CMD_ABORT);
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::transaction_of(const Entry& e, std::string& id)
+  // ------------------------------------------
+  {
+	  if (e.frame == NULL) return false;
+	  hdrmap& headers = e.frame->headers();
+	  hdrmap::iterator t = headers.find("transaction");
+	  if (t == headers.end()) return false;
+	  id = t->second;
+	  return true;
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::drop_lost(const Entry& e)
+  // ------------------------------------------
+  {
+	  // called with m_mutex held: true if e belongs to a lost transaction,
+	  // whose COMMIT / ABORT closes it
+	  std::string id;
+	  if (m_lost.empty() || !transaction_of(e, id) || (m_lost.count(id) == 0)) return false;
+	  if (is_fence(e.frame->command_id())) m_lost.erase(id);
+	  return true;
+  }
+
+  // ------------------------------------------
+  size_t OutputScheduler::cost(const Entry& e)
+  // ------------------------------------------
+  {
+	  // the body plus a rough guess for command and headers
+	  return (e.frame == NULL) ? 1 : e.frame->body().v.size() + 64;
+  }
+
+  // ------------------------------------------
+  int OutputScheduler::add_lane(unsigned weight)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  m_lanes.push_back(Lane(std::max(weight, 1u)));
+	  return m_lanes.size() - 1;
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::set_weight(int lane, unsigned weight)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if ((lane <= CONTROL_LANE) || (size_t(lane) >= m_lanes.size())) return false;
+	  m_lanes[lane].weight = std::max(weight, 1u);
+	  return true;
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::set_rate_limit(const RateLimit& limit)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  m_bucket = TokenBucket(limit);
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::set_lane_rate_limit(int lane, const RateLimit& limit)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if ((lane <= CONTROL_LANE) || (size_t(lane) >= m_lanes.size())) return false;
+	  m_lanes[lane].bucket = TokenBucket(limit);
+	  return true;
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::set_destination_rate_limit(const std::string& destination, const RateLimit& limit)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (limit.unlimited()) m_dest_buckets.erase(destination);
+	  else m_dest_buckets[destination] = TokenBucket(limit);
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::admit(Lane& lane, const Entry& e, const ptime& now, time_duration& wait, bool& global)
+  // ------------------------------------------
+  {
+	  // called with m_mutex held
+	  size_t bytes = cost(e);
+	  TokenBucket* dest = NULL;
+	  if (!m_dest_buckets.empty()) {
+		  hdrmap& headers = e.frame->headers();
+		  hdrmap::iterator d = headers.find("destination");
+		  if (d != headers.end()) {
+			  bucket_map::iterator b = m_dest_buckets.find(d->second);
+			  if (b != m_dest_buckets.end()) dest = &b->second;
+		  }
+	  }
+	  global = false;
+	  time_duration w = microseconds(0);
+	  if (!m_bucket.unlimited()) {
+		  m_bucket.refill(now);
+		  if (!m_bucket.admit(bytes)) { w = m_bucket.wait(bytes); global = true; }
+	  }
+	  if (!lane.bucket.unlimited()) {
+		  lane.bucket.refill(now);
+		  if (!lane.bucket.admit(bytes)) w = std::max(w, lane.bucket.wait(bytes));
+	  }
+	  if (dest) {
+		  dest->refill(now);
+		  if (!dest->admit(bytes)) w = std::max(w, dest->wait(bytes));
+	  }
+	  if (w > microseconds(0)) {
+		  if (wait.is_special() || (w < wait)) wait = w;
+		  return false;
+	  }
+	  if (!m_bucket.unlimited()) m_bucket.consume(bytes);
+	  if (!lane.bucket.unlimited()) lane.bucket.consume(bytes);
+	  if (dest) dest->consume(bytes);
+	  return true;
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::push(Frame* frame, int lane)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  push_locked(frame, lane);
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::push(Frame* const* frames, size_t n, int lane)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  for (size_t i = 0; i < n; i++) push_locked(frames[i], lane);
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::push_locked(Frame* frame, int lane)
+  // ------------------------------------------
+  {
+	  // called with m_mutex held
+	  stomp_command cmd = frame->command_id();
+	  Entry e = { frame, lane, m_seq++ };
+	  // the broker doesn't know this transaction any more
+	  if (drop_lost(e)) {
+		  delete frame;
+		  return;
+	  }
+	  if (is_fence(cmd)) {
+		  e.lane = AUTO_LANE;
+		  m_fenced.push_back(e);
+		  return;
+	  }
+	  if (is_control(cmd)) {
+		  e.lane = CONTROL_LANE;
+	  } else if ((lane <= CONTROL_LANE) || (size_t(lane) >= m_lanes.size())) {
+		  e.lane = DEFAULT_LANE;
+	  }
+	  m_lanes[e.lane].q.push_back(e);
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::push_heartbeat()
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  Entry e = { NULL, CONTROL_LANE, m_seq++ };
+	  m_lanes[CONTROL_LANE].q.push_back(e);
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::take_fenced(std::vector<Entry>& out)
+  // ------------------------------------------
+  {
+	  // called with m_mutex held: a fenced frame is due once no publish
+	  // frame queued before it is still waiting
+	  while (!m_fenced.empty()) {
+		  uint64_t seq = m_fenced.front().seq;
+		  for (size_t l = DEFAULT_LANE; l < m_lanes.size(); l++)
+			  if (!m_lanes[l].q.empty() && m_lanes[l].q.front().seq < seq) return;
+		  out.push_back(m_fenced.front());
+		  m_fenced.pop_front();
+	  }
+  }
+
+  // ------------------------------------------
+  bool OutputScheduler::next_batch(std::vector<Entry>& out, size_t max_bytes, time_duration* delay)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  size_t first = out.size();
+	  ptime now = boost::posix_time::microsec_clock::universal_time();
+	  time_duration wait(boost::posix_time::not_a_date_time);
+	  bool global = false;
+	  // 1. control frames, strict priority
+	  std::deque<Entry>& control = m_lanes[CONTROL_LANE].q;
+	  out.insert(out.end(), control.begin(), control.end());
+	  control.clear();
+	  take_fenced(out);
+	  // 2. publish lanes, deficit round robin until the batch is full
+	  size_t nlanes = m_lanes.size() - DEFAULT_LANE, used = 0, idle = 0;
+	  while ((used < max_bytes) && (idle < nlanes) && !global) {
+		  if (m_next >= nlanes) m_next = 0;
+		  Lane& lane = m_lanes[DEFAULT_LANE + m_next];
+		  if (lane.q.empty()) {
+			  lane.deficit = 0;
+			  m_credited = false;
+			  m_next++;
+			  idle++;
+			  continue;
+		  }
+		  if (!m_credited) {
+			  lane.deficit += lane.weight * QUANTUM;
+			  m_credited = true;
+		  }
+		  bool paced = false;
+		  while (!lane.q.empty() && (cost(lane.q.front()) <= lane.deficit) && (used < max_bytes)) {
+			  if (!admit(lane, lane.q.front(), now, wait, global)) {
+				  // over its rate: this lane sits out the rest of the batch
+				  paced = true;
+				  break;
+			  }
+			  size_t c = cost(lane.q.front());
+			  lane.deficit -= c;
+			  used += c;
+			  out.push_back(lane.q.front());
+			  lane.q.pop_front();
+		  }
+		  if (used >= max_bytes) break; 	// stay on this lane, its credit is not used up
+		  if (paced) {
+			  // no credit piles up while a lane waits for tokens
+			  lane.deficit = std::min(lane.deficit, size_t(lane.weight * QUANTUM));
+			  idle++;
+		  } else {
+			  idle = 0;
+		  }
+		  if (lane.q.empty()) lane.deficit = 0;
+		  m_credited = false;
+		  m_next++;
+	  }
+	  take_fenced(out);
+	  // the transactions this batch opens or closes
+	  std::string id;
+	  for (size_t i = first; i < out.size(); i++) {
+		  if (!transaction_of(out[i], id)) continue;
+		  stomp_command cmd = out[i].frame->command_id();
+		  if (cmd == CMD_BEGIN) m_open.insert(id);
+		  else if (is_fence(cmd)) m_open.erase(id);
+	  }
+	  bool more = !m_fenced.empty() || !control.empty();
+	  for (size_t l = DEFAULT_LANE; !more && (l < m_lanes.size()); l++)
+		  more = !m_lanes[l].q.empty();
+	  if (delay != NULL) {
+		  // only paced frames left: come back when the first of them is due
+		  *delay = boost::posix_time::not_a_date_time;
+		  if (more && (used < max_bytes) && !wait.is_special())
+			  *delay = std::max(wait, time_duration(microseconds(PACING_TICK_US)));
+	  }
+	  return more;
+  }
+
+  // ------------------------------------------
+  void OutputScheduler::restore(std::vector<Entry>& batch)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  // backwards, so that every lane gets its frames back in order. A BEGIN
+	  // stays: the SENDs and the COMMIT of its transaction go out again. A
+	  // transaction begun in an earlier batch stays open, and is dropped
+	  // after reconnecting (see discard_session_frames).
+	  std::string id;
+	  for (size_t i = batch.size(); i-- > 0; ) {
+		  const Entry& e = batch[i];
+		  if ((e.frame != NULL) && transaction_of(e, id)) {
+			  stomp_command cmd = e.frame->command_id();
+			  if (cmd == CMD_BEGIN) m_open.erase(id);
+			  else if (is_fence(cmd)) m_open.insert(id);
+		  }
+		  if (is_session_scoped(e)) delete e.frame;
+		  else if (e.lane == AUTO_LANE) m_fenced.push_front(e);
+		  else m_lanes[e.lane].q.push_front(e);
+	  }
+	  batch.clear();
+  }
+
+  // ------------------------------------------
+  size_t OutputScheduler::discard_session_frames(std::vector<std::string>* aborted)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  std::deque<Entry>& control = m_lanes[CONTROL_LANE].q;
+	  size_t n = 0;
+	  for (std::deque<Entry>::iterator it = control.begin(); it != control.end(); ) {
+		  if (is_session_scoped(*it)) {
+			  delete it->frame;
+			  it = control.erase(it);
+			  n++;
+		  } else {
+			  ++it;
+		  }
+	  }
+	  // the broker rolled back the transactions open on the lost session:
+	  // their remaining SENDs and COMMIT would be rejected on this one
+	  if (aborted) aborted->assign(m_open.begin(), m_open.end());
+	  m_lost.insert(m_open.begin(), m_open.end());
+	  m_open.clear();
+	  if (m_lost.empty()) return n;
+	  for (size_t l = 0; l < m_lanes.size(); l++) {
+		  std::deque<Entry>& q = m_lanes[l].q;
+		  for (std::deque<Entry>::iterator it = q.begin(); it != q.end(); ) {
+			  if (drop_lost(*it)) {
+				  delete it->frame;
+				  it = q.erase(it);
+				  n++;
+			  } else {
+				  ++it;
+			  }
+		  }
+	  }
+	  for (std::deque<Entry>::iterator it = m_fenced.begin(); it != m_fenced.end(); ) {
+		  if (drop_lost(*it)) {
+			  delete it->frame;
+			  it = m_fenced.erase(it);
+			  n++;
+		  } else {
+			  ++it;
+		  }
+	  }
+	  return n;
+  }
+
+  // ------------------------------------------
+  size_t OutputScheduler::pending() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  size_t n = m_fenced.size();
+	  for (size_t l = 0; l < m_lanes.size(); l++) n += m_lanes[l].q.size();
+	  return n;
+  }
+
+  // ------------------------------------------
+  size_t OutputScheduler::pending(int lane) const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if ((lane < 0) || (size_t(lane) >= m_lanes.size())) return 0;
+	  return m_lanes[lane].q.size();
+  }
+
+  // ------------------------------------------
+  size_t OutputScheduler::lanes() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_lanes.size();
+  }
+
+} // namespace STOMP
@@ -0,0 +1,188 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompScheduler.hpp
+//
+// The client's output queue. Frames are spread over lanes, each one a FIFO:
+// lane 0 carries control frames (ACK/NACK, (UN)SUBSCRIBE, BEGIN, heartbeats)
+// and always goes first, the publish lanes share what is left of each write
+// batch by weight (deficit round robin over body bytes). COMMIT and ABORT
+// are held back until every frame queued before them has gone out.
+// A transaction whose BEGIN went out on a session that was lost is gone on
+// the broker's side: what is left of it is dropped after reconnecting.
+// Publish frames can be paced by token buckets: globally, per lane and per
+// destination. A paced lane just sits out the batch, the client's output
+// actor comes back for it on a timer.
+//
+
+#ifndef __StompScheduler_H_
+#define __StompScheduler_H_
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "StompFrame.hpp"
+
+namespace STOMP {
+
+  // a publishing rate limit, 0 means unlimited. The bursts default to 1/10th
+  // of a second worth of traffic (at least one frame).
+  struct RateLimit {
+	  double 	msgs_per_sec;
+	  double 	bytes_per_sec;
+	  double 	burst_msgs;
+	  double 	burst_bytes;
+	  RateLimit(double msgs = 0, double bytes = 0):
+		  msgs_per_sec(msgs), bytes_per_sec(bytes), burst_msgs(0), burst_bytes(0) {};
+	  bool unlimited() const { return (msgs_per_sec <= 0) && (bytes_per_sec <= 0); };
+  };
+
+  // ----------------------------------------
+  // token bucket over frames and bytes. A frame larger than the byte burst
+  // gets through once the bucket is full, and leaves it in debt.
+  // ----------------------------------------
+  class TokenBucket {
+	  RateLimit 		m_limit;
+	  double 			m_msgs, m_bytes; 	// tokens
+	  double 			m_msgs_cap, m_bytes_cap;
+	  boost::posix_time::ptime m_last; 		// last refill
+  public:
+	  TokenBucket(const RateLimit& limit = RateLimit());
+	  bool unlimited() const { return m_limit.unlimited(); };
+	  void refill(const boost::posix_time::ptime& now);
+	  bool admit(size_t bytes) const;
+	  void consume(size_t bytes);
+	  // how long until admit(bytes) turns true
+	  boost::posix_time::time_duration wait(size_t bytes) const;
+  };
+
+  class OutputScheduler {
+  public:
+	  static const int 		CONTROL_LANE = 0;
+	  static const int 		DEFAULT_LANE = 1;
+	  // let the lane pick itself from the frame's command
+	  static const int 		AUTO_LANE = -1;
+	  // bytes credited to a lane per unit of weight and round
+	  static const size_t 	QUANTUM = 4096;
+	  // what one start_stomp_write pass drains at most, before it lets
+	  // newly queued control frames through again
+	  static const size_t 	BATCH_BYTES = 64 * 1024;
+	  // paced frames are released at most this often, so they still go out
+	  // several at a time
+	  static const long 	PACING_TICK_US = 5000;
+
+	  // a queued frame; frame == NULL is a heartbeat (a lone EOL)
+	  struct Entry {
+		  Frame* 	frame;
+		  int 		lane; 	// AUTO_LANE for fenced frames
+		  uint64_t 	seq; 	// global enqueue order
+	  };
+
+	  OutputScheduler();
+	  // deletes the frames still queued
+	  ~OutputScheduler();
+
+	  // a new publish lane, returns its id
+	  int 	add_lane(unsigned weight);
+	  // false if there is no such publish lane
+	  bool 	set_weight(int lane, unsigned weight);
+
+	  // queue a frame (takes ownership). An unknown lane means DEFAULT_LANE.
+	  void 	push(Frame* frame, int lane = AUTO_LANE);
+	  // queue n frames in one go, under a single lock and with consecutive
+	  // sequence numbers: no other frame is interleaved within a lane
+	  void 	push(Frame* const* frames, size_t n, int lane = AUTO_LANE);
+	  void 	push_heartbeat();
+
+	  // publish rate limits (RateLimit() lifts them)
+	  void 	set_rate_limit(const RateLimit& limit);
+	  bool 	set_lane_rate_limit(int lane, const RateLimit& limit);
+	  void 	set_destination_rate_limit(const std::string& destination, const RateLimit& limit);
+
+	  // append the next frames to send to out: all control frames, fenced
+	  // frames that became due, then publish frames up to about max_bytes.
+	  // Returns true if frames are left behind. If all of those are held back
+	  // by the rate limits, *delay tells when to come back (at least one
+	  // pacing tick), otherwise it is not_a_date_time.
+	  bool 	next_batch(std::vector<Entry>& out, size_t max_bytes = BATCH_BYTES,
+			  boost::posix_time::time_duration* delay = NULL);
+	  // put back a batch that could not be written, in front of everything,
+	  // except the frames of the lost session (see is_session_scoped)
+	  void 	restore(std::vector<Entry>& batch);
+	  // a new session: drop what is queued for the previous one, and the
+	  // frames of the transactions begun on it (their ids go to *aborted).
+	  // Returns the number of frames dropped.
+	  size_t discard_session_frames(std::vector<std::string>* aborted = NULL);
+
+	  size_t pending() const;
+	  size_t pending(int lane) const;
+	  size_t lanes() const;
+
+	  static bool is_control(stomp_command cmd);
+	  static bool is_fence(stomp_command cmd);
+	  // ACK / NACK name messages of the session, and the client subscribes
+	  // again itself after reconnecting (heartbeats are not worth resending)
+	  static bool is_session_scoped(const Entry& e);
+
+  private:
+	  struct Lane {
+		  std::deque<Entry> 	q;
+		  unsigned 				weight;
+		  size_t 				deficit;
+		  TokenBucket 			bucket;
+		  Lane(unsigned w): weight(w), deficit(0) {};
+	  };
+	  typedef std::map<std::string, TokenBucket> bucket_map;
+
+	  mutable boost::mutex 	m_mutex;
+	  std::vector<Lane> 	m_lanes; 	// [CONTROL_LANE] is served by strict priority
+	  std::deque<Entry> 	m_fenced; 	// COMMIT / ABORT waiting for their SENDs
+	  size_t 				m_next; 	// publish lane the round robin is at
+	  bool 					m_credited; // m_next already got its quantum this round
+	  uint64_t 				m_seq;
+	  TokenBucket 			m_bucket; 	// global
+	  bucket_map 			m_dest_buckets;
+	  std::set<std::string> m_open; 	// transactions whose BEGIN went out
+	  std::set<std::string> m_lost; 	// begun on a lost session, until their COMMIT / ABORT
+
+	  static size_t cost(const Entry& e);
+	  void push_locked(Frame* frame, int lane);
+	  void take_fenced(std::vector<Entry>& out);
+	  static bool transaction_of(const Entry& e, std::string& id);
+	  bool drop_lost(const Entry& e);
+	  // charge a publish frame to its buckets, or tell how long it has to wait
+	  bool admit(Lane& lane, const Entry& e, const boost::posix_time::ptime& now,
+			  boost::posix_time::time_duration& wait, bool& global);
+  };
+
+} // namespace STOMP
+
+#endif
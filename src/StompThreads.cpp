@@ -0,0 +1,161 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <cstdlib>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sched.h>
+#include <pthread.h>
+
+#include <boost/system/system_error.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "StompThreads.hpp"
+
+namespace STOMP {
+
+  // ------------------------------------------
+  CpuSet parse_cpu_set(const std::string& spec)
+  // ------------------------------------------
+  {
+	  CpuSet cpus;
+	  std::stringstream ss(spec);
+	  std::string tok;
+	  while (std::getline(ss, tok, ',')) {
+		  if (tok.empty()) continue;
+		  char* end;
+		  long first = strtol(tok.c_str(), &end, 10), last = first;
+		  if (*end == '-') last = strtol(end + 1, &end, 10);
+		  if ((end == tok.c_str()) || (*end != '\0') || (first < 0) || (last < first) || (last >= CPU_SETSIZE))
+			  throw std::invalid_argument("bad CPU list: " + spec);
+		  for (long cpu = first; cpu <= last; cpu++) cpus.push_back(int(cpu));
+	  }
+	  return cpus;
+  }
+
+  // ------------------------------------------
+  std::string format_cpu_set(const CpuSet& cpus)
+  // ------------------------------------------
+  {
+	  std::ostringstream os;
+	  for (size_t i = 0; i < cpus.size(); ) {
+		  size_t j = i;
+		  while ((j + 1 < cpus.size()) && (cpus[j + 1] == cpus[j] + 1)) j++;
+		  os << (i ? "," : "") << cpus[i];
+		  if (j > i) os << "-" << cpus[j];
+		  i = j + 1;
+	  }
+	  return os.str();
+  }
+
+  // ------------------------------------------
+  boost::system::error_code pin_current_thread(const CpuSet& cpus)
+  // ------------------------------------------
+  {
+	  cpu_set_t set;
+	  CPU_ZERO(&set);
+	  if (cpus.empty()) {
+		  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &set);
+	  } else {
+		  for (size_t i = 0; i < cpus.size(); i++) {
+			  if ((cpus[i] < 0) || (cpus[i] >= CPU_SETSIZE))
+				  return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+			  CPU_SET(cpus[i], &set);
+		  }
+	  }
+	  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	  return boost::system::error_code(rc, boost::system::system_category());
+  }
+
+  // ------------------------------------------
+  int cpu_node(int cpu)
+  // ------------------------------------------
+  {
+	  // /sys/devices/system/node/nodeN/cpulist lists the CPUs of node N
+	  for (int node = 0; node < 1024; node++) {
+		  std::ostringstream path;
+		  path << "/sys/devices/system/node/node" << node << "/cpulist";
+		  std::ifstream in(path.str().c_str());
+		  if (!in) return -1;
+		  std::string list;
+		  std::getline(in, list);
+		  try {
+			  CpuSet cpus = parse_cpu_set(list);
+			  for (size_t i = 0; i < cpus.size(); i++)
+				  if (cpus[i] == cpu) return node;
+		  } catch (std::invalid_argument&) {
+			  return -1;
+		  }
+	  }
+	  return -1;
+  }
+
+  // ------------------------------------------
+  const char* ThreadOptions::wait_name(WaitStrategy w)
+  // ------------------------------------------
+  {
+	  switch (w) {
+	  case WAIT_BLOCK: 				return "block";
+	  case WAIT_SPIN_THEN_BLOCK: 	return "spin";
+	  }
+	  return "?";
+  }
+
+  static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	  __builtin_ia32_pause();
+#endif
+  }
+
+  // ------------------------------------------
+  void run_io_service(boost::asio::io_service& io, const ThreadOptions& options, boost::atomic<uint64_t>& sleeps)
+  // ------------------------------------------
+  {
+	  boost::posix_time::ptime idle_since;
+	  while (!io.stopped()) {
+		  if (options.wait == ThreadOptions::WAIT_BLOCK) {
+			  io.run_one();
+			  continue;
+		  }
+		  // spin: poll the reactor without sleeping, sleep only after
+		  // spin_us without a single handler to run
+		  if (io.poll() > 0) {
+			  idle_since = boost::posix_time::ptime();
+			  continue;
+		  }
+		  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		  if (idle_since.is_not_a_date_time()) idle_since = now;
+		  if (now - idle_since < boost::posix_time::microseconds(options.spin_us)) {
+			  cpu_relax();
+			  continue;
+		  }
+		  sleeps++;
+		  io.run_one();
+		  idle_since = boost::posix_time::ptime();
+	  }
+  }
+
+} // namespace STOMP
@@ -0,0 +1,86 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompThreads.hpp
+//
+// Thread placement: which CPUs the client's IO thread (and the log formatter
+// thread) may run on, and how the IO thread waits for work. On hosts with
+// several sockets, keeping the IO thread next to the application threads
+// that produce and consume its frames avoids cross-node cache traffic.
+//
+
+#ifndef __StompThreads_H_
+#define __StompThreads_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/system/error_code.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+
+namespace STOMP {
+
+  // CPU numbers as the kernel counts them (sched_setaffinity, /proc/cpuinfo)
+  typedef std::vector<int> CpuSet;
+
+  // "0-3,8,10-11" -> { 0, 1, 2, 3, 8, 10, 11 }; throws std::invalid_argument
+  CpuSet 		parse_cpu_set(const std::string& spec);
+  std::string 	format_cpu_set(const CpuSet& cpus);
+
+  // restrict the calling thread to cpus (empty: every CPU)
+  boost::system::error_code pin_current_thread(const CpuSet& cpus);
+
+  // the NUMA node of a CPU, -1 when unknown (no NUMA or no sysfs)
+  int 			cpu_node(int cpu);
+
+  // -------------------------------
+  // placement of a client's IO thread, see BoostStomp::set_thread_options()
+  // -------------------------------
+  struct ThreadOptions {
+	  typedef enum {
+		  WAIT_BLOCK = 0, 			// io_service::run(): sleep in epoll until there is work
+		  WAIT_SPIN_THEN_BLOCK 		// poll for spin_us after the last handler, then sleep
+	  } WaitStrategy;
+
+	  CpuSet 		io_cpus; 		// empty: wherever the scheduler puts it
+	  WaitStrategy 	wait;
+	  unsigned 		spin_us; 		// WAIT_SPIN_THEN_BLOCK: busy-poll this long before sleeping
+	  // Re-allocate the read and write buffers from the IO thread once it is
+	  // pinned, so that the kernel's first-touch policy places them on its node.
+	  bool 			numa_local_buffers;
+
+	  ThreadOptions(): wait(WAIT_BLOCK), spin_us(50), numa_local_buffers(false) {};
+
+	  static const char* wait_name(WaitStrategy w);
+  };
+
+  // Run io until it is stopped, waiting for work the way options say.
+  // Handlers run one batch at a time, so that a new wait strategy is picked
+  // up right away; sleeps counts the times a spinning thread went to sleep.
+  void run_io_service(boost::asio::io_service& io, const ThreadOptions& options, boost::atomic<uint64_t>& sleeps);
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <unistd.h>
+
+#include "StompTrace.hpp"
+
+namespace STOMP {
+
+  const char* const TRACE_HEADER = "stomp-trace";
+
+  // ------------------------------------------
+  LatencyHistogram::LatencyHistogram(int sub_bits):
+  // ------------------------------------------
+	  m_sub_bits(sub_bits),
+	  m_count(0),
+	  m_sum(0),
+	  m_max(0)
+  {
+  }
+
+  size_t LatencyHistogram::bucket_of(uint64_t v) const {
+	  const uint64_t sub_count = uint64_t(1) << m_sub_bits;
+	  if (v < sub_count) return size_t(v);
+	  int msb = 63 - __builtin_clzll(v);
+	  int shift = msb - m_sub_bits;
+	  return (size_t(shift + 1) << m_sub_bits) + size_t((v >> shift) & (sub_count - 1));
+  }
+
+  uint64_t LatencyHistogram::value_of(size_t b) const {
+	  const uint64_t sub_count = uint64_t(1) << m_sub_bits;
+	  if (b < sub_count) return uint64_t(b);
+	  int shift = int(b >> m_sub_bits) - 1;
+	  return ((sub_count | (b & (sub_count - 1))) << shift);
+  }
+
+  // ------------------------------------------
+  void LatencyHistogram::record(uint64_t v)
+  // ------------------------------------------
+  {
+	  size_t b = bucket_of(v);
+	  if (b >= m_buckets.size()) m_buckets.resize(b + 1, 0);
+	  m_buckets[b]++;
+	  m_count++;
+	  m_sum += v;
+	  if (v > m_max) m_max = v;
+  }
+
+  // ------------------------------------------
+  void LatencyHistogram::merge(const LatencyHistogram& other)
+  // ------------------------------------------
+  {
+	  if (other.m_sub_bits != m_sub_bits) {
+		  // different precision: replay the other's buckets at their values
+		  for (size_t b = 0; b < other.m_buckets.size(); b++)
+			  for (uint64_t n = 0; n < other.m_buckets[b]; n++) record(other.value_of(b));
+		  return;
+	  }
+	  if (other.m_buckets.size() > m_buckets.size()) m_buckets.resize(other.m_buckets.size(), 0);
+	  for (size_t b = 0; b < other.m_buckets.size(); b++) m_buckets[b] += other.m_buckets[b];
+	  m_count += other.m_count;
+	  m_sum += other.m_sum;
+	  m_max = std::max(m_max, other.m_max);
+  }
+
+  // ------------------------------------------
+  void LatencyHistogram::clear()
+  // ------------------------------------------
+  {
+	  m_buckets.clear();
+	  m_count = m_sum = m_max = 0;
+  }
+
+  // ------------------------------------------
+  uint64_t LatencyHistogram::percentile(double p) const
+  // ------------------------------------------
+  {
+	  if (m_count == 0) return 0;
+	  uint64_t rank = uint64_t(p / 100.0 * (m_count - 1)) + 1, seen = 0;
+	  for (size_t b = 0; b < m_buckets.size(); b++) {
+		  seen += m_buckets[b];
+		  if (seen >= rank) return std::min(value_of(b), m_max);
+	  }
+	  return m_max;
+  }
+
+  // ------------------------------------------
+  TraceRecorder::TraceRecorder(size_t max_destinations):
+  // ------------------------------------------
+	  m_max_destinations(max_destinations)
+  {
+  }
+
+  // ------------------------------------------
+  void TraceRecorder::set_max_destinations(size_t n)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  m_max_destinations = n;
+  }
+
+  // ------------------------------------------
+  void TraceRecorder::record(boost::string_view destination, Stage stage, uint64_t us)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  static thread_local std::string s_key;
+	  s_key.assign(destination.data(), destination.size());
+	  LatencyReport::iterator it = m_destinations.find(s_key);
+	  if (it == m_destinations.end()) {
+		  if (m_destinations.size() >= m_max_destinations) s_key = "*";
+		  it = m_destinations.insert(std::make_pair(s_key, DestinationLatency())).first;
+	  }
+	  switch (stage) {
+	  case QUEUED: 		it->second.queued.record(us); break;
+	  case TRANSIT: 	it->second.transit.record(us); break;
+	  case DISPATCH: 	it->second.dispatch.record(us); break;
+	  }
+  }
+
+  // ------------------------------------------
+  LatencyReport TraceRecorder::report(bool reset)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  LatencyReport copy;
+	  if (reset) copy.swap(m_destinations);
+	  else copy = m_destinations;
+	  return(copy);
+  }
+
+  // ------------------------------------------
+  void TraceRecorder::stamp_queued(std::string& value)
+  // ------------------------------------------
+  {
+	  char buf[64];
+	  int n = snprintf(buf, sizeof(buf), "%x,%llx", host_tag(), (unsigned long long) clock_us());
+	  value.assign(buf, n);
+  }
+
+  // ------------------------------------------
+  bool TraceRecorder::stamp_written(std::string& value, Stamp& stamp)
+  // ------------------------------------------
+  {
+	  if (!parse(value, stamp)) return(false);
+	  bool first = (stamp.written == 0);
+	  stamp.written = clock_us();
+	  stamp.wall = wall_us();
+	  char buf[96];
+	  int n = snprintf(buf, sizeof(buf), "%x,%llx,%llx,%llx", stamp.host,
+			  (unsigned long long) stamp.queued, (unsigned long long) stamp.written, (unsigned long long) stamp.wall);
+	  value.assign(buf, n);
+	  return(first);
+  }
+
+  // ------------------------------------------
+  bool TraceRecorder::parse(boost::string_view value, Stamp& stamp)
+  // ------------------------------------------
+  {
+	  char buf[96];
+	  if (value.size() >= sizeof(buf)) return(false);
+	  memcpy(buf, value.data(), value.size());
+	  buf[value.size()] = '\0';
+	  unsigned long long fields[4] = { 0, 0, 0, 0 };
+	  char* p = buf;
+	  int n = 0;
+	  while (n < 4) {
+		  char* end;
+		  fields[n++] = strtoull(p, &end, 16);
+		  if (end == p) return(false);
+		  if (*end != ',') break;
+		  p = end + 1;
+	  }
+	  if (n < 2) return(false);
+	  stamp.host = uint32_t(fields[0]);
+	  stamp.queued = fields[1];
+	  stamp.written = fields[2];
+	  stamp.wall = fields[3];
+	  return(true);
+  }
+
+  // ------------------------------------------
+  uint64_t TraceRecorder::clock_us()
+  // ------------------------------------------
+  {
+	  struct timespec ts;
+	  clock_gettime(CLOCK_MONOTONIC, &ts);
+	  return (uint64_t(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000);
+  }
+
+  // ------------------------------------------
+  uint64_t TraceRecorder::wall_us()
+  // ------------------------------------------
+  {
+	  struct timespec ts;
+	  clock_gettime(CLOCK_REALTIME, &ts);
+	  return (uint64_t(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000);
+  }
+
+  static uint32_t fnv1a(const std::string& s) {
+	  uint32_t h = 2166136261u;
+	  for (size_t i = 0; i < s.size(); i++) h = (h ^ (unsigned char) s[i]) * 16777619u;
+	  return(h);
+  }
+
+  // ------------------------------------------
+  uint32_t TraceRecorder::host_tag()
+  // ------------------------------------------
+  {
+	  // monotonic clocks only compare within one boot of one host
+	  static const uint32_t tag = []() {
+		  std::string id;
+		  std::ifstream in("/proc/sys/kernel/random/boot_id");
+		  if (!std::getline(in, id) || id.empty()) {
+			  char host[256] = "";
+			  gethostname(host, sizeof(host) - 1);
+			  id = host;
+		  }
+		  return fnv1a(id);
+	  }();
+	  return(tag);
+  }
+
+} // namespace STOMP
@@ -0,0 +1,133 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompTrace.hpp
+//
+// Opt-in end-to-end latency tracing (BoostStomp::enable_tracing). A sampled
+// SEND frame carries a header stamped when it is queued, and again when the
+// IO thread writes it out:
+//
+//     stomp-trace:<host>,<queued>,<written>,<written wall clock>
+//
+// in hexadecimal: a tag of the sending host's boot, then microseconds, the
+// first two on CLOCK_MONOTONIC. The sender records how long the frame waited
+// in its output lanes. A receiving client with tracing on records the transit
+// through the broker (written -> headers read; on the monotonic clock when
+// both ends share the host, on the wall clock otherwise) and its own dispatch
+// delay (headers read -> callback or pull queue). Everything is kept per
+// destination, in histograms of bounded size.
+//
+
+#ifndef __StompTrace_H_
+#define __StompTrace_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace STOMP {
+
+  extern const char* const TRACE_HEADER; 	// "stomp-trace"
+
+  struct TraceOptions {
+	  double 	sample_rate; 		// share of SEND frames stamped (0: only measure what comes in)
+	  size_t 	max_destinations; 	// with histograms of their own, the rest share "*"
+	  TraceOptions(): sample_rate(0.01), max_destinations(256) {};
+  };
+
+  // ----------------------------------------
+  // Log-linear histogram: 2^sub_bits buckets per power of two, ie. a
+  // precision of about 1/2^sub_bits, allocated up to the largest value seen.
+  // ----------------------------------------
+  class LatencyHistogram {
+	  int 					m_sub_bits;
+	  std::vector<uint64_t> m_buckets;
+	  uint64_t 				m_count, m_sum, m_max;
+
+	  size_t bucket_of(uint64_t v) const;
+	  uint64_t value_of(size_t b) const;
+  public:
+	  LatencyHistogram(int sub_bits = 5);
+
+	  void 		record(uint64_t v);
+	  void 		merge(const LatencyHistogram& other);
+	  void 		clear();
+	  uint64_t 	count() const 	{ return m_count; };
+	  uint64_t 	max() const 	{ return m_max; };
+	  double 	mean() const 	{ return m_count ? double(m_sum) / m_count : 0.0; };
+	  // the value below which p percent of the samples are (bucket precision)
+	  uint64_t 	percentile(double p) const;
+  };
+
+  // latencies of one destination, in microseconds
+  struct DestinationLatency {
+	  LatencyHistogram 	queued; 	// sent here: queued -> written
+	  LatencyHistogram 	transit; 	// received here: written by the sender -> headers read
+	  LatencyHistogram 	dispatch; 	// received here: headers read -> handler
+	  DestinationLatency(): queued(3), transit(3), dispatch(3) {};
+  };
+  typedef std::map<std::string, DestinationLatency> LatencyReport;
+
+  // ----------------------------------------
+  // The stamps, and the histograms they end up in. Recording takes a lock:
+  // only sampled frames are recorded.
+  // ----------------------------------------
+  class TraceRecorder {
+	  boost::mutex 			m_mutex;
+	  LatencyReport 		m_destinations;
+	  size_t 				m_max_destinations;
+  public:
+	  typedef enum { QUEUED, TRANSIT, DISPATCH } Stage;
+
+	  struct Stamp {
+		  uint32_t 	host;
+		  uint64_t 	queued, written, wall; 	// written = 0: not written yet
+	  };
+
+	  TraceRecorder(size_t max_destinations = TraceOptions().max_destinations);
+	  void 	set_max_destinations(size_t n);
+	  void 	record(boost::string_view destination, Stage stage, uint64_t us);
+	  // a copy of the histograms, optionally starting over
+	  LatencyReport report(bool reset = false);
+
+	  // header values: a new one for a frame being queued, then the write
+	  // stamps added in place (false if they were there already, eg. for a
+	  // frame written again after a reconnect)
+	  static void 	stamp_queued(std::string& value);
+	  static bool 	stamp_written(std::string& value, Stamp& stamp);
+	  static bool 	parse(boost::string_view value, Stamp& stamp);
+
+	  // monotonic and wall clock, in microseconds; the tag of this host's boot
+	  static uint64_t 	clock_us();
+	  static uint64_t 	wall_us();
+	  static uint32_t 	host_tag();
+  };
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,690 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "StompTransport.hpp"
+
+namespace STOMP {
+
+  using namespace boost::asio;
+
+  // split "host:port", "[v6::addr]:port" or "host"
+  static void parse_host_port(const string& uri, string hostport, string& host, int& port)
+  {
+	  if (!hostport.empty() && hostport[hostport.size() - 1] == '/') hostport.erase(hostport.size() - 1);
+	  size_t colon = hostport.rfind(':');
+	  size_t bracket = hostport.rfind(']');
+	  if ((colon != string::npos) && ((bracket == string::npos) || (colon > bracket))) {
+		  try {
+			  port = boost::lexical_cast<int>(hostport.substr(colon + 1));
+		  } catch (boost::bad_lexical_cast&) {
+			  throw std::invalid_argument("bad port in URI: " + uri);
+		  }
+		  hostport.erase(colon);
+	  }
+	  if (hostport.size() > 1 && hostport[0] == '[' && hostport[hostport.size() - 1] == ']')
+		  hostport = hostport.substr(1, hostport.size() - 2);
+	  if (hostport.empty()) throw std::invalid_argument("no host in URI: " + uri);
+	  host = hostport;
+  }
+
+  // ------------------------------------------
+  boost::shared_ptr<Transport> Transport::from_uri(const string& uri)
+  // ------------------------------------------
+  {
+	  string host;
+	  int port;
+	  if ((uri.compare(0, 9, "failover:") == 0) || (uri.find(',') != string::npos)) {
+		  string list = uri, query;
+		  if (uri.compare(0, 9, "failover:") == 0) {
+			  list = uri.substr(9);
+			  size_t close = list.rfind(')');
+			  if ((list.empty()) || (list[0] != '(') || (close == string::npos))
+				  throw std::invalid_argument("expected failover:(uri,uri,...): " + uri);
+			  if (close + 1 < list.size() && list[close + 1] == '?') query = list.substr(close + 2);
+			  list = list.substr(1, close - 1);
+		  }
+		  long stagger = 250;
+		  if (query.compare(0, 8, "stagger=") == 0) {
+			  try {
+				  stagger = boost::lexical_cast<long>(query.substr(8));
+			  } catch (boost::bad_lexical_cast&) {
+				  throw std::invalid_argument("bad stagger in URI: " + uri);
+			  }
+		  } else if (!query.empty()) {
+			  throw std::invalid_argument("unknown option '" + query + "' in URI: " + uri);
+		  }
+		  std::vector< boost::shared_ptr<Transport> > endpoints;
+		  std::istringstream items(list);
+		  string item;
+		  while (getline(items, item, ',')) {
+			  if (item.compare(0, 9, "failover:") == 0) throw std::invalid_argument("nested failover URI: " + uri);
+			  if (!item.empty()) endpoints.push_back(from_uri(item));
+		  }
+		  if (endpoints.empty()) throw std::invalid_argument("no brokers in URI: " + uri);
+		  return boost::shared_ptr<Transport>(new FailoverTransport(endpoints, boost::posix_time::milliseconds(stagger)));
+	  }
+	  if (uri.compare(0, 7, "unix://") == 0) {
+		  string path = uri.substr(7);
+		  if (path.empty()) throw std::invalid_argument("no socket path in URI: " + uri);
+		  return boost::shared_ptr<Transport>(new UnixTransport(path));
+	  }
+	  if (uri.compare(0, 6, "tcp://") == 0) {
+		  port = 61613;
+		  parse_host_port(uri, uri.substr(6), host, port);
+		  return boost::shared_ptr<Transport>(new TcpTransport(host, port));
+	  }
+	  if ((uri.compare(0, 6, "ssl://") == 0) || (uri.compare(0, 6, "tls://") == 0)) {
+		  string rest = uri.substr(6), query;
+		  size_t q = rest.find('?');
+		  if (q != string::npos) {
+			  query = rest.substr(q + 1);
+			  rest.erase(q);
+		  }
+		  port = 61614;
+		  parse_host_port(uri, rest, host, port);
+		  // options: ca=<file>, verify=none
+		  string ca;
+		  bool verify = true;
+		  std::istringstream options(query);
+		  string option;
+		  while (getline(options, option, '&')) {
+			  if (option.compare(0, 3, "ca=") == 0) 	ca = option.substr(3);
+			  else if (option == "verify=none") 		verify = false;
+			  else if (!option.empty()) throw std::invalid_argument("unknown option '" + option + "' in URI: " + uri);
+		  }
+		  TlsTransport* tls = new TlsTransport(host, port, verify);
+		  boost::shared_ptr<Transport> result(tls);
+		  if (!ca.empty()) tls->context().load_verify_file(ca);
+		  return result;
+	  }
+	  throw std::invalid_argument("unsupported transport URI: " + uri);
+  }
+
+  // ------------------------------------------
+  void Transport::async_handshake(Stream& stream, connect_handler handler)
+  // ------------------------------------------
+  {
+	  post(stream.get_executor(), boost::bind(handler, boost::system::error_code()));
+  }
+
+  // ------------------------------------------
+  void Transport::async_probe(const socket_type::executor_type& ex, probe_handler handler)
+  // ------------------------------------------
+  {
+	  // one endpoint only, nothing better to find
+	  post(ex, boost::bind(handler, false));
+  }
+
+  // ------------------------------------------
+  const char* TransportOptions::nagle_name(NagleMode m)
+  // ------------------------------------------
+  {
+	  switch (m) {
+	  case NAGLE_OFF: 		return "nodelay";
+	  case NAGLE_ADAPTIVE: 	return "adaptive";
+	  default: 				return "nagle";
+	  }
+  }
+
+  // ------------------------------------------
+  TransportOptions::NagleMode Transport::configure(socket_type& socket, const TransportOptions& options)
+  // ------------------------------------------
+  {
+	  // options are best effort, a setting the system refuses is not fatal
+	  boost::system::error_code ec;
+	  if (options.send_buffer > 0)
+		  socket.set_option(socket_base::send_buffer_size(options.send_buffer), ec);
+	  if (options.receive_buffer > 0)
+		  socket.set_option(socket_base::receive_buffer_size(options.receive_buffer), ec);
+	  // no Nagle outside TCP
+	  return TransportOptions::NAGLE_ON;
+  }
+
+  // ------------------------------------------
+  TransportOptions::NagleMode TcpTransport::configure(socket_type& socket, const TransportOptions& options)
+  // ------------------------------------------
+  {
+	  Transport::configure(socket, options);
+	  boost::system::error_code ec;
+	  TransportOptions::NagleMode mode = TransportOptions::NAGLE_ON;
+	  if (options.nagle != TransportOptions::NAGLE_ON) {
+		  socket.set_option(ip::tcp::no_delay(true), ec);
+		  if (!ec) mode = options.nagle;
+	  }
+	  if (options.keepalive) {
+		  socket.set_option(socket_base::keep_alive(true), ec);
+#ifdef TCP_KEEPIDLE
+		  if (options.keepalive_idle > 0) {
+			  int idle = options.keepalive_idle;
+			  ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+		  }
+#endif
+	  }
+	  if (options.quick_ack) quick_ack(socket);
+	  return mode;
+  }
+
+  // ------------------------------------------
+  void TcpTransport::cork(socket_type& socket, bool on)
+  // ------------------------------------------
+  {
+#ifdef TCP_CORK
+	  // uncorking flushes whatever is pending
+	  int val = on ? 1 : 0;
+	  ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+#endif
+  }
+
+  // ------------------------------------------
+  void TcpTransport::quick_ack(socket_type& socket)
+  // ------------------------------------------
+  {
+#ifdef TCP_QUICKACK
+	  // not sticky: the kernel may fall back to delayed ACKs after a while
+	  int val = 1;
+	  ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
+#endif
+  }
+
+  // ------------------------------------------
+  void TcpTransport::async_connect(socket_type& socket, connect_handler handler)
+  // ------------------------------------------
+  {
+	  boost::shared_ptr<ip::tcp::resolver> resolver(new ip::tcp::resolver(socket.get_executor()));
+	  resolver->async_resolve(m_hostname, boost::lexical_cast<string>(m_port), ip::resolver_base::numeric_service,
+			  boost::bind(&TcpTransport::handle_resolve, this, placeholders::error, placeholders::results, resolver, &socket, handler));
+  }
+
+  // ------------------------------------------
+  void TcpTransport::handle_resolve(const boost::system::error_code& ec, ip::tcp::resolver::results_type endpoints,
+		  boost::shared_ptr<ip::tcp::resolver>, socket_type* socket, connect_handler handler)
+  // ------------------------------------------
+  {
+	  if (ec) {
+		  handler(ec);
+		  return;
+	  }
+	  // try each address in turn, generic endpoints open the socket with the right family
+	  std::vector<generic::stream_protocol::endpoint> addresses;
+	  for (ip::tcp::resolver::results_type::iterator it = endpoints.begin(); it != endpoints.end(); it++)
+		  addresses.push_back(generic::stream_protocol::endpoint(it->endpoint()));
+	  boost::asio::async_connect(*socket, addresses, boost::bind(handler, placeholders::error));
+  }
+
+  // ------------------------------------------
+  string TcpTransport::describe() const
+  // ------------------------------------------
+  {
+	  return "tcp://" + m_hostname + ":" + boost::lexical_cast<string>(m_port);
+  }
+
+  // SSL_CTX slot pointing back to the transport (asio keeps its own data in the app_data slot)
+  static int tls_transport_index()
+  {
+	  static int index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	  return index;
+  }
+
+  // ------------------------------------------
+  TlsTransport::TlsTransport(const string& hostname, int port, bool verify):
+  // ------------------------------------------
+	  TcpTransport(hostname, port),
+	  m_context(ssl::context::tls_client),
+	  m_verify(verify),
+	  m_session(NULL)
+  {
+	  m_context.set_options(ssl::context::default_workarounds | ssl::context::no_sslv2 | ssl::context::no_sslv3);
+	  if (m_verify) {
+		  m_context.set_default_verify_paths();
+		  m_context.set_verify_mode(ssl::verify_peer);
+	  } else {
+		  m_context.set_verify_mode(ssl::verify_none);
+	  }
+	  // collect sessions (TLS 1.3 tickets arrive after the handshake) through a callback
+	  SSL_CTX* ctx = m_context.native_handle();
+	  SSL_CTX_set_ex_data(ctx, tls_transport_index(), this);
+	  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	  SSL_CTX_sess_set_new_cb(ctx, &TlsTransport::new_session);
+  }
+
+  // ------------------------------------------
+  TlsTransport::~TlsTransport()
+  // ------------------------------------------
+  {
+	  if (m_session) SSL_SESSION_free(m_session);
+  }
+
+  // ------------------------------------------
+  int TlsTransport::new_session(SSL* ssl, SSL_SESSION* session)
+  // ------------------------------------------
+  {
+	  TlsTransport* self = static_cast<TlsTransport*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), tls_transport_index()));
+	  boost::mutex::scoped_lock lock(self->m_session_mutex);
+	  if (self->m_session) SSL_SESSION_free(self->m_session);
+	  self->m_session = session;
+	  // we keep the reference OpenSSL handed us
+	  return 1;
+  }
+
+  // ------------------------------------------
+  void TlsTransport::async_handshake(Stream& stream, connect_handler handler)
+  // ------------------------------------------
+  {
+	  Stream::tls_type& tls = stream.start_tls(m_context);
+	  SSL* ssl = tls.native_handle();
+	  // SNI, and the name the broker certificate must carry
+	  SSL_set_tlsext_host_name(ssl, m_hostname.c_str());
+	  if (m_verify)
+		  tls.set_verify_callback(ssl::host_name_verification(m_hostname));
+	  {
+		  boost::mutex::scoped_lock lock(m_session_mutex);
+		  if (m_session) SSL_set_session(ssl, m_session);
+	  }
+	  tls.async_handshake(ssl::stream_base::client, handler);
+  }
+
+  // ------------------------------------------
+  string TlsTransport::describe() const
+  // ------------------------------------------
+  {
+	  return "ssl://" + m_hostname + ":" + boost::lexical_cast<string>(m_port);
+  }
+
+  // ------------------------------------------
+  void UnixTransport::async_connect(socket_type& socket, connect_handler handler)
+  // ------------------------------------------
+  {
+	  socket.async_connect(generic::stream_protocol::endpoint(local::stream_protocol::endpoint(m_path)), handler);
+  }
+
+  // ---------------- failover ----------------
+
+  const double FailoverTransport::HYSTERESIS = 0.8;
+
+  // a connect in progress: one socket per endpoint that joined the race
+  struct FailoverTransport::Race {
+	  socket_type* 		target;
+	  connect_handler 	handler;
+	  std::vector<size_t> order; 		// endpoint indices, best first
+	  std::vector< boost::shared_ptr<socket_type> > sockets; // by position in order
+	  size_t 			next; 		// position of the next endpoint to start
+	  size_t 			running;
+	  bool 				done;
+	  deadline_timer 	stagger;
+	  Race(socket_type& socket, connect_handler h):
+		  target(&socket), handler(h), next(0), running(0), done(false), stagger(socket.get_executor()) {};
+	  void abandon() {
+		  done = true;
+		  boost::system::error_code ignored;
+		  stagger.cancel(ignored);
+		  for (size_t i = 0; i < sockets.size(); i++)
+			  if (sockets[i]) sockets[i]->close(ignored);
+	  }
+  };
+
+  // checking on a better endpoint
+  struct FailoverTransport::Probe {
+	  size_t 			index;
+	  socket_type 		socket;
+	  deadline_timer 	timeout;
+	  probe_handler 	handler;
+	  bool 				done;
+	  Probe(size_t i, const socket_type::executor_type& ex, probe_handler h):
+		  index(i), socket(ex), timeout(ex), handler(h), done(false) {};
+  };
+
+  // ------------------------------------------
+  FailoverTransport::FailoverTransport(const std::vector< boost::shared_ptr<Transport> >& endpoints,
+		  const boost::posix_time::time_duration& stagger):
+  // ------------------------------------------
+	  m_active(-1),
+	  m_stagger(stagger)
+  {
+	  for (size_t i = 0; i < endpoints.size(); i++) {
+		  Endpoint ep = { endpoints[i], -1, 0 };
+		  m_endpoints.push_back(ep);
+	  }
+	  if (m_endpoints.empty()) throw std::invalid_argument("FailoverTransport: no endpoints");
+  }
+
+  // ------------------------------------------
+  std::vector<size_t> FailoverTransport::ranking() const
+  // ------------------------------------------
+  {
+	  std::vector< std::pair< std::pair<bool, double>, size_t > > keys;
+	  for (size_t i = 0; i < m_endpoints.size(); i++) {
+		  const Endpoint& ep = m_endpoints[i];
+		  keys.push_back(std::make_pair(std::make_pair(ep.failures > 0, std::max(ep.rtt_ms, 0.0)), i));
+	  }
+	  std::sort(keys.begin(), keys.end());
+	  std::vector<size_t> order;
+	  for (size_t i = 0; i < keys.size(); i++) order.push_back(keys[i].second);
+	  return order;
+  }
+
+  // ------------------------------------------
+  bool FailoverTransport::better(size_t candidate) const
+  // ------------------------------------------
+  {
+	  // is candidate (down or not) faster than the active endpoint, by a margin?
+	  if ((m_active < 0) || (candidate == size_t(m_active))) return false;
+	  double active_rtt = m_endpoints[m_active].rtt_ms;
+	  if (active_rtt <= 0) return false;
+	  return std::max(m_endpoints[candidate].rtt_ms, 0.0) < active_rtt * HYSTERESIS;
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::async_connect(socket_type& socket, connect_handler handler)
+  // ------------------------------------------
+  {
+	  if (m_race) m_race->abandon();
+	  boost::shared_ptr<Race> race(new Race(socket, handler));
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  m_active = -1;
+		  race->order = ranking();
+	  }
+	  race->sockets.resize(race->order.size());
+	  m_race = race;
+	  start_candidate(race);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::start_candidate(boost::shared_ptr<Race> race)
+  // ------------------------------------------
+  {
+	  if (race->done || (race->next >= race->order.size())) return;
+	  size_t pos = race->next++;
+	  race->sockets[pos].reset(new socket_type(race->target->get_executor()));
+	  race->running++;
+	  m_endpoints[race->order[pos]].transport->async_connect(*race->sockets[pos],
+			  boost::bind(&FailoverTransport::handle_candidate, this, race, pos, placeholders::error));
+	  // give it a head start, then let the next one join in
+	  if (race->next < race->order.size()) {
+		  race->stagger.expires_from_now(m_stagger);
+		  race->stagger.async_wait(boost::bind(&FailoverTransport::handle_stagger, this, race, placeholders::error));
+	  }
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::handle_stagger(boost::shared_ptr<Race> race, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  if (ec || race->done) return;
+	  start_candidate(race);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::handle_candidate(boost::shared_ptr<Race> race, size_t pos, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  race->running--;
+	  boost::system::error_code ignored;
+	  if (race->done) {
+		  // lost the race, or the race was abandoned
+		  race->sockets[pos]->close(ignored);
+		  return;
+	  }
+	  size_t index = race->order[pos];
+	  if (ec) {
+		  {
+			  boost::mutex::scoped_lock lock(m_mutex);
+			  m_endpoints[index].failures++;
+		  }
+		  race->sockets[pos]->close(ignored);
+		  if (race->next < race->order.size()) {
+			  // no point waiting for the stagger
+			  start_candidate(race);
+		  } else if (race->running == 0) {
+			  race->done = true;
+			  if (m_race == race) m_race.reset();
+			  race->handler(ec);
+		  }
+		  return;
+	  }
+	  // the winner: hand its socket over to the client, close the others
+	  *race->target = std::move(*race->sockets[pos]);
+	  race->abandon();
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  m_active = index;
+	  }
+	  if (m_race == race) m_race.reset();
+	  race->handler(boost::system::error_code());
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::cancel()
+  // ------------------------------------------
+  {
+	  if (!m_race) return;
+	  // the client stopped: nobody is waiting for the outcome any more
+	  m_race->abandon();
+	  m_race.reset();
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::async_handshake(Stream& stream, connect_handler handler)
+  // ------------------------------------------
+  {
+	  m_endpoints[std::max(m_active, 0)].transport->async_handshake(stream, handler);
+  }
+
+  // ------------------------------------------
+  TransportOptions::NagleMode FailoverTransport::configure(socket_type& socket, const TransportOptions& options)
+  // ------------------------------------------
+  {
+	  return m_endpoints[std::max(m_active, 0)].transport->configure(socket, options);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::cork(socket_type& socket, bool on)
+  // ------------------------------------------
+  {
+	  m_endpoints[std::max(m_active, 0)].transport->cork(socket, on);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::quick_ack(socket_type& socket)
+  // ------------------------------------------
+  {
+	  m_endpoints[std::max(m_active, 0)].transport->quick_ack(socket);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::connected(const boost::posix_time::time_duration& rtt)
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (m_active < 0) return;
+	  Endpoint& ep = m_endpoints[m_active];
+	  double sample = rtt.total_microseconds() / 1e3;
+	  ep.rtt_ms = (ep.rtt_ms < 0) ? sample : 0.8 * ep.rtt_ms + 0.2 * sample;
+	  ep.failures = 0;
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::failed()
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (m_active < 0) return;
+	  m_endpoints[m_active].failures++;
+	  m_active = -1;
+  }
+
+  // ------------------------------------------
+  bool FailoverTransport::preferred() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  for (size_t i = 0; i < m_endpoints.size(); i++)
+		  if (better(i)) return false;
+	  return true;
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::async_probe(const socket_type::executor_type& ex, probe_handler handler)
+  // ------------------------------------------
+  {
+	  // the fastest endpoint that beats the active one. Health does not
+	  // count here: finding out whether it is back is the point.
+	  int candidate = -1;
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  for (size_t i = 0; i < m_endpoints.size(); i++) {
+			  if (better(i) && ((candidate < 0) ||
+					  (std::max(m_endpoints[i].rtt_ms, 0.0) < std::max(m_endpoints[candidate].rtt_ms, 0.0))))
+				  candidate = i;
+		  }
+	  }
+	  if (candidate < 0) {
+		  post(ex, boost::bind(handler, false));
+		  return;
+	  }
+	  // a plain connect is enough to tell whether it is up
+	  boost::shared_ptr<Probe> probe(new Probe(candidate, ex, handler));
+	  probe->timeout.expires_from_now(boost::posix_time::seconds(5));
+	  probe->timeout.async_wait(boost::bind(&FailoverTransport::handle_probe_timeout, this, probe, placeholders::error));
+	  m_endpoints[candidate].transport->async_connect(probe->socket,
+			  boost::bind(&FailoverTransport::handle_probe, this, probe, placeholders::error));
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::handle_probe(boost::shared_ptr<Probe> probe, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  if (probe->done) return;
+	  probe->done = true;
+	  boost::system::error_code ignored;
+	  probe->timeout.cancel(ignored);
+	  probe->socket.close(ignored);
+	  {
+		  boost::mutex::scoped_lock lock(m_mutex);
+		  Endpoint& ep = m_endpoints[probe->index];
+		  if (ec) ep.failures++;
+		  else ep.failures = 0;
+	  }
+	  probe->handler(!ec);
+  }
+
+  // ------------------------------------------
+  void FailoverTransport::handle_probe_timeout(boost::shared_ptr<Probe> probe, const boost::system::error_code& ec)
+  // ------------------------------------------
+  {
+	  if (ec || probe->done) return;
+	  // fails the connect with operation_aborted
+	  boost::system::error_code ignored;
+	  probe->socket.close(ignored);
+  }
+
+  // ------------------------------------------
+  string FailoverTransport::host() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  return m_endpoints[std::max(m_active, 0)].transport->host();
+  }
+
+  // ------------------------------------------
+  string FailoverTransport::describe() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  if (m_active >= 0) return m_endpoints[m_active].transport->describe();
+	  string result = "failover:(";
+	  for (size_t i = 0; i < m_endpoints.size(); i++)
+		  result += (i ? "," : "") + m_endpoints[i].transport->describe();
+	  return result + ")";
+  }
+
+  // ------------------------------------------
+  std::vector<EndpointStatus> FailoverTransport::endpoints() const
+  // ------------------------------------------
+  {
+	  boost::mutex::scoped_lock lock(m_mutex);
+	  std::vector<EndpointStatus> result;
+	  for (size_t i = 0; i < m_endpoints.size(); i++) {
+		  EndpointStatus st = { m_endpoints[i].transport->describe(), m_endpoints[i].rtt_ms,
+				  m_endpoints[i].failures, int(i) == m_active };
+		  result.push_back(st);
+	  }
+	  return result;
+  }
+
+  // ------------------------------------------
+  PairTransport::PairTransport()
+  // ------------------------------------------
+  {
+	  int fds[2];
+	  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		  throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "socketpair");
+	  m_client_fd = fds[0];
+	  m_peer_fd = fds[1];
+  }
+
+  // ------------------------------------------
+  PairTransport::~PairTransport()
+  // ------------------------------------------
+  {
+	  if (m_client_fd >= 0) ::close(m_client_fd);
+	  if (m_peer_fd >= 0) ::close(m_peer_fd);
+  }
+
+  // ------------------------------------------
+  void PairTransport::async_connect(socket_type& socket, connect_handler handler)
+  // ------------------------------------------
+  {
+	  boost::system::error_code ec;
+	  if (m_client_fd < 0) {
+		  ec = error::not_connected;
+	  } else {
+		  socket.assign(generic::stream_protocol(AF_UNIX, 0), m_client_fd, ec);
+		  if (!ec) m_client_fd = -1;
+	  }
+	  post(socket.get_executor(), boost::bind(handler, ec));
+  }
+
+  // ------------------------------------------
+  void PairTransport::assign_peer(socket_type& socket)
+  // ------------------------------------------
+  {
+	  if (m_peer_fd < 0) throw std::logic_error("PairTransport: peer end already taken");
+	  socket.assign(generic::stream_protocol(AF_UNIX, 0), m_peer_fd);
+	  m_peer_fd = -1;
+  }
+
+} // namespace STOMP
@@ -0,0 +1,361 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp.  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+//	StompTransport.hpp
+//
+// How BoostStomp reaches its broker. Every transport hands the client the
+// same socket type, a generic stream socket, so the read and write actors
+// never care whether it is TCP, a Unix domain socket or one end of an
+// in-memory socketpair: transports only differ in how they connect it.
+// TLS transports additionally wrap the connected socket in an ssl::stream,
+// which the actors reach through the Stream class below. The Stream also
+// feeds a wire capture, if there is one (see StompCapture.hpp).
+//
+//   tcp://host:port          TCP (port defaults to 61613)
+//   ssl://host:port          TLS over TCP (port defaults to 61614), also tls://
+//                            options: ?ca=/path/to/ca.pem  ?verify=none
+//   unix:///path/to/socket   Unix domain stream socket
+//   failover:(uri,uri,...)   a list of brokers, raced on connect (also a bare
+//                            comma separated list), option: ?stagger=<ms>
+//
+
+#ifndef __StompTransport_H_
+#define __StompTransport_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "StompCapture.hpp"
+
+namespace STOMP {
+
+  using std::string;
+
+  namespace detail {
+
+	// an I/O handler that records the bytes transferred before passing them on
+	template <typename BufferSequence, typename Handler>
+	struct capture_handler {
+		boost::shared_ptr<CaptureWriter> 	capture; // outlives a stop_capture() meanwhile
+		CaptureRecordType 				type;
+		BufferSequence 					buffers;
+		Handler 						handler;
+		void operator()(const boost::system::error_code& ec, size_t bytes_transferred) {
+			capture->record_buffers(type, buffers, bytes_transferred);
+			handler(ec, bytes_transferred);
+		}
+	};
+
+  } // namespace detail
+
+  // -------------------------------
+  // the byte stream the read and write actors work on: the transport
+  // socket, or a TLS session on top of it. One predictable branch per
+  // call instead of a virtual one.
+  // -------------------------------
+  class Stream {
+  public:
+	  typedef boost::asio::generic::stream_protocol::socket 	socket_type;
+	  typedef boost::asio::ssl::stream<socket_type&> 			tls_type;
+	  typedef socket_type::executor_type 						executor_type;
+
+	  Stream(socket_type& socket): m_socket(socket) {};
+
+	  executor_type get_executor() 	{ return m_socket.get_executor(); };
+	  socket_type& 	socket() 		{ return m_socket; };
+	  bool 			secure() const 	{ return m_tls.get() != NULL; };
+	  // wrap the (connected) socket in a new TLS session
+	  tls_type& 	start_tls(boost::asio::ssl::context& ctx) { m_tls.reset(new tls_type(m_socket, ctx)); return *m_tls; };
+	  tls_type& 	tls() 			{ return *m_tls; };
+	  // forget the TLS session of a closed connection. Connections are closed
+	  // without a close_notify exchange, so tell OpenSSL not to invalidate
+	  // the session: it is still good for resuming.
+	  void 			reset() {
+		  if (m_tls) SSL_set_shutdown(m_tls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+		  m_tls.reset();
+	  };
+
+	  // record everything read and written from now on (NULL: stop recording)
+	  void 			set_capture(boost::shared_ptr<CaptureWriter> capture) { m_capture = capture; };
+	  CaptureWriter* capture() const { return m_capture.get(); };
+
+	  // AsyncReadStream / AsyncWriteStream / SyncWriteStream requirements
+	  template <typename MutableBufferSequence, typename ReadHandler>
+	  void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+		  if (m_capture) {
+			  detail::capture_handler<MutableBufferSequence, typename std::decay<ReadHandler>::type>
+			  	  op = { m_capture, CAPTURE_IN, buffers, std::forward<ReadHandler>(handler) };
+			  read_some(buffers, std::move(op));
+		  } else {
+			  read_some(buffers, std::forward<ReadHandler>(handler));
+		  }
+	  }
+	  template <typename ConstBufferSequence, typename WriteHandler>
+	  void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+		  if (m_capture) {
+			  detail::capture_handler<ConstBufferSequence, typename std::decay<WriteHandler>::type>
+			  	  op = { m_capture, CAPTURE_OUT, buffers, std::forward<WriteHandler>(handler) };
+			  write_some_async(buffers, std::move(op));
+		  } else {
+			  write_some_async(buffers, std::forward<WriteHandler>(handler));
+		  }
+	  }
+	  template <typename ConstBufferSequence>
+	  size_t write_some(const ConstBufferSequence& buffers, boost::system::error_code& ec) {
+		  size_t n = m_tls ? m_tls->write_some(buffers, ec) : m_socket.write_some(buffers, ec);
+		  if (m_capture) m_capture->record_buffers(CAPTURE_OUT, buffers, n);
+		  return n;
+	  }
+	  template <typename ConstBufferSequence>
+	  size_t write_some(const ConstBufferSequence& buffers) {
+		  size_t n = m_tls ? m_tls->write_some(buffers) : m_socket.write_some(buffers);
+		  if (m_capture) m_capture->record_buffers(CAPTURE_OUT, buffers, n);
+		  return n;
+	  }
+
+  private:
+	  socket_type& 				m_socket;
+	  boost::scoped_ptr<tls_type> m_tls;
+	  boost::shared_ptr<CaptureWriter> m_capture;
+
+	  template <typename MutableBufferSequence, typename ReadHandler>
+	  void read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+		  if (m_tls) 	m_tls->async_read_some(buffers, std::forward<ReadHandler>(handler));
+		  else 		m_socket.async_read_some(buffers, std::forward<ReadHandler>(handler));
+	  }
+	  template <typename ConstBufferSequence, typename WriteHandler>
+	  void write_some_async(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+		  if (m_tls) 	m_tls->async_write_some(buffers, std::forward<WriteHandler>(handler));
+		  else 		m_socket.async_write_some(buffers, std::forward<WriteHandler>(handler));
+	  }
+  };
+
+  // -------------------------------
+  // socket tuning, applied after every connect. TCP-only settings are
+  // ignored by the other transports.
+  // -------------------------------
+  struct TransportOptions {
+	  typedef enum {
+		  NAGLE_ON = 0, 	// the socket's setting is left alone (Nagle, unless the system says otherwise)
+		  NAGLE_OFF, 		// TCP_NODELAY: every write goes out right away
+		  NAGLE_ADAPTIVE 	// TCP_NODELAY, but cork the socket while draining a large batch
+	  } NagleMode;
+
+	  NagleMode nagle;
+	  size_t 	cork_bytes; 		// ADAPTIVE: cork batches of at least this many bytes
+	  int 		send_buffer; 		// SO_SNDBUF, 0: system default
+	  int 		receive_buffer; 	// SO_RCVBUF, 0: system default
+	  bool 		keepalive; 			// SO_KEEPALIVE
+	  int 		keepalive_idle; 	// seconds before the first probe (TCP_KEEPIDLE), 0: system default
+	  bool 		quick_ack; 			// TCP_QUICKACK, re-armed after every read
+
+	  TransportOptions():
+		  nagle(NAGLE_ON), cork_bytes(16384), send_buffer(0), receive_buffer(0),
+		  keepalive(false), keepalive_idle(0), quick_ack(false) {};
+
+	  static const char* nagle_name(NagleMode m);
+  };
+
+  // -------------------------------
+  // transport interface
+  // -------------------------------
+  class Transport {
+  public:
+	  typedef Stream::socket_type socket_type;
+	  typedef boost::function<void (const boost::system::error_code&)> connect_handler;
+	  typedef boost::function<void (bool)> probe_handler;
+
+	  virtual ~Transport() {};
+	  // connect (a closed) socket to the broker, handler runs on the socket's executor
+	  virtual void 	async_connect(socket_type& socket, connect_handler handler) = 0;
+	  // secure a connected stream, if this transport does that (no-op by default)
+	  virtual void 	async_handshake(Stream& stream, connect_handler handler);
+	  // apply options to a connected socket, returns the Nagle mode in effect
+	  virtual TransportOptions::NagleMode configure(socket_type& socket, const TransportOptions& options);
+	  // cork / uncork a socket around a large write (TCP only)
+	  virtual void 	cork(socket_type& /*socket*/, bool /*on*/) {};
+	  // re-arm TCP_QUICKACK after a read (TCP only)
+	  virtual void 	quick_ack(socket_type& /*socket*/) {};
+	  // abandon a connect in progress, its handler may or may not run (with an error)
+	  virtual void 	cancel() {};
+	  // what the client saw of the last connect: CONNECTED after rtt, or the
+	  // session failing (refused, lost). Multi-endpoint transports rank on it.
+	  virtual void 	connected(const boost::posix_time::time_duration& /*rtt*/) {};
+	  virtual void 	failed() {};
+	  // is the client on the best endpoint this transport knows of?
+	  virtual bool 	preferred() const { return true; };
+	  // check whether a better endpoint than the current one answers: void(bool)
+	  virtual void 	async_probe(const socket_type::executor_type& ex, probe_handler handler);
+	  // value for the CONNECT frame's host header
+	  virtual string host() const = 0;
+	  // for log messages, in URI form
+	  virtual string describe() const = 0;
+
+	  // parse a tcp://, ssl://, unix:// or failover: URI, throws std::invalid_argument on anything else
+	  static boost::shared_ptr<Transport> from_uri(const string& uri);
+  };
+
+  // -------------------------------
+  // TCP: tries every address the hostname resolves to
+  // -------------------------------
+  class TcpTransport: public Transport {
+	  void handle_resolve(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::results_type endpoints,
+			  boost::shared_ptr<boost::asio::ip::tcp::resolver> resolver, socket_type* socket, connect_handler handler);
+  protected:
+	  string 	m_hostname;
+	  int 		m_port;
+  public:
+	  TcpTransport(const string& hostname, int port): m_hostname(hostname), m_port(port) {};
+	  void 	async_connect(socket_type& socket, connect_handler handler);
+	  TransportOptions::NagleMode configure(socket_type& socket, const TransportOptions& options);
+	  void 	cork(socket_type& socket, bool on);
+	  void 	quick_ack(socket_type& socket);
+	  string host() const { return m_hostname; };
+	  string describe() const;
+  };
+
+  // -------------------------------
+  // TLS over TCP. The transport keeps the last session the broker gave us
+  // and offers it on the next handshake, so a reconnect (eg. after a broker
+  // failover) resumes the session instead of doing a full handshake.
+  // Configure certificates through context() before starting the client.
+  // -------------------------------
+  class TlsTransport: public TcpTransport {
+	  boost::asio::ssl::context 	m_context;
+	  bool 						m_verify;
+	  boost::mutex 				m_session_mutex;
+	  SSL_SESSION* 				m_session; 	// owned, may be NULL
+
+	  static int new_session(SSL* ssl, SSL_SESSION* session);
+  public:
+	  // verify: check the broker certificate against the trusted CAs and its host name
+	  TlsTransport(const string& hostname, int port, bool verify = true);
+	  ~TlsTransport();
+	  void 	async_handshake(Stream& stream, connect_handler handler);
+	  string describe() const;
+	  boost::asio::ssl::context& context() { return m_context; };
+  };
+
+  // -------------------------------
+  // Unix domain stream socket, for brokers on the same host
+  // -------------------------------
+  class UnixTransport: public Transport {
+	  string 	m_path;
+  public:
+	  UnixTransport(const string& path): m_path(path) {};
+	  void 	async_connect(socket_type& socket, connect_handler handler);
+	  string host() const { return "localhost"; };
+	  string describe() const { return "unix://" + m_path; };
+  };
+
+  // -------------------------------
+  // A list of brokers, eg. one per rack. Connecting races them happy-eyeballs
+  // style: the best ranked endpoint starts, every stagger interval (or as soon
+  // as an attempt fails) the next one joins in, and the first one to connect
+  // wins. Endpoints rank by health (no failure since they last worked), then
+  // by the RTT the client measured from CONNECT to CONNECTED, then by their
+  // place in the list. An endpoint not measured yet counts as the fastest, so
+  // it gets tried once. While the client is on a worse endpoint, preferred()
+  // is false and async_probe() checks whether the better one is back.
+  // -------------------------------
+  struct EndpointStatus {
+	  string 	uri;
+	  double 	rtt_ms; 	// smoothed CONNECT-to-CONNECTED time, < 0: not measured yet
+	  unsigned 	failures; 	// since it last worked
+	  bool 		active;
+  };
+
+  class FailoverTransport: public Transport {
+	  struct Endpoint {
+		  boost::shared_ptr<Transport> 	transport;
+		  double 						rtt_ms;
+		  unsigned 						failures;
+	  };
+	  struct Race;
+	  struct Probe;
+
+	  mutable boost::mutex 				m_mutex; 	// for readers outside the IO thread
+	  std::vector<Endpoint> 			m_endpoints;
+	  int 								m_active; 	// -1 while not connected
+	  boost::posix_time::time_duration 	m_stagger;
+	  boost::shared_ptr<Race> 			m_race; 	// connect in progress
+
+	  std::vector<size_t> ranking() const;
+	  bool better(size_t candidate) const;
+	  void start_candidate(boost::shared_ptr<Race> race);
+	  void handle_candidate(boost::shared_ptr<Race> race, size_t pos, const boost::system::error_code& ec);
+	  void handle_stagger(boost::shared_ptr<Race> race, const boost::system::error_code& ec);
+	  void handle_probe(boost::shared_ptr<Probe> probe, const boost::system::error_code& ec);
+	  void handle_probe_timeout(boost::shared_ptr<Probe> probe, const boost::system::error_code& ec);
+  public:
+	  // a better endpoint must be this much faster to be worth moving to
+	  static const double HYSTERESIS;
+
+	  FailoverTransport(const std::vector< boost::shared_ptr<Transport> >& endpoints,
+			  const boost::posix_time::time_duration& stagger = boost::posix_time::milliseconds(250));
+	  void 	async_connect(socket_type& socket, connect_handler handler);
+	  void 	async_handshake(Stream& stream, connect_handler handler);
+	  TransportOptions::NagleMode configure(socket_type& socket, const TransportOptions& options);
+	  void 	cork(socket_type& socket, bool on);
+	  void 	quick_ack(socket_type& socket);
+	  void 	cancel();
+	  void 	connected(const boost::posix_time::time_duration& rtt);
+	  void 	failed();
+	  bool 	preferred() const;
+	  void 	async_probe(const socket_type::executor_type& ex, probe_handler handler);
+	  string host() const;
+	  string describe() const;
+	  // health and RTT of every endpoint, in list order
+	  std::vector<EndpointStatus> endpoints() const;
+  };
+
+  // -------------------------------
+  // In-memory transport: a connected socketpair, the client gets one end
+  // and the test (or replay) code plays the broker on the other one.
+  // A pair connects exactly once.
+  // -------------------------------
+  class PairTransport: public Transport {
+	  int 	m_client_fd;
+	  int 	m_peer_fd;
+  public:
+	  PairTransport();
+	  ~PairTransport();
+	  void 	async_connect(socket_type& socket, connect_handler handler);
+	  string host() const { return "localhost"; };
+	  string describe() const { return "pair://"; };
+	  // hand the broker end over to a socket (owned by the caller from then on)
+	  void 	assign_peer(socket_type& socket);
+  };
+
+} // namespace STOMP
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//
+// AsyncTest.cpp: the asio-style operations of pull subscriptions, with
+// plain callback handlers run on a test io_service
+//
+
+#define BOOST_TEST_MODULE async
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "BoostStomp.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+typedef vector< boost::shared_ptr<Frame> > frame_list;
+
+// the outcome of an async_next / async_next_batch
+struct Result {
+	int 						calls;
+	boost::system::error_code 	ec;
+	frame_list 					frames;
+	Result(): calls(0) {};
+};
+
+struct NextHandler {
+	Result* r;
+	void operator()(boost::system::error_code ec, boost::shared_ptr<Frame> frame) {
+		r->calls++;
+		r->ec = ec;
+		if (frame) r->frames.push_back(frame);
+	}
+};
+
+struct BatchHandler {
+	Result* r;
+	void operator()(boost::system::error_code ec, frame_list frames) {
+		r->calls++;
+		r->ec = ec;
+		r->frames.insert(r->frames.end(), frames.begin(), frames.end());
+	}
+};
+
+// an allocator counting what it hands out, for handlers that carry one
+template <typename T>
+struct CountingAllocator {
+	typedef T value_type;
+	int* allocated; 	// objects currently allocated
+	explicit CountingAllocator(int* n): allocated(n) {};
+	template <typename U>
+	CountingAllocator(const CountingAllocator<U>& other): allocated(other.allocated) {};
+	T* allocate(size_t n) {
+		(*allocated)++;
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t) {
+		(*allocated)--;
+		::operator delete(p);
+	}
+	template <typename U>
+	bool operator==(const CountingAllocator<U>& other) const { return allocated == other.allocated; };
+	template <typename U>
+	bool operator!=(const CountingAllocator<U>& other) const { return allocated != other.allocated; };
+};
+
+struct AllocatingHandler: NextHandler {
+	typedef CountingAllocator<void> allocator_type;
+	typedef boost::asio::io_context::executor_type executor_type;
+	int* allocated;
+	boost::asio::io_context* io;
+	allocator_type get_allocator() const { return allocator_type(allocated); };
+	executor_type get_executor() const { return io->get_executor(); };
+};
+
+// run the handlers posted so far, without hanging on a parked operation
+static void run(boost::asio::io_context& io) {
+	io.restart();
+	io.run_for(std::chrono::milliseconds(200));
+}
+
+// the same, for an operation completed from the IO thread: io has nothing to
+// run until the client posts the completion, so poll until it does
+static void run_until_called(boost::asio::io_context& io, const Result& r) {
+	boost::asio::steady_timer::time_point deadline =
+			boost::asio::steady_timer::clock_type::now() + std::chrono::seconds(5);
+	while ((r.calls == 0) && (boost::asio::steady_timer::clock_type::now() < deadline)) {
+		io.restart();
+		io.run_for(std::chrono::milliseconds(10));
+	}
+}
+
+// a subscription without a client is what one looks like after detach()
+BOOST_AUTO_TEST_CASE(detached_subscription_aborts_waiters)
+{
+	boost::asio::io_context io;
+	Subscription sub(NULL, "/queue/a");
+	Result next, batch;
+	sub.async_next(boost::asio::bind_executor(io, NextHandler{ &next }));
+	sub.async_next_batch(8, boost::asio::bind_executor(io, BatchHandler{ &batch }));
+	run(io);
+	BOOST_CHECK_EQUAL(next.calls, 1);
+	BOOST_CHECK(next.ec == boost::asio::error::operation_aborted);
+	BOOST_CHECK_EQUAL(batch.calls, 1);
+	BOOST_CHECK(batch.ec == boost::asio::error::operation_aborted);
+	BOOST_CHECK(batch.frames.empty());
+}
+
+BOOST_AUTO_TEST_CASE(cancel_completes_the_waiter)
+{
+	boost::asio::io_context io;
+	boost::shared_ptr<PairTransport> pair(new PairTransport());
+	BoostStomp client(pair);
+	client.start(); 	// the subscription is registered on the IO thread
+	std::string topic("/queue/a");
+	boost::shared_ptr<Subscription> sub = client.subscribe(topic);
+	Result next;
+	sub->async_next(boost::asio::bind_executor(io, NextHandler{ &next }));
+	run(io);
+	BOOST_CHECK_EQUAL(next.calls, 0); 	// parked
+	sub->cancel();
+	run(io);
+	BOOST_CHECK_EQUAL(next.calls, 1);
+	BOOST_CHECK(next.ec == boost::asio::error::operation_aborted);
+	// a second waiter is parked again, and aborted once the client is gone
+	Result again;
+	sub->async_next(boost::asio::bind_executor(io, NextHandler{ &again }));
+	client.unsubscribe(topic);
+	run_until_called(io, again);
+	BOOST_CHECK_EQUAL(again.calls, 1);
+	BOOST_CHECK(again.ec == boost::asio::error::operation_aborted);
+	// from then on, waiters complete right away
+	Result late;
+	sub->async_next(boost::asio::bind_executor(io, NextHandler{ &late }));
+	run(io);
+	BOOST_CHECK_EQUAL(late.calls, 1);
+	BOOST_CHECK(late.ec == boost::asio::error::operation_aborted);
+	client.stop();
+}
+
+BOOST_AUTO_TEST_CASE(operations_use_the_handler_allocator)
+{
+	boost::asio::io_context io;
+	Subscription sub(NULL, "/queue/a");
+	Result next;
+	int allocated = 0;
+	AllocatingHandler handler;
+	handler.r = &next;
+	handler.allocated = &allocated;
+	handler.io = &io;
+	sub.async_next(handler);
+	// the operation was made with the handler's allocator, and given back
+	// before the handler was posted
+	BOOST_CHECK_EQUAL(allocated, 0);
+	run(io);
+	BOOST_CHECK_EQUAL(next.calls, 1);
+
+	// parked until cancelled
+	boost::shared_ptr<PairTransport> pair(new PairTransport());
+	BoostStomp client(pair);
+	client.start();
+	std::string topic("/queue/a");
+	boost::shared_ptr<Subscription> live = client.subscribe(topic);
+	live->async_next(handler);
+	BOOST_CHECK_EQUAL(allocated, 1);
+	live->cancel();
+	BOOST_CHECK_EQUAL(allocated, 0);
+	run(io);
+	BOOST_CHECK_EQUAL(next.calls, 2);
+	client.stop();
+}
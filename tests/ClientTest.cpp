@@ -0,0 +1,138 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//
+// ClientTest.cpp: whole sessions over a PairTransport, the broker end played
+// by a script (CONNECTED, SUBSCRIBE, MESSAGE, ACK / NACK)
+//
+
+#define BOOST_TEST_MODULE client
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+
+#include "BoostStomp.hpp"
+#include "ScriptedBroker.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+static string message(const string& dest, const string& headers, const string& body) {
+	return "MESSAGE\ndestination:" + dest + "\n" + headers + "\n" + body;
+}
+
+// the callback of the push subscription: accepts all but "reject"
+static boost::atomic<int> delivered(0);
+static bool on_message(Frame* frame) {
+	delivered++;
+	boost::string_view b = frame->body_view();
+	return string(b.data(), b.size()) != "reject";
+}
+
+BOOST_AUTO_TEST_CASE(stomp12_callback_acks_and_nacks)
+{
+	ScriptedBroker broker;
+	BoostStomp client(broker.transport, ACK_CLIENT_INDIVIDUAL);
+	string topic("/queue/acks");
+	delivered = 0;
+
+	BrokerThread script(broker, [&](ScriptedBroker& b) {
+		ScriptedBroker::Received connect = b.expect("CONNECT");
+		if (connect["accept-version"].find("1.2") == string::npos)
+			throw runtime_error("CONNECT without 1.2: " + connect["accept-version"]);
+		b.send("CONNECTED\nversion:1.2\n\n");
+		ScriptedBroker::Received sub = b.expect("SUBSCRIBE");
+		if (sub["destination"] != topic) throw runtime_error("SUBSCRIBE to " + sub["destination"]);
+		if (sub["ack"] != "client-individual") throw runtime_error("SUBSCRIBE with ack:" + sub["ack"]);
+		b.send(message(topic, "message-id:m1\nsubscription:" + sub["id"] + "\nack:a\\c1\n", "accept"));
+		// 1.2 acknowledges by the ack header, escaped on the wire both ways
+		ScriptedBroker::Received ack = b.expect("ACK");
+		if (ack["id"] != "a:1") throw runtime_error("ACK id:" + ack["id"]);
+		b.send(message(topic, "message-id:m2\nsubscription:" + sub["id"] + "\nack:a2\n", "reject"));
+		ScriptedBroker::Received nack = b.expect("NACK");
+		if (nack["id"] != "a2") throw runtime_error("NACK id:" + nack["id"]);
+	});
+
+	client.subscribe(topic, &on_message);
+	client.start();
+	BOOST_CHECK_EQUAL(script.join(), "");
+	client.stop();
+	BOOST_CHECK_EQUAL(delivered.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(stomp11_pull_subscription_acks_when_handed_out)
+{
+	ScriptedBroker broker;
+	BoostStomp client(broker.transport, ACK_CLIENT);
+	string topic("/queue/pull");
+
+	BrokerThread script(broker, [&](ScriptedBroker& b) {
+		b.expect("CONNECT");
+		b.send("CONNECTED\nversion:1.1\n\n");
+		ScriptedBroker::Received sub = b.expect("SUBSCRIBE");
+		if (sub["ack"] != "client") throw runtime_error("SUBSCRIBE with ack:" + sub["ack"]);
+		b.send(message(topic, "message-id:m1\nsubscription:" + sub["id"] + "\n", "pulled"));
+		// 1.1 acknowledges by message-id, naming the subscription
+		ScriptedBroker::Received ack = b.expect("ACK");
+		if (ack["message-id"] != "m1") throw runtime_error("ACK message-id:" + ack["message-id"]);
+		if (ack["subscription"] != sub["id"]) throw runtime_error("ACK subscription:" + ack["subscription"]);
+	});
+
+	client.start(); 	// the queue is registered on the IO thread
+	boost::shared_ptr<Subscription> sub = client.subscribe(topic);
+	vector< boost::shared_ptr<Frame> > frames;
+	client.poll(sub, frames, 8, boost::posix_time::seconds(5));
+	BOOST_CHECK_EQUAL(script.join(), "");
+	client.stop();
+	BOOST_REQUIRE_EQUAL(frames.size(), 1u);
+	boost::string_view b = frames[0]->body_view();
+	BOOST_CHECK_EQUAL(string(b.data(), b.size()), "pulled");
+}
+
+BOOST_AUTO_TEST_CASE(empty_error_frame_is_not_fatal)
+{
+	// an ERROR frame with an empty body is logged, not fatal to the session
+	ScriptedBroker broker;
+	BoostStomp client(broker.transport, ACK_CLIENT_INDIVIDUAL);
+	string topic("/queue/after-error");
+	delivered = 0;
+
+	BrokerThread script(broker, [&](ScriptedBroker& b) {
+		b.expect("CONNECT");
+		b.send("CONNECTED\nversion:1.2\n\n");
+		ScriptedBroker::Received sub = b.expect("SUBSCRIBE");
+		b.send("ERROR\nmessage:just a warning\n\n");
+		b.send(message(topic, "message-id:m1\nsubscription:" + sub["id"] + "\nack:a1\n", "accept"));
+		if (b.expect("ACK")["id"] != "a1") throw runtime_error("wrong ACK");
+	});
+
+	client.subscribe(topic, &on_message);
+	client.start();
+	BOOST_CHECK_EQUAL(script.join(), "");
+	client.stop();
+	BOOST_CHECK_EQUAL(delivered.load(), 1);
+}
@@ -0,0 +1,206 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//
+// CodecTest.cpp: the per-version frame codecs, frames encoded and parsed
+// back through a streambuf, as the client does on the wire
+//
+
+#define BOOST_TEST_MODULE codec
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <boost/asio.hpp>
+
+#include "StompFrame.hpp"
+#include "StompCodec.hpp"
+
+using namespace STOMP;
+using namespace std;
+
+static const stomp_server_command_map_t no_custom_commands;
+
+static string wire(const Frame& frame, const FrameCodec& codec) {
+	boost::asio::streambuf sb;
+	codec.encode(frame, sb);
+	return string(boost::asio::buffer_cast<const char*>(sb.data()), sb.size());
+}
+
+// parse a frame from its wire form, the body included
+static void parse(Frame& frame, const string& raw, const FrameCodec& codec) {
+	boost::asio::streambuf sb;
+	sb.sputn(raw.data(), raw.size());
+	frame.parse_head(sb, no_custom_commands, codec);
+	frame.parse_body(sb);
+}
+
+// a MESSAGE with the given header, encoded and parsed back
+static string round_trip(const FrameCodec& codec, const string& key, const string& value) {
+	hdrmap h;
+	h["destination"] = "/queue/a";
+	h[key] = value;
+	Frame in(CMD_MESSAGE, h, binbody(string("body")));
+	Frame out(CMD_MESSAGE);
+	parse(out, wire(in, codec), codec);
+	BOOST_CHECK_EQUAL(string(out.body_view().data(), out.body_view().size()), "body");
+	hdrmap::iterator it = out.headers().find(key);
+	BOOST_REQUIRE(it != out.headers().end());
+	return it->second;
+}
+
+BOOST_AUTO_TEST_CASE(for_version)
+{
+	BOOST_CHECK_EQUAL(FrameCodec::for_version("1.0").version(), STOMP_1_0);
+	BOOST_CHECK_EQUAL(FrameCodec::for_version("1.1").version(), STOMP_1_1);
+	BOOST_CHECK_EQUAL(FrameCodec::for_version("1.2").version(), STOMP_1_2);
+	BOOST_CHECK_EQUAL(FrameCodec::for_version("2.0").version(), STOMP_1_0);
+	BOOST_CHECK(!FrameCodec::for_version(STOMP_1_0).supports_nack());
+	BOOST_CHECK(FrameCodec::for_version(STOMP_1_1).supports_heartbeat());
+}
+
+BOOST_AUTO_TEST_CASE(stomp10_writes_headers_verbatim)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_0);
+	hdrmap h;
+	h["x-path"] = "c:\\tmp";
+	string raw = wire(Frame(CMD_SEND, h), codec);
+	BOOST_CHECK_EQUAL(raw, string("SEND\nx-path:c:\\tmp\n\n") + '\0');
+	BOOST_CHECK_EQUAL(round_trip(codec, "x-path", "c:\\tmp\\n"), "c:\\tmp\\n");
+}
+
+BOOST_AUTO_TEST_CASE(stomp11_escapes)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_1);
+	hdrmap h;
+	h["x:key"] = "a:b\nc\\d";
+	string raw = wire(Frame(CMD_SEND, h), codec);
+	BOOST_CHECK_EQUAL(raw, string("SEND\nx\\ckey:a\\cb\\nc\\\\d\n\n") + '\0');
+	BOOST_CHECK_EQUAL(round_trip(codec, "x:key", "a:b\nc\\d"), "a:b\nc\\d");
+	// 1.1 has no \r escape: a carriage return goes out as it is
+	h.clear();
+	h["x-cr"] = "a\rb";
+	BOOST_CHECK_EQUAL(wire(Frame(CMD_SEND, h), codec), string("SEND\nx-cr:a\rb\n\n") + '\0');
+	BOOST_CHECK_EQUAL(round_trip(codec, "x-cr", "a\rb"), "a\rb");
+}
+
+BOOST_AUTO_TEST_CASE(stomp12_escapes_cr)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_2);
+	hdrmap h;
+	h["x-cr"] = "a\r\nb:c";
+	string raw = wire(Frame(CMD_SEND, h), codec);
+	BOOST_CHECK_EQUAL(raw, string("SEND\nx-cr:a\\r\\nb\\cc\n\n") + '\0');
+	BOOST_CHECK_EQUAL(round_trip(codec, "x-cr", "a\r\nb:c"), "a\r\nb:c");
+	BOOST_CHECK_EQUAL(round_trip(codec, "x-end", "trailing\r"), "trailing\r");
+}
+
+BOOST_AUTO_TEST_CASE(stomp12_crlf_line_endings)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_2);
+	Frame f(CMD_MESSAGE);
+	parse(f, string("MESSAGE\r\ndestination:/queue/a\r\nmessage-id:7\r\n\r\nhi") + '\0', codec);
+	BOOST_CHECK_EQUAL(f.command_id(), CMD_MESSAGE);
+	BOOST_CHECK_EQUAL(f.header(HDR_DESTINATION), "/queue/a");
+	BOOST_CHECK_EQUAL(f.header("message-id"), "7");
+	BOOST_CHECK_EQUAL(f.headers()["message-id"], "7");
+}
+
+BOOST_AUTO_TEST_CASE(undefined_escapes_are_kept)
+{
+	BOOST_CHECK_EQUAL(Stomp11Codec::decode_token("a\\tb", 4), "a\\tb");
+	BOOST_CHECK_EQUAL(Stomp12Codec::decode_token("a\\tb", 4), "a\\tb");
+	// \r is only defined from 1.2 on
+	BOOST_CHECK_EQUAL(Stomp11Codec::decode_token("a\\rb", 4), "a\\rb");
+	BOOST_CHECK_EQUAL(Stomp12Codec::decode_token("a\\rb", 4), "a\rb");
+	// a lone backslash at the end
+	BOOST_CHECK_EQUAL(Stomp12Codec::decode_token("ab\\", 3), "ab\\");
+	// 1.0 does not unescape at all
+	BOOST_CHECK_EQUAL(Stomp10Codec::decode_token("a\\nb", 4), "a\\nb");
+
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_2);
+	Frame f(CMD_MESSAGE);
+	parse(f, string("MESSAGE\nx-odd:a\\tb\\cc\n\n") + '\0', codec);
+	BOOST_CHECK_EQUAL(f.header("x-odd"), "a\\tb:c");
+}
+
+BOOST_AUTO_TEST_CASE(lazy_lookup_unescapes)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_1);
+	Frame f(CMD_MESSAGE);
+	parse(f, string("MESSAGE\ndestination:/topic/a\\cb\nx-plain:v\nx-plain:second\n\n") + '\0', codec);
+	// well-known header, escaped: decoded on lookup
+	BOOST_CHECK_EQUAL(f.header(HDR_DESTINATION), "/topic/a:b");
+	// repeated headers: the first one counts
+	BOOST_CHECK_EQUAL(f.header("x-plain"), "v");
+	BOOST_CHECK(f.header("x-missing").empty());
+}
+
+BOOST_AUTO_TEST_CASE(connected_is_not_unescaped)
+{
+	const FrameCodec& codec = FrameCodec::for_version(STOMP_1_2);
+	Frame f(CMD_CONNECTED);
+	parse(f, string("CONNECTED\nversion:1.2\nserver:broker\\c1\n\n") + '\0', codec);
+	BOOST_CHECK_EQUAL(f.command_id(), CMD_CONNECTED);
+	BOOST_CHECK_EQUAL(f.header(HDR_VERSION), "1.2");
+	BOOST_CHECK_EQUAL(f.header("server"), "broker\\c1");
+}
+
+// the ACK headers each version builds for a received MESSAGE
+static hdrmap ack_for(ProtocolVersion v, const string& raw) {
+	const FrameCodec& codec = FrameCodec::for_version(v);
+	Frame msg(CMD_MESSAGE);
+	parse(msg, raw, codec);
+	hdrmap h;
+	codec.ack_headers(msg, h);
+	return h;
+}
+
+BOOST_AUTO_TEST_CASE(ack_headers)
+{
+	string raw = string("MESSAGE\ndestination:/queue/a\nmessage-id:m\\c1\n"
+			"subscription:s1\nack:a\\c7\n\nx") + '\0';
+
+	hdrmap h = ack_for(STOMP_1_0, raw);
+	BOOST_CHECK_EQUAL(h.size(), 1u);
+	BOOST_CHECK_EQUAL(h["message-id"], "m\\c1"); 	// 1.0: as received
+
+	h = ack_for(STOMP_1_1, raw);
+	BOOST_CHECK_EQUAL(h.size(), 2u);
+	BOOST_CHECK_EQUAL(h["message-id"], "m:1");
+	BOOST_CHECK_EQUAL(h["subscription"], "s1");
+
+	h = ack_for(STOMP_1_2, raw);
+	BOOST_CHECK_EQUAL(h.size(), 1u);
+	BOOST_CHECK_EQUAL(h["id"], "a:7");
+
+	// and back on the wire, escaped again
+	hdrmap ack = ack_for(STOMP_1_2, raw);
+	BOOST_CHECK_EQUAL(wire(Frame(CMD_ACK, ack), FrameCodec::for_version(STOMP_1_2)),
+			string("ACK\nid:a\\c7\n\n") + '\0');
+
+	// a MESSAGE without the header to copy
+	h = ack_for(STOMP_1_2, string("MESSAGE\ndestination:/queue/a\nmessage-id:1\n\n") + '\0');
+	BOOST_CHECK(h.empty());
+}
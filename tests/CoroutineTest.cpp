@@ -0,0 +1,140 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//
+// CoroutineTest.cpp: the C++20 coroutine flavours of the asynchronous API
+// (connect, send_confirmed, Subscription::next / next_batch) against a
+// scripted broker. Built with -std=c++20, see the Makefile.
+//
+
+#define BOOST_TEST_MODULE coroutine
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/asio.hpp>
+#if !defined(BOOST_ASIO_HAS_CO_AWAIT)
+#error "CoroutineTest needs C++20 coroutines, build it with -std=c++20"
+#endif
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+
+#include "BoostStomp.hpp"
+#include "ScriptedBroker.hpp"
+
+using namespace STOMP;
+using namespace std;
+using boost::asio::awaitable;
+
+static string body_of(const boost::shared_ptr<Frame>& frame) {
+	boost::string_view b = frame->body_view();
+	return string(b.data(), b.size());
+}
+
+static string message(const string& dest, int id, const string& body) {
+	return "MESSAGE\ndestination:" + dest + "\nmessage-id:" + to_string(id) +
+			"\nsubscription:0\n\n" + body;
+}
+
+BOOST_AUTO_TEST_CASE(connect_send_confirmed_next)
+{
+	boost::asio::io_context io; 	// outlives the client: its handlers run here
+	ScriptedBroker broker;
+	BoostStomp client(broker.transport);
+	string topic("/queue/co");
+
+	BrokerThread script(broker, [&](ScriptedBroker& b) {
+		b.expect("CONNECT");
+		b.send("CONNECTED\nversion:1.2\n\n");
+		if (b.expect("SUBSCRIBE")["destination"] != topic) throw runtime_error("SUBSCRIBE to the wrong destination");
+		b.send(message(topic, 1, "first"));
+		ScriptedBroker::Received send = b.expect("SEND");
+		if (send.body != "confirmed") throw runtime_error("SEND body: " + send.body);
+		b.send("RECEIPT\nreceipt-id:" + send["receipt"] + "\n\n");
+		for (int i = 2; i <= 4; i++) b.send(message(topic, i, "batch" + to_string(i)));
+	});
+
+	vector<string> bodies;
+	bool done = false;
+	std::exception_ptr failure;
+	boost::asio::co_spawn(io, [&]() -> awaitable<void> {
+		co_await client.connect(); 	// starts the client
+		boost::shared_ptr<Subscription> sub = client.subscribe(topic);
+		bodies.push_back(body_of(co_await sub->next()));
+		co_await client.send_confirmed(topic, hdrmap(), string("confirmed"));
+		while (bodies.size() < 4) {
+			vector< boost::shared_ptr<Frame> > batch = co_await sub->next_batch(8);
+			for (size_t i = 0; i < batch.size(); i++) bodies.push_back(body_of(batch[i]));
+		}
+		done = true;
+	}, [&](std::exception_ptr e) { failure = e; });
+	io.run_for(std::chrono::seconds(10));
+
+	BOOST_CHECK_EQUAL(script.join(), "");
+	client.stop();
+	if (failure) {
+		try { std::rethrow_exception(failure); }
+		catch (std::exception& e) { BOOST_ERROR(string("coroutine failed: ") + e.what()); }
+	}
+	BOOST_REQUIRE(done);
+	BOOST_CHECK_EQUAL(bodies.size(), 4u);
+	BOOST_CHECK_EQUAL(bodies[0], "first");
+	BOOST_CHECK_EQUAL(bodies[1], "batch2");
+	BOOST_CHECK_EQUAL(bodies[3], "batch4");
+}
+
+BOOST_AUTO_TEST_CASE(send_confirmed_fails_on_error)
+{
+	boost::asio::io_context io;
+	ScriptedBroker broker;
+	BoostStomp client(broker.transport);
+	string topic("/queue/co");
+
+	BrokerThread script(broker, [&](ScriptedBroker& b) {
+		b.expect("CONNECT");
+		b.send("CONNECTED\nversion:1.2\n\n");
+		ScriptedBroker::Received send = b.expect("SEND");
+		b.send("ERROR\nreceipt-id:" + send["receipt"] + "\nmessage:not allowed\n\n");
+	});
+
+	boost::system::error_code ec;
+	bool done = false;
+	boost::asio::co_spawn(io, [&]() -> awaitable<void> {
+		co_await client.connect();
+		try {
+			co_await client.send_confirmed(topic, hdrmap(), string("rejected"));
+		} catch (boost::system::system_error& e) {
+			ec = e.code();
+		}
+		done = true;
+	}, boost::asio::detached);
+	io.run_for(std::chrono::seconds(10));
+
+	BOOST_CHECK_EQUAL(script.join(), "");
+	client.stop();
+	BOOST_REQUIRE(done);
+	BOOST_CHECK(ec == boost::system::errc::protocol_error);
+}
@@ -0,0 +1,170 @@
+/*
+ BoostStomp - a STOMP (Simple Text Oriented Messaging Protocol) client
+----------------------------------------------------
+Copyright (c) 2012 Elias Karakoulakis <elias.karakoulakis@gmail.com>
+
+SOFTWARE NOTICE AND LICENSE
+
+BoostStomp is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+BoostStomp is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with BoostStomp .  If not, see <http://www.gnu.org/licenses/>.
+
+for more information on the LGPL, see:
+http://en.wikipedia.org/wiki/GNU_Lesser_General_Public_License
+*/
+
+
+//
+// ScriptedBroker.hpp: the broker end of a PairTransport, played by a test.
+// It reads the frames the client sends and writes canned replies, so a
+// whole session can be scripted without a real broker:
+//
+//    ScriptedBroker broker;
+//    BoostStomp client(broker.transport);
+//    BrokerThread script(broker, [](ScriptedBroker& b) {
+//        b.expect("CONNECT");
+//        b.send("CONNECTED\nversion:1.2\n\n");
+//    });
+//    client.start();
+//    ...
+//    BOOST_CHECK_EQUAL(script.join(), "");
+//
+
+#ifndef __ScriptedBroker_H_
+#define __ScriptedBroker_H_
+
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <cstring>
+#include <poll.h>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "StompFrame.hpp"
+#include "StompCodec.hpp"
+#include "StompTransport.hpp"
+
+namespace STOMP {
+
+  class ScriptedBroker {
+  public:
+	  // a frame as the client sent it, headers decoded
+	  struct Received {
+		  std::string command;
+		  hdrmap 		headers;
+		  std::string body;
+		  const std::string& operator[](const std::string& key) {
+			  if (headers.find(key) == headers.end())
+				  throw std::runtime_error(command + " without a " + key + " header");
+			  return headers[key];
+		  };
+	  };
+
+	  // how long to wait for the client before giving up
+	  static const int TIMEOUT_MS = 5000;
+
+	  boost::shared_ptr<PairTransport> transport;
+
+	  ScriptedBroker(): transport(new PairTransport()), m_peer(m_io) {
+		  transport->assign_peer(m_peer);
+	  };
+
+	  // the next frame from the client, heartbeats skipped
+	  Received receive() {
+		  size_t nul;
+		  while ((nul = m_in.find('\0')) == std::string::npos) {
+			  // poll first: a client that goes quiet fails the test, not hangs it
+			  struct pollfd pfd = { m_peer.native_handle(), POLLIN, 0 };
+			  if (::poll(&pfd, 1, TIMEOUT_MS) <= 0)
+				  throw std::runtime_error("timed out waiting for a frame");
+			  char buf[4096];
+			  boost::system::error_code ec;
+			  size_t n = m_peer.read_some(boost::asio::buffer(buf), ec);
+			  if (ec) throw std::runtime_error("client closed the connection: " + ec.message());
+			  m_in.append(buf, n);
+		  }
+		  std::string raw = m_in.substr(0, nul);
+		  m_in.erase(0, nul + 1);
+		  size_t start = raw.find_first_not_of("\r\n");
+		  if (start == std::string::npos) throw std::runtime_error("empty frame");
+		  raw.erase(0, start);
+		  Received f;
+		  size_t eol = raw.find('\n');
+		  size_t blank = raw.find("\n\n");
+		  if ((eol == std::string::npos) || (blank == std::string::npos))
+			  throw std::runtime_error("malformed frame: " + raw);
+		  f.command = raw.substr(0, eol);
+		  bool connect = (f.command == "CONNECT") || (f.command == "STOMP");
+		  if (blank > eol)
+			  FrameCodec::for_version(STOMP_1_2).decode_headers(raw.data() + eol + 1, blank - eol, connect, f.headers);
+		  f.body = raw.substr(blank + 2);
+		  return f;
+	  };
+
+	  // the next frame, which has to be a command
+	  Received expect(const std::string& command) {
+		  Received f = receive();
+		  if (f.command != command)
+			  throw std::runtime_error("expected " + command + ", got " + f.command);
+		  return f;
+	  };
+
+	  // write a frame given up to its body, the terminating NULL is added
+	  void send(const std::string& frame) {
+		  std::string raw = frame;
+		  raw += '\0';
+		  boost::asio::write(m_peer, boost::asio::buffer(raw));
+	  };
+
+	  // drop the connection, as a broker going away
+	  void close() {
+		  boost::system::error_code ec;
+		  m_peer.shutdown(Transport::socket_type::shutdown_both, ec);
+		  m_peer.close(ec);
+	  };
+
+  private:
+	  boost::asio::io_service 	m_io;
+	  Transport::socket_type 	m_peer;
+	  std::string 				m_in; 	// read, not parsed yet
+  };
+
+  // runs a broker script on its own thread, concurrently with the client.
+  // The script reports a failure by throwing.
+  class BrokerThread {
+	  std::string 	m_error;
+	  boost::thread m_thread;
+
+	  void run(ScriptedBroker* broker, std::function<void(ScriptedBroker&)> script) {
+		  try {
+			  script(*broker);
+		  } catch (std::exception& e) {
+			  m_error = e.what();
+		  }
+	  };
+  public:
+	  BrokerThread(ScriptedBroker& broker, std::function<void(ScriptedBroker&)> script):
+		  m_thread(boost::bind(&BrokerThread::run, this, &broker, script)) {};
+	  ~BrokerThread() { if (m_thread.joinable()) m_thread.join(); };
+	  // wait for the script to end: what went wrong, empty if nothing did
+	  std::string join() {
+		  m_thread.join();
+		  return m_error;
+	  };
+  };
+
+} // namespace STOMP
+
+#endif